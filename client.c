@@ -14,38 +14,87 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/param.h>
 #include <sys/types.h>
 
+#include <ctype.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "coma.h"
 
+/*
+ * Title changes a client may have handled per second and in a burst,
+ * anything beyond that collapses into one update once a token is back.
+ */
+#define CLIENT_TITLE_RATE	10
+#define CLIENT_TITLE_BURST	5
+#define CLIENT_TITLE_INTERVAL	(1000000000ULL / CLIENT_TITLE_RATE)
+#define CLIENT_TITLE_WINDOW	1000000000ULL
+
+/* Largest _COMA_WM_STATUS we bother reading. */
+#define CLIENT_STATUS_MAX	8192
+
+static void	client_title_event(struct client *);
+static void	client_title_update(struct client *);
+static int	client_title_token(struct client *, u_int64_t);
+static void	client_search_update(struct client *);
+static int	client_search_from(struct client *, const char *,
+		    const char *, size_t);
+static void	client_field_set(char **, const char *, size_t);
+static void	client_pwd_set(struct client *, const char *, size_t);
+static int	client_status_differs(const char *, size_t,
+		    const char *, size_t);
+static const char	*client_status_field(const void *, size_t,
+			    const char *, size_t *);
+
 struct client_list	clients;
+struct client_list	clients_mru;
 static u_int32_t	client_id = 1;
+
+static u_int32_t		titles_deferred = 0;
+static struct coma_stat		*titles_stat = NULL;
+
+/* Where the current walk through the MRU list is. */
+static struct client	*mru_cycle = NULL;
+static int		mru_depth = 0;
 struct client		*client_active = NULL;
 
 void
 coma_client_init(void)
 {
 	TAILQ_INIT(&clients);
+	TAILQ_INIT(&clients_mru);
+
+	titles_stat = coma_stats_create("client:title");
 }
 
 void
-coma_client_create(Window window)
+coma_client_create(Window window, const struct coma_placement *place)
 {
 	XWindowAttributes	attr;
 	struct frame		*frame;
 	struct client		*client;
-	u_int32_t		frame_id, pos, visible;
+	u_int32_t		frame_id, pos, visible, ws;
 
 	XGetWindowAttributes(dpy, window, &attr);
+	coma_stats_roundtrip();
 
 	if (coma_wm_property_read(window, atom_frame_id, &frame_id) == -1) {
 		frame_id = 0;
-		frame = frame_active;
+		frame = NULL;
+		if (client_discovery == 0)
+			frame = coma_spawn_frame(window);
+		if (place != NULL && place->frame != NULL)
+			frame = place->frame;
+		if (frame == NULL)
+			frame = frame_active;
 	} else {
-		if ((frame = coma_frame_lookup(frame_id)) == NULL)
+		if (coma_wm_property_read(window,
+		    atom_client_workspace, &ws) == -1)
+			ws = 0;
+		if ((frame = coma_workspace_frame(ws, frame_id)) == NULL)
 			frame = frame_active;
 	}
 
@@ -60,6 +109,7 @@ coma_client_create(Window window)
 
 	client = coma_calloc(1, sizeof(*client));
 	TAILQ_INSERT_TAIL(&clients, client, glist);
+	TAILQ_INSERT_TAIL(&clients_mru, client, mru);
 
 	if (coma_wm_property_read(window, atom_client_pos, &pos) == 0)
 		client->pos = pos;
@@ -73,7 +123,10 @@ coma_client_create(Window window)
 	if (frame == frame_popup && frame != frame_active)
 		visible = 0;
 
-	if (client_active == NULL)
+	if (frame->workspace != workspace_active)
+		visible = 0;
+
+	if (client_active == NULL && frame->workspace == workspace_active)
 		client_active = client;
 
 	client->x = attr.x;
@@ -85,13 +138,28 @@ coma_client_create(Window window)
 	client->window = window;
 	client->id = client_id++;
 	client->bw = frame_border;
+	client->title_tokens = CLIENT_TITLE_BURST;
+	client->title_refill = coma_stats_now();
+	client->title_window = client->title_refill;
 
-	coma_client_update_title(client);
+	if (place != NULL && place->tag != NULL &&
+	    (client->tag = strdup(place->tag)) == NULL)
+		fatal("strdup");
 
+	/* Before the title is read so no change of it gets lost. */
 	XSelectInput(dpy, client->window,
 	    StructureNotifyMask | PropertyChangeMask | FocusChangeMask);
 
+	client_search_update(client);
+	(void)coma_client_update_status(client);
+	(void)coma_client_update_title(client);
+	coma_proc_add(client);
+	coma_control_event(COMA_CONTROL_EVENT_CLIENT,
+	    "client\tcreate\t%u\t0x%08lx\t%u", client->id, client->window,
+	    client->frame->id);
+
 	XAddToSaveSet(dpy, client->window);
+	coma_ewmh_client_add(client);
 	XSetWindowBorderWidth(dpy, client->window, client->bw);
 
 	coma_wm_register_prefix(client->window);
@@ -106,7 +174,7 @@ coma_client_create(Window window)
 
 	if (client_discovery == 0) {
 		coma_frame_bar_update(frame);
-		XSync(dpy, False);
+		coma_wm_sync(False);
 	}
 }
 
@@ -125,6 +193,56 @@ coma_client_find(Window window)
 	return (coma_frame_find_client(window));
 }
 
+struct client *
+coma_client_lookup(u_int32_t id)
+{
+	struct client	*client;
+
+	TAILQ_FOREACH(client, &clients, glist) {
+		if (client->id == id)
+			return (client);
+	}
+
+	return (NULL);
+}
+
+void
+coma_client_select(struct client *client)
+{
+	struct frame	*prev;
+
+	if (client->frame->workspace != workspace_active)
+		coma_workspace_switch(client->frame->workspace);
+
+	prev = frame_active;
+	frame_active = client->frame;
+
+	if (frame_active == frame_popup && prev != frame_popup)
+		coma_frame_popup_show();
+
+	if (frame_active != frame_popup && prev == frame_popup) {
+		coma_frame_popup_hide();
+		frame_active = client->frame;
+	}
+
+	coma_client_focus(client);
+	coma_client_warp_pointer(client);
+}
+
+void
+coma_client_tag(struct client *client, const char *tag)
+{
+	free(client->tag);
+	client->tag = NULL;
+
+	if (tag != NULL && (client->tag = strdup(tag)) == NULL)
+		fatal("strdup");
+
+	client_search_update(client);
+
+	coma_frame_bar_update(client->frame);
+}
+
 void
 coma_client_destroy(struct client *client)
 {
@@ -144,13 +262,28 @@ coma_client_destroy(struct client *client)
 	if (frame->focus != NULL && frame->focus->id == client->id)
 		frame->focus = NULL;
 
-	next = TAILQ_NEXT(client, list);
 	TAILQ_REMOVE(&clients, client, glist);
+	TAILQ_REMOVE(&clients_mru, client, mru);
 	TAILQ_REMOVE(&frame->clients, client, list);
 
-	if (client->status)
-		free(client->status);
+	if (mru_cycle == client)
+		mru_cycle = NULL;
+
+	if (client->flags & COMA_CLIENT_TITLE)
+		titles_deferred--;
 
+	coma_proc_remove(client);
+	coma_ewmh_client_remove(client);
+	coma_control_event(COMA_CONTROL_EVENT_CLIENT,
+	    "client\tdestroy\t%u", client->id);
+
+	free(client->tag);
+	free(client->pwd);
+	free(client->cmd);
+	free(client->host);
+	free(client->title);
+	free(client->status);
+	free(client->search);
 	free(client);
 
 	coma_frame_bar_update(frame);
@@ -165,21 +298,84 @@ coma_client_destroy(struct client *client)
 		}
 	}
 
-	if (next == NULL) {
-		if ((next = TAILQ_FIRST(&frame->clients)) == NULL) {
-			if (frame->split != NULL)
-				coma_frame_merge();
-		}
+	/* The frame shows what was used in it last. */
+	TAILQ_FOREACH(next, &clients_mru, mru) {
+		if (next->frame == frame)
+			break;
 	}
 
 	if (next == NULL) {
-		coma_frame_select_any();
+		if (frame->parent != NULL)
+			coma_frame_merge();
+		TAILQ_FOREACH(next, &clients_mru, mru) {
+			if (next->frame->workspace == workspace_active)
+				break;
+		}
+		if (next != NULL) {
+			coma_client_select(next);
+			coma_frame_bar_update(next->frame);
+		} else {
+			coma_frame_select_any();
+		}
 	} else {
 		coma_client_focus(next);
 		coma_frame_bar_update(frame);
 	}
 }
 
+/* Switch back to the client that had the focus before this one. */
+void
+coma_client_last(void)
+{
+	struct client	*client;
+
+	if ((client = TAILQ_FIRST(&clients_mru)) == NULL)
+		return;
+
+	if ((client = TAILQ_NEXT(client, mru)) == NULL)
+		return;
+
+	coma_client_select(client);
+	coma_frame_bar_update(client->frame);
+}
+
+/*
+ * Walk the clients in most recently used order across frames and the
+ * popup. Every client selected moves to the front, so the next one in
+ * the walk is always found mru_depth entries down the list.
+ */
+void
+coma_client_mru_next(void)
+{
+	int		idx;
+	struct client	*client;
+
+	if (mru_cycle == NULL || mru_cycle != client_active)
+		mru_depth = 0;
+
+	mru_depth++;
+
+	idx = 0;
+	TAILQ_FOREACH(client, &clients_mru, mru) {
+		if (idx++ == mru_depth)
+			break;
+	}
+
+	if (client == NULL) {
+		mru_depth = 1;
+		client = TAILQ_FIRST(&clients_mru);
+		if (client != NULL)
+			client = TAILQ_NEXT(client, mru);
+	}
+
+	if (client == NULL)
+		return;
+
+	mru_cycle = client;
+	coma_client_select(client);
+	coma_frame_bar_update(client->frame);
+}
+
 void
 coma_client_adjust(struct client *client)
 {
@@ -191,7 +387,10 @@ coma_client_adjust(struct client *client)
 	coma_client_send_configure(client);
 
 	coma_wm_property_write(client->window,
-	    atom_frame_id, client->frame->id);
+	    atom_frame_id, client->frame->slot);
+	coma_wm_property_write(client->window,
+	    atom_client_workspace, client->frame->workspace->id);
+	coma_ewmh_client_desktop(client);
 }
 
 void
@@ -212,6 +411,17 @@ coma_client_hide(struct client *client)
 	}
 }
 
+/* Map a hidden client without focusing it. */
+void
+coma_client_show(struct client *client)
+{
+	if (client->flags & COMA_CLIENT_HIDDEN) {
+		client->flags &= ~COMA_CLIENT_HIDDEN;
+		XMapRaised(dpy, client->window);
+		coma_wm_property_write(client->window, atom_client_visible, 1);
+	}
+}
+
 void
 coma_client_unhide(struct client *client)
 {
@@ -252,11 +462,23 @@ coma_client_focus(struct client *client)
 	client_active = client;
 	client->frame->focus = client;
 
+	coma_proc_activity(client, 0);
+
+	if (TAILQ_FIRST(&clients_mru) != client) {
+		TAILQ_REMOVE(&clients_mru, client, mru);
+		TAILQ_INSERT_HEAD(&clients_mru, client, mru);
+	}
+
+	coma_ewmh_active(client);
+
 	if (client_discovery == 0) {
 		coma_frame_bar_update(client->frame);
 		coma_wm_property_write(DefaultRootWindow(dpy),
 		    atom_client_act, client->window);
-		XSync(dpy, True);
+		coma_control_event(COMA_CONTROL_EVENT_FOCUS,
+		    "focus\t%u\t0x%08lx\t%u", client->id, client->window,
+		    client->frame->id);
+		coma_wm_sync(True);
 	}
 }
 
@@ -284,46 +506,539 @@ coma_client_send_configure(struct client *client)
 	    StructureNotifyMask, (XEvent *)&cfg);
 }
 
+/*
+ * WM_NAME changed. Handled right away while the client has tokens left,
+ * otherwise a single update is done by coma_client_titles_flush().
+ */
 void
+coma_client_title_changed(struct client *client)
+{
+	u_int64_t	now;
+
+	now = coma_stats_now();
+
+	client->title_changes++;
+	client->title_count++;
+
+	coma_proc_activity(client, 0);
+
+	if (now - client->title_window >= CLIENT_TITLE_WINDOW) {
+		client->title_rate = (client->title_count *
+		    CLIENT_TITLE_WINDOW) / (now - client->title_window);
+		client->title_window = now;
+		client->title_count = 0;
+	}
+
+	if (client->flags & COMA_CLIENT_TITLE) {
+		client->title_deferred++;
+		return;
+	}
+
+	if (client_title_token(client, now) == -1) {
+		client->flags |= COMA_CLIENT_TITLE;
+		client->title_deferred++;
+		titles_deferred++;
+		return;
+	}
+
+	client_title_update(client);
+}
+
+/* Do the deferred title updates of clients that have a token again. */
+void
+coma_client_titles_flush(void)
+{
+	u_int64_t	now;
+	struct client	*client;
+
+	if (titles_deferred == 0)
+		return;
+
+	now = coma_stats_now();
+
+	TAILQ_FOREACH(client, &clients, glist) {
+		if (!(client->flags & COMA_CLIENT_TITLE))
+			continue;
+
+		if (client_title_token(client, now) == -1)
+			continue;
+
+		client->flags &= ~COMA_CLIENT_TITLE;
+		titles_deferred--;
+
+		client_title_update(client);
+	}
+}
+
+/* Title changes per second over the last second it was measured. */
+u_int32_t
+coma_client_title_rate(struct client *client)
+{
+	/* Nothing came in since, it went quiet. */
+	if (coma_stats_now() - client->title_window >= 2 * CLIENT_TITLE_WINDOW)
+		return (0);
+
+	return (client->title_rate);
+}
+
+/* Milliseconds until a deferred title update is due, -1 if none are. */
+int
+coma_client_titles_timeout(void)
+{
+	u_int64_t	now, due, next;
+	struct client	*client;
+
+	if (titles_deferred == 0)
+		return (-1);
+
+	now = coma_stats_now();
+	next = UINT64_MAX;
+
+	TAILQ_FOREACH(client, &clients, glist) {
+		if (!(client->flags & COMA_CLIENT_TITLE))
+			continue;
+		due = client->title_refill + CLIENT_TITLE_INTERVAL;
+		if (due < next)
+			next = due;
+	}
+
+	if (next <= now)
+		return (0);
+
+	return ((next - now + 999999) / 1000000);
+}
+
+/*
+ * Fetch the title again, returns 1 if it is different from what we had.
+ * Unless the client sets _COMA_WM_STATUS the title is also where host,
+ * directory and command come from.
+ */
+int
 coma_client_update_title(struct client *client)
 {
-	int		n, len;
-	char		*name, *args[4], pwd[PATH_MAX];
+	int		n, hooked;
+	char		*name, *copy, *args[4];
 
+	coma_stats_roundtrip();
 	if (!XFetchName(dpy, client->window, &name))
-		return;
+		return (0);
+
+	/* The same title again does not need to be parsed or drawn. */
+	if (client->title != NULL && !strcmp(client->title, name)) {
+		XFree(name);
+		return (0);
+	}
+
+	free(client->title);
+
+	if ((client->title = strdup(name)) == NULL)
+		fatal("strdup");
+
+	XFree(name);
+
+	if (client->flags & COMA_CLIENT_STATUS) {
+		client_search_update(client);
+		client_title_event(client);
+		return (1);
+	}
+
+	if ((copy = strdup(client->title)) == NULL)
+		fatal("strdup");
+
+	if ((n = coma_split_string(copy, ";", args, 4)) < 2) {
+		/* What was sampled from /proc beats a plain title. */
+		if (!(client->flags & COMA_CLIENT_PROC)) {
+			hooked = client->host != NULL;
+			client_field_set(&client->pwd, NULL, 0);
+			client_field_set(&client->host, NULL, 0);
+			client_field_set(&client->cmd, args[0],
+			    args[0] != NULL ? strlen(args[0]) : 0);
+			if (hooked)
+				coma_proc_activity(client, 1);
+		}
+	} else {
+		client->flags &= ~COMA_CLIENT_PROC;
+		client_pwd_set(client, args[1], strlen(args[1]));
+		client_field_set(&client->host, args[0], strlen(args[0]));
+		client_field_set(&client->cmd, n == 3 ? args[2] : NULL,
+		    n == 3 ? strlen(args[2]) : 0);
+		if (client->host != NULL)
+			coma_remote_seen(client->host);
+	}
+
+	free(copy);
+
+	client_search_update(client);
+	client_title_event(client);
+
+	return (1);
+}
+
+/*
+ * Directory and command as sampled from /proc, only taken for clients
+ * whose shell does not tell us itself. NULL leaves a value as it is.
+ * Returns 1 if anything was taken.
+ */
+int
+coma_client_sampled(struct client *client, const char *pwd, const char *cmd)
+{
+	if ((client->flags & COMA_CLIENT_STATUS) || client->host != NULL)
+		return (0);
+
+	client->flags |= COMA_CLIENT_PROC;
+
+	if (pwd != NULL)
+		client_pwd_set(client, pwd, strlen(pwd));
+	if (cmd != NULL)
+		client_field_set(&client->cmd, cmd, strlen(cmd));
+
+	client_search_update(client);
+	client_title_event(client);
+
+	return (1);
+}
+
+/*
+ * Read _COMA_WM_STATUS, a list of NUL separated host=, pwd= and cmd=
+ * fields as set by coma -T. Only the fields whose value differs from
+ * the last one we read are taken over. Returns 1 if anything changed.
+ */
+int
+coma_client_update_status(struct client *client)
+{
+	Atom		type;
+	int		format, first, changed;
+	unsigned char	*data;
+	unsigned long	nitems, bytes;
+	const char	*val, *prev;
+	size_t		vlen, plen;
+
+	coma_stats_roundtrip();
+	if (XGetWindowProperty(dpy, client->window, atom_client_status, 0,
+	    CLIENT_STATUS_MAX / 4, False, AnyPropertyType, &type, &format,
+	    &nitems, &bytes, &data) != Success)
+		return (0);
+
+	if (type == None || format != 8) {
+		if (data != NULL)
+			XFree(data);
+
+		if (!(client->flags & COMA_CLIENT_STATUS))
+			return (0);
+
+		/* Gone again, the title is all we have. */
+		client->flags &= ~COMA_CLIENT_STATUS;
+		free(client->status);
+		client->status = NULL;
+		client->status_len = 0;
+		free(client->title);
+		client->title = NULL;
+
+		(void)coma_client_update_title(client);
+		return (1);
+	}
+
+	first = !(client->flags & COMA_CLIENT_STATUS);
+	client->flags &= ~COMA_CLIENT_PROC;
+
+	if (!first && client->status_len == nitems &&
+	    !memcmp(client->status, data, nitems)) {
+		XFree(data);
+		return (0);
+	}
+
+	changed = 0;
+
+	val = client_status_field(data, nitems, "host", &vlen);
+	prev = client_status_field(client->status,
+	    client->status_len, "host", &plen);
+	if (first || client_status_differs(val, vlen, prev, plen)) {
+		client_field_set(&client->host, val, vlen);
+		if (client->host != NULL)
+			coma_remote_seen(client->host);
+		changed = 1;
+	}
+
+	val = client_status_field(data, nitems, "pwd", &vlen);
+	prev = client_status_field(client->status,
+	    client->status_len, "pwd", &plen);
+	if (first || client_status_differs(val, vlen, prev, plen)) {
+		client_pwd_set(client, val, vlen);
+		changed = 1;
+	}
+
+	val = client_status_field(data, nitems, "cmd", &vlen);
+	prev = client_status_field(client->status,
+	    client->status_len, "cmd", &plen);
+	if (first || client_status_differs(val, vlen, prev, plen)) {
+		client_field_set(&client->cmd, val, vlen);
+		changed = 1;
+	}
 
-	free(client->pwd);
 	free(client->status);
+	client->status = coma_malloc(nitems + 1);
+	memcpy(client->status, data, nitems);
+	client->status[nitems] = '\0';
+	client->status_len = nitems;
+	client->flags |= COMA_CLIENT_STATUS;
 
-	client->pwd = NULL;
-	client->cmd = NULL;
-	client->host = NULL;
+	XFree(data);
 
-	if ((client->status = strdup(name)) == NULL)
+	if (changed) {
+		client_search_update(client);
+		client_title_event(client);
+	}
+
+	return (changed);
+}
+
+static void
+client_title_update(struct client *client)
+{
+	struct coma_sample	sample;
+
+	coma_stats_begin(&sample);
+
+	/* The same title again does not need to be drawn. */
+	if (coma_client_update_title(client))
+		coma_frame_bar_update(client->frame);
+
+	coma_stats_end(titles_stat, &sample);
+}
+
+/* Take a token, refilled at CLIENT_TITLE_RATE. Returns -1 if none. */
+static int
+client_title_token(struct client *client, u_int64_t now)
+{
+	u_int64_t	add;
+
+	add = (now - client->title_refill) / CLIENT_TITLE_INTERVAL;
+
+	if (add > 0) {
+		if (client->title_tokens + add >= CLIENT_TITLE_BURST) {
+			client->title_tokens = CLIENT_TITLE_BURST;
+			client->title_refill = now;
+		} else {
+			client->title_tokens += add;
+			client->title_refill += add * CLIENT_TITLE_INTERVAL;
+		}
+	}
+
+	if (client->title_tokens == 0)
+		return (-1);
+
+	client->title_tokens--;
+
+	return (0);
+}
+
+static void
+client_title_event(struct client *client)
+{
+	coma_control_event(COMA_CONTROL_EVENT_TITLE, "title\t%u\t%s\t%s\t%s",
+	    client->id, client->host ? client->host : "-",
+	    client->pwd ? client->pwd : "-", client->cmd ? client->cmd : "-");
+}
+
+/*
+ * Score client against a lowercased query for the client finder,
+ * the characters of the query must appear in order in its tag,
+ * command, host or directory. Every place the query could start is
+ * tried and the best one wins. Returns -1 if there is no match.
+ */
+int
+coma_client_search(struct client *client, const char *query, size_t qlen,
+    u_int64_t mask)
+{
+	int		score, best;
+	const char	*p, *end;
+
+	/* Most clients miss a character or two, no need to look closer. */
+	if ((client->search_mask & mask) != mask)
+		return (-1);
+
+	while (qlen > 0 && *query == ' ') {
+		query++;
+		qlen--;
+	}
+
+	if (qlen == 0)
+		return (0);
+
+	best = -1;
+	p = client->search;
+	end = client->search + client->search_len;
+
+	while ((p = memchr(p, *query, end - p)) != NULL) {
+		score = client_search_from(client, p, query, qlen);
+		if (score == -1)
+			break;
+		if (score > best)
+			best = score;
+		p++;
+	}
+
+	return (best);
+}
+
+/* One bit per letter or digit, everything else shares the rest. */
+u_int64_t
+coma_client_search_mask(const char *str)
+{
+	u_int64_t	mask;
+	int		c;
+
+	mask = 0;
+
+	for (; *str != '\0'; str++) {
+		c = tolower((unsigned char)*str);
+		if (c >= 'a' && c <= 'z')
+			mask |= 1ULL << (c - 'a');
+		else if (c >= '0' && c <= '9')
+			mask |= 1ULL << (26 + c - '0');
+		else if (c != ' ')
+			mask |= 1ULL << (36 + c % 28);
+	}
+
+	return (mask);
+}
+
+/* Kept up to date here so opening the client finder costs nothing. */
+static void
+client_search_update(struct client *client)
+{
+	int		len;
+	size_t		idx;
+	char		buf[1024];
+
+	free(client->search);
+
+	len = snprintf(buf, sizeof(buf), "%s %s %s %s",
+	    client->tag ? client->tag : "", client->cmd ? client->cmd : "",
+	    client->host ? client->host : "", client->pwd ? client->pwd : "");
+	if (len == -1)
+		len = 0;
+	if ((size_t)len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	for (idx = 0; idx < (size_t)len; idx++)
+		buf[idx] = tolower((unsigned char)buf[idx]);
+
+	buf[len] = '\0';
+
+	if ((client->search = strdup(buf)) == NULL)
 		fatal("strdup");
 
-	if ((n = coma_split_string(client->status, ";", args, 4)) < 2) {
-		client->cmd = args[0];
-		return;
+	client->search_len = len;
+	client->search_mask = coma_client_search_mask(buf);
+}
+
+static int
+client_search_from(struct client *client, const char *p, const char *query,
+    size_t qlen)
+{
+	size_t		idx;
+	int		score;
+	const char	*end, *m, *prev;
+
+	score = 0;
+	prev = NULL;
+	end = client->search + client->search_len;
+
+	for (idx = 0; idx < qlen; idx++) {
+		if (query[idx] == ' ')
+			continue;
+
+		if ((m = memchr(p, query[idx], end - p)) == NULL)
+			return (-1);
+
+		if (prev != NULL && m == prev + 1)
+			score += 8;
+		else if (m == client->search || strchr(" /-_.", m[-1]))
+			score += 6;
+		else if (prev != NULL)
+			score -= MIN(m - prev - 1, 4);
+
+		score++;
+		prev = m;
+		p = m + 1;
 	}
 
-	if (args[1] != NULL && !strncmp(args[1], homedir, strlen(homedir))) {
-		len = snprintf(pwd, sizeof(pwd), "~%s",
-		    args[1] + strlen(homedir));
-		if (len != -1 && (size_t)len < sizeof(pwd))
-			client->pwd = strdup(pwd);
+	return (score);
+}
+
+/* Replace a field with a copy of len bytes of value, NULL clears it. */
+static void
+client_field_set(char **field, const char *value, size_t len)
+{
+	free(*field);
+	*field = NULL;
+
+	if (value == NULL || len == 0)
+		return;
+
+	*field = coma_malloc(len + 1);
+	memcpy(*field, value, len);
+	(*field)[len] = '\0';
+}
+
+/* The directory is shown with $HOME as ~. */
+static void
+client_pwd_set(struct client *client, const char *value, size_t len)
+{
+	int		ret;
+	size_t		hlen;
+	char		pwd[PATH_MAX];
+
+	hlen = strlen(homedir);
+
+	if (value != NULL && len >= hlen && !strncmp(value, homedir, hlen)) {
+		ret = snprintf(pwd, sizeof(pwd), "~%.*s",
+		    (int)(len - hlen), value + hlen);
+		if (ret != -1 && (size_t)ret < sizeof(pwd)) {
+			client_field_set(&client->pwd, pwd, ret);
+			return;
+		}
 	}
 
-	if (client->pwd == NULL) {
-		if ((client->pwd = strdup(args[1])) == NULL)
-			fatal("strdup failed");
+	client_field_set(&client->pwd, value, len);
+}
+
+/* Find key= in a NUL separated status list, its length goes in len. */
+static const char *
+client_status_field(const void *data, size_t datalen, const char *key,
+    size_t *len)
+{
+	size_t		klen, off, elen;
+	const char	*list, *entry;
+
+	*len = 0;
+
+	if (data == NULL)
+		return (NULL);
+
+	list = data;
+	klen = strlen(key);
+
+	for (off = 0; off < datalen; off += elen + 1) {
+		entry = list + off;
+		elen = strnlen(entry, datalen - off);
+
+		if (elen > klen && entry[klen] == '=' &&
+		    !strncmp(entry, key, klen)) {
+			*len = elen - klen - 1;
+			return (entry + klen + 1);
+		}
 	}
 
-	client->host = args[0];
+	return (NULL);
+}
 
-	if (n == 3)
-		client->cmd = args[2];
+static int
+client_status_differs(const char *a, size_t alen, const char *b, size_t blen)
+{
+	if (a == NULL || b == NULL)
+		return (a != b);
 
-	XFree(name);
+	return (alen != blen || memcmp(a, b, alen));
 }
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The modes coma runs in inside of the terminals it starts, these take
+ * the place of the old coma-cmd, coma-remote and coma-pool scripts so
+ * no shell is started just to set a title or change directory.
+ *
+ *	coma -C cmd [args]			run a local command
+ *	coma -R [-S control] host dir cmd [args]	run it on host in dir
+ *	coma -P fifo				wait for a directory, run $SHELL
+ *	coma -T [field=value ...]		set _COMA_WM_STATUS fields
+ */
+
+#include <sys/types.h>
+
+#include <X11/Xlib.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <bsd/string.h>
+#endif
+
+#include "coma.h"
+
+static void	cmd_exec(char **);
+static void	cmd_quote(char *, size_t, const char *);
+static void	cmd_fatal(const char *, ...);
+static void	cmd_status_fail(const char *, ...);
+static int	cmd_status_add(char *, size_t, size_t *, const char *,
+		    size_t);
+
+void
+coma_cmd_local(int argc, char **argv)
+{
+	char		host[256], cwd[PATH_MAX];
+
+	if (argc < 1)
+		cmd_fatal("-C requires a command");
+
+	if (gethostname(host, sizeof(host)) == -1)
+		host[0] = '\0';
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL)
+		cwd[0] = '\0';
+
+	/* Same format the shell uses, see the README. */
+	printf("\033]0;%s;%s;%s\007", host, cwd, argv[0]);
+	fflush(stdout);
+
+	cmd_exec(argv);
+}
+
+void
+coma_cmd_remote(int argc, char **argv)
+{
+	int		idx, cnt;
+	const char	*ssh;
+	char		*args[8], opt[PATH_MAX + 16], line[8192];
+
+	cnt = 0;
+
+	if ((ssh = getenv("COMA_SSH")) == NULL || *ssh == '\0')
+		ssh = "ssh";
+
+	if ((args[cnt++] = strdup(ssh)) == NULL)
+		cmd_fatal("strdup");
+
+	if (argc >= 2 && !strcmp(argv[0], "-S")) {
+		(void)snprintf(opt, sizeof(opt), "ControlPath=%s", argv[1]);
+		args[cnt++] = "-o";
+		args[cnt++] = opt;
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc < 3)
+		cmd_fatal("-R requires a host, directory and command");
+
+	line[0] = '\0';
+
+	/* Let the remote shell expand a leading ~, quote the rest. */
+	if (!strcmp(argv[1], "~")) {
+		(void)strlcat(line, "cd", sizeof(line));
+	} else if (!strncmp(argv[1], "~/", 2)) {
+		(void)strlcat(line, "cd ~/", sizeof(line));
+		cmd_quote(line, sizeof(line), argv[1] + 2);
+	} else {
+		(void)strlcat(line, "cd ", sizeof(line));
+		cmd_quote(line, sizeof(line), argv[1]);
+	}
+
+	(void)strlcat(line, " &&", sizeof(line));
+
+	for (idx = 2; idx < argc; idx++) {
+		(void)strlcat(line, " ", sizeof(line));
+		if (strlcat(line, argv[idx], sizeof(line)) >= sizeof(line))
+			cmd_fatal("command too long");
+	}
+
+	args[cnt++] = argv[0];
+	args[cnt++] = line;
+	args[cnt] = NULL;
+
+	cmd_exec(args);
+}
+
+void
+coma_cmd_pool(int argc, char **argv)
+{
+	int		fd;
+	ssize_t		ret;
+	size_t		len;
+	const char	*shell;
+	char		*sargv[2], dir[PATH_MAX];
+
+	if (argc != 1)
+		cmd_fatal("-P requires a fifo");
+
+	if ((fd = open(argv[0], O_RDONLY)) == -1)
+		cmd_fatal("open(%s): %s", argv[0], errno_s);
+
+	len = 0;
+	while (len < sizeof(dir) - 1) {
+		ret = read(fd, dir + len, sizeof(dir) - 1 - len);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			cmd_fatal("read(%s): %s", argv[0], errno_s);
+		}
+		if (ret == 0)
+			break;
+		len += ret;
+		if (dir[len - 1] == '\n')
+			break;
+	}
+
+	(void)close(fd);
+	(void)unlink(argv[0]);
+
+	dir[len] = '\0';
+	dir[strcspn(dir, "\n")] = '\0';
+
+	if (dir[0] != '\0' && chdir(dir) == -1)
+		fprintf(stderr, "chdir(%s): %s\n", dir, errno_s);
+
+	if ((shell = getenv("SHELL")) == NULL || *shell == '\0')
+		shell = "/bin/sh";
+
+	if ((sargv[0] = strdup(shell)) == NULL)
+		cmd_fatal("strdup");
+	sargv[1] = NULL;
+
+	cmd_exec(sargv);
+}
+
+/*
+ * Set fields of _COMA_WM_STATUS on the terminal we are in ($WINDOWID),
+ * the ones not given keep what they had. Without any fields the property
+ * is removed so the title is used again. Meant for shell hooks so it
+ * fails quietly and fast instead of holding up the prompt.
+ */
+void
+coma_cmd_status(int argc, char **argv)
+{
+	Display		*display;
+	Atom		atom, type;
+	Window		window;
+	int		idx, format;
+	unsigned char	*data;
+	unsigned long	nitems, bytes, off;
+	const char	*env, *entry, *eq;
+	char		*ep, list[8192];
+	size_t		len, klen, elen;
+
+	for (idx = 0; idx < argc; idx++) {
+		if ((eq = strchr(argv[idx], '=')) == NULL || eq == argv[idx])
+			cmd_status_fail("bad field '%s'", argv[idx]);
+	}
+
+	if ((env = getenv("WINDOWID")) == NULL || *env == '\0')
+		cmd_status_fail("no $WINDOWID");
+
+	errno = 0;
+	window = strtoul(env, &ep, 0);
+	if (errno != 0 || *ep != '\0' || window == 0)
+		cmd_status_fail("bad $WINDOWID '%s'", env);
+
+	if ((display = XOpenDisplay(NULL)) == NULL)
+		cmd_status_fail("cannot open display");
+
+	atom = XInternAtom(display, "_COMA_WM_STATUS", False);
+
+	if (argc == 0) {
+		XDeleteProperty(display, window, atom);
+		XCloseDisplay(display);
+		exit(0);
+	}
+
+	len = 0;
+	for (idx = 0; idx < argc; idx++) {
+		if (cmd_status_add(list, sizeof(list), &len, argv[idx],
+		    strlen(argv[idx])) == -1)
+			cmd_status_fail("fields too long");
+	}
+
+	/* Keep the fields that were not given. */
+	if (XGetWindowProperty(display, window, atom, 0, sizeof(list) / 4,
+	    False, AnyPropertyType, &type, &format, &nitems, &bytes,
+	    &data) == Success && data != NULL) {
+		for (off = 0; format == 8 && off < nitems; off += elen + 1) {
+			entry = (const char *)data + off;
+			elen = strnlen(entry, nitems - off);
+
+			if ((eq = memchr(entry, '=', elen)) == NULL)
+				continue;
+
+			klen = eq - entry + 1;
+			for (idx = 0; idx < argc; idx++) {
+				if (!strncmp(argv[idx], entry, klen))
+					break;
+			}
+
+			if (idx == argc && cmd_status_add(list, sizeof(list),
+			    &len, entry, elen) == -1)
+				break;
+		}
+		XFree(data);
+	}
+
+	XChangeProperty(display, window, atom,
+	    XInternAtom(display, "UTF8_STRING", False), 8, PropModeReplace,
+	    (unsigned char *)list, len > 0 ? len - 1 : 0);
+	XCloseDisplay(display);
+
+	exit(0);
+}
+
+static void
+cmd_exec(char **argv)
+{
+	execvp(argv[0], argv);
+	cmd_fatal("%s: %s", argv[0], errno_s);
+}
+
+/* Append a NUL terminated entry to the status list. */
+static int
+cmd_status_add(char *list, size_t size, size_t *len, const char *entry,
+    size_t elen)
+{
+	if (elen >= size - *len)
+		return (-1);
+
+	memcpy(list + *len, entry, elen);
+	list[*len + elen] = '\0';
+	*len += elen + 1;
+
+	return (0);
+}
+
+static void
+cmd_quote(char *line, size_t len, const char *str)
+{
+	const char	*p;
+	char		c[2];
+
+	c[1] = '\0';
+	(void)strlcat(line, "'", len);
+
+	for (p = str; *p != '\0'; p++) {
+		if (*p == '\'') {
+			(void)strlcat(line, "'\\''", len);
+		} else {
+			c[0] = *p;
+			(void)strlcat(line, c, len);
+		}
+	}
+
+	(void)strlcat(line, "'", len);
+}
+
+static void
+cmd_fatal(const char *fmt, ...)
+{
+	va_list		args;
+
+	fprintf(stderr, "coma: ");
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+
+	fprintf(stderr, "\n");
+
+	/* Keep the terminal around long enough to read why. */
+	sleep(2);
+	exit(1);
+}
+
+static void
+cmd_status_fail(const char *fmt, ...)
+{
+	va_list		args;
+
+	fprintf(stderr, "coma: ");
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+
+	fprintf(stderr, "\n");
+	exit(1);
+}
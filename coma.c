@@ -18,6 +18,7 @@
 #include <sys/wait.h>
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -60,12 +61,29 @@ main(int argc, char *argv[])
 	int			ch;
 	struct passwd		*pw;
 	const char		*config;
-	char			*layout;
+	char			*layout, errmsg[128];
+
+	if (argc >= 2) {
+		if (!strcmp(argv[1], "-C"))
+			coma_cmd_local(argc - 2, argv + 2);
+		if (!strcmp(argv[1], "-R"))
+			coma_cmd_remote(argc - 2, argv + 2);
+		if (!strcmp(argv[1], "-P"))
+			coma_cmd_pool(argc - 2, argv + 2);
+		if (!strcmp(argv[1], "-T"))
+			coma_cmd_status(argc - 2, argv + 2);
+	}
 
 	cargv = argv;
 	layout = NULL;
 	config = NULL;
 
+	/* We chdir() below, restarts and wrappers need to find us. */
+	if (strchr(argv[0], '/') != NULL && argv[0][0] != '/') {
+		if ((argv[0] = realpath(cargv[0], NULL)) == NULL)
+			fatal("realpath(%s): %s", cargv[0], errno_s);
+	}
+
 	if ((pw = getpwuid(getuid())) == NULL)
 		fatal("who are you?");
 
@@ -76,6 +94,8 @@ main(int argc, char *argv[])
 		fatal("chdir(%s): %s", homedir, errno_s);
 
 	coma_log_init();
+	coma_stats_init();
+	coma_spawn_init();
 	coma_wm_init();
 
 	while ((ch = getopt(argc, argv, "c:hl:")) != -1) {
@@ -97,7 +117,13 @@ main(int argc, char *argv[])
 		fatal("strdup");
 
 	coma_frame_init();
+
+	if (coma_layout_init(errmsg, sizeof(errmsg)) == -1)
+		fatal("builtin layouts: %s", errmsg);
+
+	coma_terminal_init();
 	coma_config_parse(config);
+	coma_remote_init();
 
 	if (layout != NULL)
 		coma_frame_layout(layout);
@@ -118,12 +144,25 @@ main(int argc, char *argv[])
 		fatal("sigaction: %s", errno_s);
 	if (sigaction(SIGCHLD, &sa, NULL) == -1)
 		fatal("sigaction: %s", errno_s);
+	if (sigaction(SIGUSR1, &sa, NULL) == -1)
+		fatal("sigaction: %s", errno_s);
+
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL) == -1)
+		fatal("sigaction: %s", errno_s);
 
 	if (gethostname(myhost, sizeof(myhost)) == -1)
 		fatal("gethostname: %s", errno_s);
 
+	coma_complete_init();
+	coma_history_init();
 	coma_client_init();
+	coma_proc_init();
 	coma_wm_setup();
+	coma_control_init();
+	coma_config_watch();
+	coma_terminal_setup();
+	coma_pool_init();
 	coma_wm_run();
 
 	if (restart) {
@@ -158,43 +197,61 @@ coma_reap(void)
 void
 coma_spawn_terminal(void)
 {
-	char	*argv[2];
+	const char	*pwd;
+	char		*argv[8], cwd[PATH_MAX], buf[PATH_MAX + 32];
+
+	if (coma_pool_adopt() == 0)
+		return;
 
-	argv[0] = terminal;
-	argv[1] = NULL;
+	pwd = coma_execute_cwd(cwd, sizeof(cwd));
 
-	coma_execute(argv);
+	if (coma_terminal_argv(argv, 8, buf, sizeof(buf),
+	    -1, NULL, pwd, 0) != -1)
+		coma_execute(argv);
 }
 
 void
 coma_execute(char **argv)
 {
-	pid_t		pid;
 	const char	*pwd;
+	char		cwd[PATH_MAX];
 
-	pid = fork();
+	pwd = coma_execute_cwd(cwd, sizeof(cwd));
 
-	switch (pid) {
-	case -1:
-		fprintf(stderr, "failed to spawn terminal: %s\n", errno_s);
-		return;
-	case 0:
-		if (frame_active->focus)
-			pwd = frame_active->focus->pwd;
-		else
-			pwd = NULL;
+	(void)coma_spawn_request(argv, pwd, NULL, NULL, NULL);
+}
 
-		if (pwd != NULL && chdir(pwd) == -1)
-			fprintf(stderr, "chdir: %s\n", errno_s);
+/*
+ * The directory new programs start in, that of the focused client in
+ * the active frame. Returns NULL if it is not known.
+ */
+const char *
+coma_execute_cwd(char *cwd, size_t cwdlen)
+{
+	int		len;
+	const char	*pwd;
+
+	if (frame_active->focus)
+		pwd = frame_active->focus->pwd;
+	else
+		pwd = NULL;
 
-		(void)setsid();
-		execvp(argv[0], argv);
-		fprintf(stderr, "failed to start '%s': %s\n", argv[0], errno_s);
-		exit(1);
-		break;
-	default:
-		break;
+	if (pwd != NULL && pwd[0] == '~') {
+		len = snprintf(cwd, cwdlen, "%s%s", homedir, pwd + 1);
+		if (len == -1 || (size_t)len >= cwdlen)
+			pwd = NULL;
+		else
+			pwd = cwd;
 	}
+
+	return (pwd);
+}
+
+void
+coma_fd_cloexec(int fd)
+{
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+		fatal("fcntl(%d): %s", fd, errno_s);
 }
 
 void *
@@ -351,6 +408,8 @@ coma_log_init(void)
 	if ((logfp = fopen(COMA_LOG_FILE, "a")) == NULL)
 		fatal("failed to open logfile: %s", strerror(errno));
 
+	coma_fd_cloexec(fileno(logfp));
+
 	coma_log("coma %s starting", COMA_VERSION);
 }
 
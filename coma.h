@@ -27,6 +27,8 @@
 #include <string.h>
 #include <signal.h>
 
+#include "layout.h"
+
 #define errno_s				strerror(errno)
 
 #define COMA_VERSION			"1.2"
@@ -43,12 +45,13 @@
 #define COMA_ACTION_NOHOLD_PREFIX_LEN	(sizeof(COMA_ACTION_NOHOLD_PREFIX) - 1)
 
 #define COMA_LOG_FILE			".coma.log"
+#define COMA_CONTROL_SOCKET		".coma.sock"
+#define COMA_HISTORY_FILE		".coma.history"
 #define COMA_MOD_KEY			ControlMask
 #define COMA_PREFIX_KEY			XK_t
 
-#define COMA_FRAME_LAYOUT_DEFAULT	1
-#define COMA_FRAME_LAYOUT_SMALL_LARGE	2
-#define COMA_FRAME_LAYOUT_SMALL_DUAL	3
+#define COMA_FRAME_LAYOUT_DEFAULT	"default"
+#define COMA_FRAME_LAYOUT_FALLBACK	"full"
 
 #define COMA_FRAME_BORDER	5
 #define COMA_FRAME_GAP		20
@@ -60,6 +63,9 @@
 struct frame;
 
 #define COMA_CLIENT_HIDDEN	0x0001
+#define COMA_CLIENT_TITLE	0x0002
+#define COMA_CLIENT_STATUS	0x0004
+#define COMA_CLIENT_PROC	0x0008
 
 struct client {
 	u_int32_t		id;
@@ -72,9 +78,15 @@ struct client {
 
 	char			*tag;
 	char			*cmd;
+	char			*title;
 	char			*pwd;
 	char			*host;
 	char			*status;
+	size_t			status_len;
+
+	char			*search;
+	size_t			search_len;
+	u_int64_t		search_mask;
 
 	u_int16_t		w;
 	u_int16_t		h;
@@ -85,8 +97,18 @@ struct client {
 	u_int16_t		fbo;
 	u_int16_t		fbw;
 
+	/* Title changes, a token bucket and the rate they come in at. */
+	u_int32_t		title_tokens;
+	u_int64_t		title_refill;
+	u_int64_t		title_window;
+	u_int32_t		title_count;
+	u_int32_t		title_rate;
+	u_int64_t		title_changes;
+	u_int64_t		title_deferred;
+
 	TAILQ_ENTRY(client)	list;
 	TAILQ_ENTRY(client)	glist;
+	TAILQ_ENTRY(client)	mru;
 };
 
 TAILQ_HEAD(client_list, client);
@@ -94,6 +116,21 @@ TAILQ_HEAD(client_list, client);
 #define COMA_FRAME_INLIST	0x0001
 #define COMA_FRAME_ZOOMED	0x0002
 
+#define COMA_FRAME_LEFT		0
+#define COMA_FRAME_RIGHT	1
+#define COMA_FRAME_UP		2
+#define COMA_FRAME_DOWN		3
+#define COMA_FRAME_DIRECTIONS	4
+
+#define COMA_FRAME_SPLIT_NONE		0
+#define COMA_FRAME_SPLIT_HORIZONTAL	1
+#define COMA_FRAME_SPLIT_VERTICAL	2
+
+/* Smallest frame a split may leave, and how far frame-grow moves it. */
+#define COMA_FRAME_MIN_SIZE		64
+#define COMA_FRAME_RATIO_MIN		10
+#define COMA_FRAME_RESIZE_STEP		5
+
 struct frame {
 	u_int32_t		id;
 	int			flags;
@@ -116,25 +153,99 @@ struct frame {
 
 	struct client		*focus;
 	struct client_list	clients;
-	struct frame		*split;
+	struct frame		*adj[COMA_FRAME_DIRECTIONS];
+
+	/*
+	 * Position in the split tree, rx/ry/rw/rh is the area the frame
+	 * or the frames below it cover including borders and bar.
+	 */
+	int			split;
+	int			ratio;
+	struct frame		*parent;
+	struct frame		*child[2];
+
+	u_int16_t		rx;
+	u_int16_t		ry;
+	u_int16_t		rw;
+	u_int16_t		rh;
+
+	/* The monitor this frame was laid out on and its workspace. */
+	struct coma_output	*output;
+	struct coma_workspace	*workspace;
+
+	/*
+	 * Where the frame is in the layout of its workspace, the same
+	 * after a restart unlike the id. Splits share the slot of the
+	 * frame they were made from.
+	 */
+	u_int32_t		slot;
 
 	TAILQ_ENTRY(frame)	list;
 };
 
 TAILQ_HEAD(frame_list, frame);
 
+#define COMA_WORKSPACE_DEFAULT		"main"
+
+/* A workspace, the frame state is only kept here while it is parked. */
+struct coma_workspace {
+	u_int32_t		id;
+	char			*name;
+
+	struct frame_list	frames;
+	struct frame_list	splits;
+	struct frame		*popup;
+	struct frame		*active;
+	struct frame		*restore;
+	u_int32_t		configured;
+
+	TAILQ_ENTRY(coma_workspace)	list;
+};
+
+struct coma_io {
+	int			fd;
+	short			events;
+	void			*arg;
+	void			(*cb)(struct coma_io *, int);
+	LIST_ENTRY(coma_io)	list;
+};
+
+#define COMA_CONTROL_EVENT_FOCUS	0x0001
+#define COMA_CONTROL_EVENT_TITLE	0x0002
+#define COMA_CONTROL_EVENT_CLIENT	0x0004
+
+/* Where a rule wants a new window to go. */
+struct coma_placement {
+	struct frame		*frame;
+	const char		*tag;
+};
+
+struct coma_output;
+
+struct coma_stat;
+
+struct coma_sample {
+	u_int64_t		start;
+	u_int64_t		waited;
+	u_int64_t		roundtrips;
+	unsigned long		request;
+};
+
 extern Display			*dpy;
 extern XftFont			*font;
 extern struct client_list	clients;
+extern struct client_list	clients_mru;
 extern int			restart;
 extern char			*homedir;
 extern char			myhost[256];
 extern unsigned int		prefix_mod;
 extern KeySym			prefix_key;
 extern char			*terminal;
+extern int			terminal_pool;
+extern char			*ssh_path;
+extern int			ssh_idle;
 extern char			*font_name;
 extern int			frame_count;
-extern int			frame_layout;
 extern u_int16_t		frame_gap;
 extern u_int16_t		frame_bar;
 extern u_int16_t		frame_width;
@@ -146,6 +257,7 @@ extern u_int16_t		screen_height;
 extern struct frame		*frame_popup;
 extern struct frame		*frame_active;
 extern struct client		*client_active;
+extern struct coma_workspace	*workspace_active;
 extern int			client_discovery;
 extern volatile sig_atomic_t	sig_recv;
 
@@ -154,26 +266,143 @@ extern Atom			atom_client_pos;
 extern Atom			atom_client_act;
 extern Atom			atom_net_wm_pid;
 extern Atom			atom_client_visible;
+extern Atom			atom_client_workspace;
+extern Atom			atom_client_status;
 
 void		fatal(const char *, ...);
 void		coma_log(const char *, ...);
 
+void		coma_proc_init(void);
+void		coma_proc_cleanup(void);
+void		coma_proc_add(struct client *);
+void		coma_proc_remove(struct client *);
+void		coma_proc_activity(struct client *, int);
+
+void		coma_cmd_pool(int, char **);
+void		coma_cmd_local(int, char **);
+void		coma_cmd_remote(int, char **);
+void		coma_cmd_status(int, char **);
+
 void		coma_reap(void);
 void		coma_command(char *);
 void		coma_execute(char **);
+void		coma_fd_cloexec(int);
+const char	*coma_execute_cwd(char *, size_t);
+
+void		coma_spawn_init(void);
+void		coma_spawn_setenv(const char *, const char *);
+void		coma_spawn_forget(pid_t);
+pid_t		coma_spawn_parent(pid_t, char *, size_t);
+u_int32_t	coma_spawn_request(char **, const char *, char **,
+		    void (*)(pid_t, int, void *), void *);
+struct frame	*coma_spawn_frame(Window);
 char		*coma_program_path(void);
 void		coma_spawn_terminal(void);
 void		coma_config_parse(const char *);
+void		coma_config_watch(void);
+void		coma_config_reload(void);
+void		coma_config_cleanup(void);
 int		coma_split_arguments(char *, char **, size_t);
 int		coma_split_string(char *, const char *, char **, size_t);
 
+void		coma_stats_init(void);
+void		coma_stats_dump(FILE *);
+void		coma_stats_cleanup(void);
+void		coma_stats_roundtrip(void);
+u_int64_t	coma_stats_now(void);
+void		coma_stats_wait(void);
+void		coma_stats_resume(void);
+void		coma_stats_begin(struct coma_sample *);
+void		coma_stats_record(struct coma_stat *, u_int64_t);
+void		coma_stats_end(struct coma_stat *, struct coma_sample *);
+
+struct coma_stat	*coma_stats_create(const char *);
+
 void		*coma_malloc(size_t);
 void		*coma_calloc(size_t, size_t);
 
+void		coma_terminal_init(void);
+void		coma_terminal_setup(void);
+void		coma_terminal_cleanup(void);
+int		coma_terminal_daemon(void);
+void		coma_terminal_exited(pid_t);
+int		coma_terminal_profile_key(const char *);
+int		coma_terminal_profile(const char *, const char *,
+		    const char *);
+int		coma_terminal_argv(char **, size_t, char *, size_t, int,
+		    const char *, const char *, int);
+
+void		coma_remote_init(void);
+void		coma_remote_expire(void);
+void		coma_remote_cleanup(void);
+void		coma_remote_exited(pid_t, int);
+void		coma_remote_seen(const char *);
+char		*coma_remote_control(const char *);
+
+void		coma_workspace_next(void);
+void		coma_workspace_prev(void);
+void		coma_workspace_setup(void);
+void		coma_workspace_cleanup(void);
+int		coma_workspace_index(struct coma_workspace *);
+int		coma_workspace_define(const char *);
+void		coma_workspace_hidden(void (*)(void));
+void		coma_workspace_switch(struct coma_workspace *);
+
+struct frame		*coma_workspace_frame(u_int32_t, u_int32_t);
+struct coma_workspace	*coma_workspace_nth(int);
+struct coma_workspace	*coma_workspace_lookup(u_int32_t);
+struct coma_workspace	*coma_workspace_find(const char *);
+
+void		coma_rule_clear(void);
+int		coma_rule_add(int, char **, char *, size_t);
+int		coma_rule_check(int, char **, char *, size_t);
+int		coma_rule_place(Window, struct coma_placement *);
+
+void		coma_complete_init(void);
+void		coma_complete_cleanup(void);
+size_t		coma_complete(const char *, char *, size_t, char *, size_t);
+
+void		coma_history_init(void);
+void		coma_history_cleanup(void);
+void		coma_history_add(const char *, const char *);
+size_t		coma_history_suggest(const char *, const char *, char *, size_t,
+		    char **, size_t);
+
+void		coma_pool_init(void);
+int		coma_pool_adopt(void);
+void		coma_pool_cleanup(void);
+void		coma_pool_exited(pid_t);
+int		coma_pool_claim(Window);
+
+void		coma_control_init(void);
+void		coma_control_cleanup(void);
+void		coma_control_event(int, const char *, ...);
+
+void		coma_ewmh_init(void);
+void		coma_ewmh_flush(void);
+void		coma_ewmh_cleanup(void);
+void		coma_ewmh_desktops(void);
+void		coma_ewmh_active(struct client *);
+void		coma_ewmh_client_add(struct client *);
+void		coma_ewmh_client_remove(struct client *);
+void		coma_ewmh_client_desktop(struct client *);
+
 void		coma_wm_run(void);
 void		coma_wm_init(void);
+void		coma_wm_sync(int);
 void		coma_wm_setup(void);
+void		coma_wm_batch_end(void);
+void		coma_wm_batch_begin(void);
+int		coma_wm_action(const char *);
+void		coma_wm_io_register(struct coma_io *);
+void		coma_wm_io_unregister(struct coma_io *);
 XftColor	*coma_wm_color(const char *);
+void		coma_wm_font_reload(void);
+void		coma_wm_prefix_reload(void);
+void		coma_wm_colors_reload(void);
+void		coma_wm_actions_reset(void);
+int		coma_wm_color_valid(const char *);
+int		coma_wm_action_valid(const char *);
 void		coma_wm_register_prefix(Window);
 int		coma_wm_register_action(const char *, KeySym);
 void		coma_wm_property_write(Window, Atom, u_int32_t);
@@ -181,13 +410,20 @@ int		coma_wm_property_read(Window, Atom, u_int32_t *);
 int		coma_wm_register_color(const char *, const char *);
 
 struct frame	*coma_frame_lookup(u_int32_t);
+struct frame	*coma_frame_slot(u_int32_t);
+struct frame	*coma_frame_nth(int);
 
 void		coma_frame_init(void);
 void		coma_frame_prev(void);
 void		coma_frame_next(void);
+void		coma_frame_up(void);
+void		coma_frame_down(void);
 void		coma_frame_zoom(void);
 void		coma_frame_setup(void);
 void		coma_frame_split(void);
+void		coma_frame_vsplit(void);
+void		coma_frame_grow(void);
+void		coma_frame_shrink(void);
 void		coma_frame_merge(void);
 void		coma_frame_cleanup(void);
 void		coma_frame_bar_sort(void);
@@ -200,11 +436,21 @@ void		coma_frame_client_next(void);
 void		coma_frame_bars_create(void);
 void		coma_frame_bars_update(void);
 void		coma_frame_popup_toggle(void);
-void		coma_frame_update_titles(void);
 void		coma_frame_layout(const char *);
+void		coma_frame_reconfigure(void);
+int		coma_frame_layout_switch(const char *);
+void		coma_frame_outputs_begin(void);
+void		coma_frame_workspace_hide(void);
+void		coma_frame_workspace_show(void);
+void		coma_frame_state_save(struct coma_workspace *);
+void		coma_frame_state_load(struct coma_workspace *);
+void		coma_frame_outputs_end(void);
+void		coma_frame_output(const char *, u_int16_t, u_int16_t,
+		    u_int16_t, u_int16_t);
 void		coma_frame_select_id(u_int32_t);
 void		coma_frame_client_move_left(void);
 void		coma_frame_client_move_right(void);
+void		coma_frame_client_move(struct client *, struct frame *);
 void		coma_frame_register(struct frame *);
 void		coma_frame_focus(struct frame *, int);
 void		coma_frame_bar_update(struct frame *);
@@ -213,19 +459,36 @@ void		coma_frame_mouseover(u_int16_t, u_int16_t);
 struct frame	*coma_frame_create(u_int16_t, u_int16_t, u_int16_t, u_int16_t);
 
 void		coma_client_init(void);
-void		coma_client_create(Window);
+void		coma_client_create(Window, const struct coma_placement *);
 void		coma_client_kill_active(void);
 void		coma_client_map(struct client *);
 void		coma_client_hide(struct client *);
+void		coma_client_show(struct client *);
 void		coma_client_focus(struct client *);
 void		coma_client_unhide(struct client *);
+void		coma_client_select(struct client *);
 void		coma_client_adjust(struct client *);
 void		coma_client_destroy(struct client *);
-void		coma_client_update_title(struct client *);
+int		coma_client_update_title(struct client *);
+int		coma_client_update_status(struct client *);
+int		coma_client_sampled(struct client *, const char *,
+		    const char *);
+void		coma_client_title_changed(struct client *);
+void		coma_client_titles_flush(void);
+u_int32_t	coma_client_title_rate(struct client *);
+int		coma_client_titles_timeout(void);
 void		coma_client_warp_pointer(struct client *);
 void		coma_client_send_configure(struct client *);
+void		coma_client_tag(struct client *, const char *);
+void		coma_client_last(void);
+void		coma_client_mru_next(void);
+int		coma_client_search(struct client *, const char *, size_t,
+		    u_int64_t);
+
+u_int64_t	coma_client_search_mask(const char *);
 
 struct client	*coma_client_find(Window);
+struct client	*coma_client_lookup(u_int32_t);
 struct client	*coma_frame_find_client(Window);
 
 #endif
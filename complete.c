@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Completion of program names for the run prompt.
+ *
+ * A thread builds a sorted index of all executables found on $PATH
+ * and rebuilds it when one of the directories changes (inotify on
+ * Linux, a periodic rescan elsewhere). The event loop only ever does
+ * a couple of binary searches on the current index.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <bsd/string.h>
+#endif
+
+#include "coma.h"
+
+#define COMPLETE_RESCAN_MS	(60 * 1000)
+#define COMPLETE_SETTLE_MS	250
+
+struct complete_index {
+	size_t		count;
+	char		**names;
+};
+
+static void			*complete_thread(void *);
+static struct complete_index	*complete_build(void);
+static void			complete_free(struct complete_index *);
+static int			complete_watch(void);
+static int			complete_cmp(const void *, const void *);
+static size_t			complete_bound(struct complete_index *,
+				    const char *, size_t, int);
+
+static pthread_t		thread;
+static pthread_mutex_t		lock = PTHREAD_MUTEX_INITIALIZER;
+static struct complete_index	*current = NULL;
+static char			*path = NULL;
+static int			quit[2] = { -1, -1 };
+static struct coma_stat		*lookups = NULL;
+
+void
+coma_complete_init(void)
+{
+	const char	*env;
+
+	if ((env = getenv("PATH")) == NULL)
+		env = "/bin:/usr/bin";
+
+	if ((path = strdup(env)) == NULL)
+		fatal("strdup");
+
+	if (pipe(quit) == -1)
+		fatal("pipe: %s", errno_s);
+
+	coma_fd_cloexec(quit[0]);
+	coma_fd_cloexec(quit[1]);
+
+	lookups = coma_stats_create("complete:lookup");
+
+	if (pthread_create(&thread, NULL, complete_thread, NULL) != 0)
+		fatal("pthread_create failed");
+}
+
+void
+coma_complete_cleanup(void)
+{
+	if (quit[1] == -1)
+		return;
+
+	/* Without it the join below would never return. */
+	if (write(quit[1], "q", 1) == -1)
+		fatal("complete: cannot stop indexer: %s", errno_s);
+	(void)pthread_join(thread, NULL);
+
+	(void)close(quit[0]);
+	(void)close(quit[1]);
+	quit[0] = quit[1] = -1;
+
+	complete_free(current);
+	current = NULL;
+
+	free(path);
+	path = NULL;
+}
+
+/*
+ * Look up prefix in the index. The longest common prefix of all
+ * matches is written to common and up to listlen bytes of space
+ * separated candidates to list. Returns the number of matches.
+ */
+size_t
+coma_complete(const char *prefix, char *common, size_t clen,
+    char *list, size_t listlen)
+{
+	struct coma_sample	sample;
+	const char		*first, *last;
+	size_t			plen, lo, hi, idx, n;
+
+	if (clen > 0)
+		common[0] = '\0';
+	if (listlen > 0)
+		list[0] = '\0';
+
+	plen = strlen(prefix);
+
+	coma_stats_begin(&sample);
+	pthread_mutex_lock(&lock);
+
+	if (current == NULL) {
+		pthread_mutex_unlock(&lock);
+		return (0);
+	}
+
+	lo = complete_bound(current, prefix, plen, 0);
+	hi = complete_bound(current, prefix, plen, 1);
+
+	if (lo < hi) {
+		first = current->names[lo];
+		last = current->names[hi - 1];
+
+		/* Sorted, so first and last share the common part. */
+		for (n = 0; first[n] != '\0' && first[n] == last[n]; n++)
+			;
+
+		if (n < clen) {
+			memcpy(common, first, n);
+			common[n] = '\0';
+		}
+
+		for (idx = lo; idx < hi; idx++) {
+			if (idx != lo && strlcat(list, " ", listlen) >= listlen)
+				break;
+			if (strlcat(list, current->names[idx],
+			    listlen) >= listlen)
+				break;
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+	coma_stats_end(lookups, &sample);
+
+	return (hi - lo);
+}
+
+static void *
+complete_thread(void *arg)
+{
+	struct pollfd		pfd[2];
+	struct complete_index	*idx, *old;
+	sigset_t		sigs;
+	int			watch, timeout, nfds, ret;
+	char			buf[4096];
+
+	/* Signals are for the main loop. */
+	sigfillset(&sigs);
+	(void)pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	watch = -1;
+
+	for (;;) {
+		if (watch != -1)
+			(void)close(watch);
+
+		watch = complete_watch();
+		idx = complete_build();
+
+		pthread_mutex_lock(&lock);
+		old = current;
+		current = idx;
+		pthread_mutex_unlock(&lock);
+
+		complete_free(old);
+
+		pfd[0].fd = quit[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = watch;
+		pfd[1].events = POLLIN;
+		nfds = watch != -1 ? 2 : 1;
+
+		timeout = watch != -1 ? -1 : COMPLETE_RESCAN_MS;
+
+		/* An interrupted poll is not a reason to rebuild. */
+		while ((ret = poll(pfd, nfds, timeout)) == -1 && errno == EINTR)
+			;
+
+		if (ret == -1)
+			break;
+
+		if (pfd[0].revents & POLLIN)
+			break;
+
+		/* Let a package install or the like settle first. */
+		if (nfds == 2 && (pfd[1].revents & POLLIN)) {
+			do {
+				while (read(watch, buf, sizeof(buf)) > 0)
+					;
+			} while (poll(&pfd[1], 1, COMPLETE_SETTLE_MS) > 0);
+		}
+	}
+
+	if (watch != -1)
+		(void)close(watch);
+
+	return (NULL);
+}
+
+/*
+ * Returns a descriptor that becomes readable when any of the $PATH
+ * directories change, or -1 if the platform has no way to tell us.
+ */
+static int
+complete_watch(void)
+{
+#if defined(__linux__)
+	int		fd;
+	char		*copy, *dir, *p;
+
+	if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		coma_log("inotify_init1: %s", errno_s);
+		return (-1);
+	}
+
+	if ((copy = strdup(path)) == NULL)
+		return (fd);
+
+	p = copy;
+	while ((dir = strsep(&p, ":")) != NULL) {
+		if (*dir == '\0')
+			continue;
+		(void)inotify_add_watch(fd, dir, IN_CREATE | IN_DELETE |
+		    IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF);
+	}
+
+	free(copy);
+
+	return (fd);
+#else
+	return (-1);
+#endif
+}
+
+static struct complete_index *
+complete_build(void)
+{
+	DIR			*d;
+	struct stat		st;
+	struct dirent		*dp;
+	int			len;
+	size_t			size, idx, uniq;
+	struct complete_index	*ci;
+	char			*copy, *dir, *p, file[PATH_MAX];
+
+	ci = coma_calloc(1, sizeof(*ci));
+
+	size = 0;
+
+	if ((copy = strdup(path)) == NULL)
+		return (ci);
+
+	p = copy;
+	while ((dir = strsep(&p, ":")) != NULL) {
+		if (*dir == '\0' || (d = opendir(dir)) == NULL)
+			continue;
+
+		while ((dp = readdir(d)) != NULL) {
+			if (dp->d_name[0] == '.')
+				continue;
+
+			len = snprintf(file, sizeof(file), "%s/%s",
+			    dir, dp->d_name);
+			if (len == -1 || (size_t)len >= sizeof(file))
+				continue;
+
+			if (stat(file, &st) == -1 || !S_ISREG(st.st_mode) ||
+			    !(st.st_mode & 0111))
+				continue;
+
+			if (ci->count == size) {
+				size = size == 0 ? 1024 : size * 2;
+				ci->names = realloc(ci->names,
+				    size * sizeof(char *));
+				if (ci->names == NULL)
+					fatal("realloc: %s", errno_s);
+			}
+
+			ci->names[ci->count] = strdup(dp->d_name);
+			if (ci->names[ci->count] == NULL)
+				fatal("strdup");
+			ci->count++;
+		}
+
+		(void)closedir(d);
+	}
+
+	free(copy);
+
+	if (ci->count == 0)
+		return (ci);
+
+	qsort(ci->names, ci->count, sizeof(char *), complete_cmp);
+
+	/* The same name in several directories only shows up once. */
+	uniq = 1;
+	for (idx = 1; idx < ci->count; idx++) {
+		if (!strcmp(ci->names[idx], ci->names[uniq - 1])) {
+			free(ci->names[idx]);
+			continue;
+		}
+		ci->names[uniq++] = ci->names[idx];
+	}
+
+	ci->count = uniq;
+
+	return (ci);
+}
+
+static void
+complete_free(struct complete_index *ci)
+{
+	size_t		idx;
+
+	if (ci == NULL)
+		return;
+
+	for (idx = 0; idx < ci->count; idx++)
+		free(ci->names[idx]);
+
+	free(ci->names);
+	free(ci);
+}
+
+static int
+complete_cmp(const void *a, const void *b)
+{
+	return (strcmp(*(char * const *)a, *(char * const *)b));
+}
+
+/*
+ * First entry that does not sort before prefix (upper == 0) or the
+ * first entry after all entries starting with prefix (upper == 1).
+ */
+static size_t
+complete_bound(struct complete_index *ci, const char *prefix, size_t plen,
+    int upper)
+{
+	int		cmp;
+	size_t		lo, hi, mid;
+
+	lo = 0;
+	hi = ci->count;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strncmp(ci->names[mid], prefix, plen);
+
+		if (cmp < 0 || (upper && cmp == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
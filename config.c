@@ -14,24 +14,82 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+/*
+ * The configuration file is parsed into a struct config that is only
+ * applied once the whole file turned out fine. While running the file
+ * is watched and a changed file is parsed again, comparing the result
+ * with what is live so only the settings that differ are applied.
+ * A broken file keeps the configuration that was there.
+ */
+
 #include <sys/types.h>
+#include <sys/queue.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 
 #include <X11/keysymdef.h>
 
 #include <ctype.h>
+#include <limits.h>
+#include <poll.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
 
+#if defined(__linux__)
+#include <bsd/string.h>
+#endif
+
 #include "coma.h"
 
+struct config_entry {
+	char				*key;
+	char				*value;
+	TAILQ_ENTRY(config_entry)	list;
+};
+
+TAILQ_HEAD(config_list, config_entry);
+
+struct config {
+	char			*font;
+	char			*terminal;
+	char			*ssh_path;
+	char			*layout;
+	KeySym			prefix_key;
+	unsigned int		prefix_mod;
+	int			ssh_idle;
+	int			terminal_pool;
+	int			frame_count;
+	int			frame_offset;
+	u_int16_t		frame_gap;
+	u_int16_t		frame_bar;
+	u_int16_t		frame_width;
+	u_int16_t		frame_height;
+	u_int16_t		frame_border;
+	u_int16_t		screen_height;
+
+	struct config_list	binds;
+	struct config_list	colors;
+	struct config_list	frames;
+	struct config_list	layouts;
+	struct config_list	profiles;
+	struct config_list	rules;
+	struct config_list	workspaces;
+};
+
 static void	config_bind(int, char **);
 static void	config_font(int, char **);
 static void	config_color(int, char **);
 static void	config_prefix(int, char **);
 static void	config_terminal(int, char **);
+static void	config_terminal_pool(int, char **);
+static void	config_terminal_profile(int, char **);
+static void	config_ssh_path(int, char **);
+static void	config_ssh_idle(int, char **);
 static void	config_screen_height(int, char **);
 
 static void	config_frame_gap(int, char **);
@@ -43,14 +101,36 @@ static void	config_frame_offset(int, char **);
 static void	config_frame_border(int, char **);
 static void	config_frame_layout(int, char **);
 static void	config_frame_create(int, char **);
-
-static void		config_parse(const char *);
-static void		config_fatal(const char *, const char *, ...);
+static void	config_layout(int, char **);
+static void	config_workspace(int, char **);
+static void	config_rule(int, char **);
+
+static struct config	*config_load(const char *, int);
+static struct config	*config_create(const struct config *);
+
+static void		config_free(struct config *);
+static void		config_apply(struct config *, struct config *, int);
+static void		config_error(const char *, const char *, ...);
+static void		config_string(char **, const char *);
+static int		config_string_equal(const char *, const char *);
+static int		config_list_equal(struct config_list *,
+			    struct config_list *);
+static void		config_list_free(struct config_list *);
+static int		config_join(int, char **, char *, size_t);
+static void		config_entry_add(struct config_list *,
+			    const char *, const char *);
+static struct config_entry	*config_entry_find(struct config_list *,
+				    const char *);
+
+#if defined(__linux__)
+static void		config_watch_event(struct coma_io *, int);
+#endif
 
 static char		*config_read_line(FILE *, char *, size_t);
 static long long	config_strtonum(const char *, const char *, int,
 			    long long, long long);
 
+/* A negative number of args means at least that many. */
 struct {
 	const char		*name;
 	int			args;
@@ -61,6 +141,10 @@ struct {
 	{ "color",			2,	config_color },
 	{ "prefix",			1,	config_prefix },
 	{ "terminal",			1,	config_terminal },
+	{ "terminal-pool",		1,	config_terminal_pool },
+	{ "terminal-profile",		-3,	config_terminal_profile },
+	{ "ssh-path",			1,	config_ssh_path },
+	{ "ssh-idle",			1,	config_ssh_idle },
 	{ "screen-height",		1,	config_screen_height },
 
 	{ "frame-gap",			1,	config_frame_gap },
@@ -72,6 +156,9 @@ struct {
 	{ "frame-border",		1,	config_frame_border },
 	{ "frame-layout",		1,	config_frame_layout },
 	{ "frame-create",		4,	config_frame_create },
+	{ "layout",			-2,	config_layout },
+	{ "workspace",			1,	config_workspace },
+	{ "rule",			-2,	config_rule },
 
 	{ NULL, 0, NULL }
 };
@@ -89,40 +176,252 @@ struct {
 	{ NULL,		0 }
 };
 
-static int	config_line = 1;
+static int		config_line = 1;
+static int		config_failed = 0;
+static char		config_errmsg[PATH_MAX + 256];
+static char		config_path[PATH_MAX];
+
+/* The built-in defaults, what is live and what is being parsed. */
+static struct config	*config_base = NULL;
+static struct config	*config_active = NULL;
+static struct config	*config_new = NULL;
+
+#if defined(__linux__)
+/*
+ * The file is watched by name in its directory, both where the path
+ * points and, for a symlink, where the link itself lives.
+ */
+struct config_watch {
+	int		wd;
+	char		dir[PATH_MAX];
+	char		name[NAME_MAX + 1];
+};
+
+static void		config_watch_add(struct config_watch *, const char *);
+static void		config_watch_setup(void);
+
+static struct coma_io		config_io = { .fd = -1 };
+static struct config_watch	config_watches[2] = {
+	{ .wd = -1 }, { .wd = -1 }
+};
+#endif
 
 void
 coma_config_parse(const char *cpath)
 {
 	int			len;
 	struct passwd		*pw;
-	char			path[PATH_MAX];
+	struct config		*conf;
 
 	if (cpath == NULL) {
 		if ((pw = getpwuid(getuid())) == NULL)
 			fatal("getpwuid(): %s", errno_s);
 
-		len = snprintf(path, sizeof(path), "%s/.comarc", pw->pw_dir);
-		if (len == -1 || (size_t)len >= sizeof(path))
+		len = snprintf(config_path, sizeof(config_path),
+		    "%s/.comarc", pw->pw_dir);
+		if (len == -1 || (size_t)len >= sizeof(config_path))
 			fatal("failed to create path to config file");
+	} else {
+		if (strlcpy(config_path, cpath, sizeof(config_path)) >=
+		    sizeof(config_path))
+			fatal("config file path too long");
+	}
 
-		cpath = path;
+	/* Whatever is set before the config is what it falls back to. */
+	config_base = config_create(NULL);
+
+	if ((conf = config_load(config_path, 1)) == NULL) {
+		fprintf(stderr, "%s\n", config_errmsg);
+		exit(1);
+	}
+
+	config_apply(config_base, conf, 0);
+	config_active = conf;
+}
+
+/* Parse the config file again and apply what changed in it. */
+void
+coma_config_reload(void)
+{
+	struct config	*conf;
+
+	if ((conf = config_load(config_path, 0)) == NULL) {
+		coma_log("%s, keeping the old config", config_errmsg);
+		return;
 	}
 
-	config_parse(cpath);
+	config_apply(config_active, conf, 1);
+	config_free(config_active);
+	config_active = conf;
+
+	coma_log("reloaded %s", config_path);
+}
+
+/*
+ * Watch the directory the config file lives in, editors tend to write
+ * a new file and rename it over the old one.
+ */
+void
+coma_config_watch(void)
+{
+#if defined(__linux__)
+	if ((config_io.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		coma_log("inotify_init1: %s", errno_s);
+		return;
+	}
+
+	config_watch_setup();
+
+	config_io.arg = NULL;
+	config_io.events = POLLIN;
+	config_io.cb = config_watch_event;
+
+	coma_wm_io_register(&config_io);
+#endif
+}
+
+void
+coma_config_cleanup(void)
+{
+#if defined(__linux__)
+	if (config_io.fd != -1) {
+		coma_wm_io_unregister(&config_io);
+		(void)close(config_io.fd);
+		config_io.fd = -1;
+	}
+#endif
+
+	config_free(config_active);
+	config_free(config_base);
+
+	config_active = NULL;
+	config_base = NULL;
+}
+
+#if defined(__linux__)
+static void
+config_watch_event(struct coma_io *io, int revents)
+{
+	ssize_t			ret;
+	size_t			off;
+	int			idx, changed;
+	struct inotify_event	*evt;
+	struct config_watch	*watch;
+	union {
+		struct inotify_event	evt;
+		char			buf[4096];
+	} u;
+
+	changed = 0;
+
+	for (;;) {
+		if ((ret = read(io->fd, u.buf, sizeof(u.buf))) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				coma_log("inotify read: %s", errno_s);
+			break;
+		}
+
+		if (ret == 0)
+			break;
+
+		for (off = 0; off < (size_t)ret;
+		    off += sizeof(*evt) + evt->len) {
+			evt = (struct inotify_event *)(u.buf + off);
+			if (evt->len == 0)
+				continue;
+			for (idx = 0; idx < 2; idx++) {
+				watch = &config_watches[idx];
+				if (evt->wd == watch->wd &&
+				    !strcmp(evt->name, watch->name))
+					changed = 1;
+			}
+		}
+	}
+
+	if (!changed)
+		return;
+
+	coma_config_reload();
+
+	/* A symlink may point somewhere else now. */
+	config_watch_setup();
+}
+
+static void
+config_watch_setup(void)
+{
+	int		idx;
+	char		path[PATH_MAX];
+
+	for (idx = 0; idx < 2; idx++) {
+		if (config_watches[idx].wd != -1)
+			(void)inotify_rm_watch(config_io.fd,
+			    config_watches[idx].wd);
+		config_watches[idx].wd = -1;
+	}
+
+	config_watch_add(&config_watches[0], config_path);
+
+	if (realpath(config_path, path) != NULL &&
+	    strcmp(path, config_path))
+		config_watch_add(&config_watches[1], path);
 }
 
 static void
-config_parse(const char *path)
+config_watch_add(struct config_watch *watch, const char *path)
+{
+	const char	*p;
+
+	if ((p = strrchr(path, '/')) == NULL) {
+		(void)strlcpy(watch->dir, ".", sizeof(watch->dir));
+		p = path;
+	} else {
+		(void)strlcpy(watch->dir, path, sizeof(watch->dir));
+		watch->dir[p == path ? 1 : p - path] = '\0';
+		p++;
+	}
+
+	(void)strlcpy(watch->name, p, sizeof(watch->name));
+
+	watch->wd = inotify_add_watch(config_io.fd, watch->dir,
+	    IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (watch->wd == -1)
+		coma_log("inotify_add_watch(%s): %s", watch->dir, errno_s);
+}
+#endif
+
+/*
+ * Parse the file at path into a new config, based on the defaults.
+ * Returns NULL with config_errmsg set if anything in it is wrong. With
+ * optional set a file that cannot be opened is the same as an empty one.
+ */
+static struct config *
+config_load(const char *path, int optional)
 {
 	FILE		*fp;
+	struct config	*conf;
 	int		i, argc;
 	char		*line, buf[128], *argv[16];
 
-	if ((fp = fopen(path, "r")) == NULL)
-		return;
+	conf = config_create(config_base);
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		if (optional)
+			return (conf);
+		(void)snprintf(config_errmsg, sizeof(config_errmsg),
+		    "%s: %s", path, errno_s);
+		config_free(conf);
+		return (NULL);
+	}
 
-	while ((line = config_read_line(fp, buf, sizeof(buf))) != NULL) {
+	config_new = conf;
+	config_line = 1;
+	config_failed = 0;
+
+	while (config_failed == 0 &&
+	    (line = config_read_line(fp, buf, sizeof(buf))) != NULL) {
 		argc = coma_split_string(line, " ", argv, 16);
 
 		if (argc < 2) {
@@ -133,8 +432,14 @@ config_parse(const char *path)
 		for (i = 0; keywords[i].name != NULL; i++) {
 			if (!strcmp(argv[0], keywords[i].name)) {
 				coma_log("got '%s' with %d", argv[0], argc - 1);
-				if (argc - 1 != keywords[i].args) {
-					config_fatal(argv[0],
+				if (keywords[i].args < 0 &&
+				    argc - 1 < -keywords[i].args) {
+					config_error(argv[0],
+					    "requires at least %d args, got %d",
+					    -keywords[i].args, argc - 1);
+				} else if (keywords[i].args >= 0 &&
+				    argc - 1 != keywords[i].args) {
+					config_error(argv[0],
 					    "requires %d args, got %d",
 					    keywords[i].args, argc - 1);
 				} else {
@@ -147,66 +452,448 @@ config_parse(const char *path)
 	}
 
 	(void)fclose(fp);
+
+	if (config_failed == 0 && conf->layout != NULL &&
+	    config_entry_find(&conf->layouts, conf->layout) == NULL &&
+	    !coma_layout_builtin(conf->layout)) {
+		(void)snprintf(config_errmsg, sizeof(config_errmsg),
+		    "config error: unknown frame-layout '%s'", conf->layout);
+		config_failed = 1;
+	}
+
+	config_new = NULL;
+
+	if (config_failed) {
+		config_free(conf);
+		return (NULL);
+	}
+
+	return (conf);
+}
+
+/* A config with the settings of base, or those that are live now. */
+static struct config *
+config_create(const struct config *base)
+{
+	struct config	*conf;
+
+	conf = coma_calloc(1, sizeof(*conf));
+
+	TAILQ_INIT(&conf->binds);
+	TAILQ_INIT(&conf->colors);
+	TAILQ_INIT(&conf->frames);
+	TAILQ_INIT(&conf->layouts);
+	TAILQ_INIT(&conf->profiles);
+	TAILQ_INIT(&conf->rules);
+	TAILQ_INIT(&conf->workspaces);
+
+	if (base != NULL) {
+		config_string(&conf->font, base->font);
+		config_string(&conf->terminal, base->terminal);
+		config_string(&conf->ssh_path, base->ssh_path);
+		config_string(&conf->layout, base->layout);
+		conf->prefix_key = base->prefix_key;
+		conf->prefix_mod = base->prefix_mod;
+		conf->ssh_idle = base->ssh_idle;
+		conf->terminal_pool = base->terminal_pool;
+		conf->frame_count = base->frame_count;
+		conf->frame_offset = base->frame_offset;
+		conf->frame_gap = base->frame_gap;
+		conf->frame_bar = base->frame_bar;
+		conf->frame_width = base->frame_width;
+		conf->frame_height = base->frame_height;
+		conf->frame_border = base->frame_border;
+		conf->screen_height = base->screen_height;
+	} else {
+		config_string(&conf->font, font_name);
+		config_string(&conf->terminal, terminal);
+		config_string(&conf->ssh_path, ssh_path);
+		conf->prefix_key = prefix_key;
+		conf->prefix_mod = prefix_mod;
+		conf->ssh_idle = ssh_idle;
+		conf->terminal_pool = terminal_pool;
+		conf->frame_count = frame_count;
+		conf->frame_offset = frame_offset;
+		conf->frame_gap = frame_gap;
+		conf->frame_bar = frame_bar;
+		conf->frame_width = frame_width;
+		conf->frame_height = frame_height;
+		conf->frame_border = frame_border;
+		conf->screen_height = screen_height;
+	}
+
+	return (conf);
+}
+
+static void
+config_free(struct config *conf)
+{
+	if (conf == NULL)
+		return;
+
+	free(conf->font);
+	free(conf->terminal);
+	free(conf->ssh_path);
+	free(conf->layout);
+
+	config_list_free(&conf->binds);
+	config_list_free(&conf->colors);
+	config_list_free(&conf->frames);
+	config_list_free(&conf->layouts);
+	config_list_free(&conf->profiles);
+	config_list_free(&conf->rules);
+	config_list_free(&conf->workspaces);
+
+	free(conf);
+}
+
+/*
+ * Apply everything in conf that differs from old. At startup (live is 0)
+ * old holds the defaults and nothing is on screen yet.
+ */
+static void
+config_apply(struct config *old, struct config *conf, int live)
+{
+	struct config_entry	*entry, *prev;
+	int			argc, recolor, relayout, reterm;
+	u_int16_t		x, y, w, h;
+	char			*value, copy[128], *argv[16];
+
+	if (!config_string_equal(old->font, conf->font)) {
+		config_string(&font_name, conf->font);
+		if (live)
+			coma_wm_font_reload();
+	}
+
+	if (old->prefix_key != conf->prefix_key ||
+	    old->prefix_mod != conf->prefix_mod) {
+		prefix_key = conf->prefix_key;
+		prefix_mod = conf->prefix_mod;
+		if (live)
+			coma_wm_prefix_reload();
+	}
+
+	recolor = 0;
+
+	TAILQ_FOREACH(entry, &old->colors, list) {
+		if (config_entry_find(&conf->colors, entry->key) == NULL) {
+			(void)coma_wm_register_color(entry->key, NULL);
+			recolor = 1;
+		}
+	}
+
+	TAILQ_FOREACH(entry, &conf->colors, list) {
+		prev = config_entry_find(&old->colors, entry->key);
+		if (prev == NULL || strcmp(prev->value, entry->value)) {
+			(void)coma_wm_register_color(entry->key, entry->value);
+			recolor = 1;
+		}
+	}
+
+	if (live && recolor)
+		coma_wm_colors_reload();
+
+	if (!config_list_equal(&old->binds, &conf->binds)) {
+		coma_wm_actions_reset();
+		TAILQ_FOREACH(entry, &conf->binds, list) {
+			(void)coma_wm_register_action(entry->key,
+			    XStringToKeysym(entry->value));
+		}
+	}
+
+	reterm = 0;
+
+	if (!config_string_equal(old->terminal, conf->terminal)) {
+		config_string(&terminal, conf->terminal);
+		reterm = 1;
+	}
+
+	if (!config_string_equal(old->ssh_path, conf->ssh_path)) {
+		config_string(&ssh_path, conf->ssh_path);
+		if (live)
+			coma_remote_init();
+	}
+
+	ssh_idle = conf->ssh_idle;
+
+	if (!config_list_equal(&old->profiles, &conf->profiles)) {
+		coma_terminal_cleanup();
+		coma_terminal_init();
+		TAILQ_FOREACH(entry, &conf->profiles, list) {
+			(void)strlcpy(copy, entry->value, sizeof(copy));
+			if ((value = strchr(copy, ' ')) != NULL)
+				*(value)++ = '\0';
+			(void)coma_terminal_profile(entry->key, copy,
+			    value != NULL ? value : "");
+		}
+		reterm = 1;
+	}
+
+	/* The server for the old terminal does not serve the new one. */
+	if (live && reterm)
+		coma_terminal_setup();
+
+	if (!config_list_equal(&old->rules, &conf->rules)) {
+		coma_rule_clear();
+		TAILQ_FOREACH(entry, &conf->rules, list) {
+			(void)strlcpy(copy, entry->value, sizeof(copy));
+			argc = coma_split_string(copy, " ", argv, 16);
+			if (coma_rule_add(argc, argv,
+			    config_errmsg, sizeof(config_errmsg)) == -1)
+				fatal("rule %s: %s",
+				    entry->value, config_errmsg);
+		}
+	}
+
+	relayout = 0;
+
+	if (!config_list_equal(&old->layouts, &conf->layouts)) {
+		coma_layout_cleanup();
+		if (coma_layout_init(config_errmsg,
+		    sizeof(config_errmsg)) == -1)
+			fatal("builtin layouts: %s", config_errmsg);
+		TAILQ_FOREACH(entry, &conf->layouts, list) {
+			(void)strlcpy(copy, entry->value, sizeof(copy));
+			if (coma_layout_define(entry->key,
+			    coma_split_string(copy, " ", argv, 16), argv,
+			    config_errmsg, sizeof(config_errmsg)) == -1)
+				fatal("layout %s: %s",
+				    entry->key, config_errmsg);
+		}
+		relayout = 1;
+	}
+
+	if (!config_string_equal(old->layout, conf->layout)) {
+		coma_frame_layout(conf->layout != NULL ?
+		    conf->layout : COMA_FRAME_LAYOUT_DEFAULT);
+		relayout = 1;
+	}
+
+	/* frame_offset is overwritten once placed, only set it if needed. */
+	if (old->frame_gap != conf->frame_gap ||
+	    old->frame_bar != conf->frame_bar ||
+	    old->frame_count != conf->frame_count ||
+	    old->frame_width != conf->frame_width ||
+	    old->frame_height != conf->frame_height ||
+	    old->frame_offset != conf->frame_offset ||
+	    old->frame_border != conf->frame_border) {
+		frame_gap = conf->frame_gap;
+		frame_bar = conf->frame_bar;
+		frame_count = conf->frame_count;
+		frame_width = conf->frame_width;
+		frame_height = conf->frame_height;
+		frame_offset = conf->frame_offset;
+		frame_border = conf->frame_border;
+		relayout = 1;
+	}
+
+	TAILQ_FOREACH(entry, &conf->workspaces, list) {
+		if (config_entry_find(&old->workspaces, entry->key) != NULL)
+			continue;
+		if (coma_workspace_define(entry->key) == -1)
+			coma_log("workspace '%s' exists", entry->key);
+		else if (live)
+			coma_ewmh_desktops();
+	}
+
+	if (live == 0) {
+		screen_height = conf->screen_height;
+		terminal_pool = conf->terminal_pool;
+		TAILQ_FOREACH(entry, &conf->frames, list) {
+			if (sscanf(entry->value, "%hu %hu %hu %hu",
+			    &x, &y, &w, &h) != 4)
+				fatal("bad frame '%s'", entry->value);
+			coma_frame_register(coma_frame_create(w, h, x, y));
+		}
+		return;
+	}
+
+	TAILQ_FOREACH(entry, &old->workspaces, list) {
+		if (config_entry_find(&conf->workspaces, entry->key) == NULL)
+			coma_log("workspace '%s' stays until a restart",
+			    entry->key);
+	}
+
+	if (old->screen_height != conf->screen_height ||
+	    !config_list_equal(&old->frames, &conf->frames))
+		coma_log("screen-height and frame-create need a restart");
+
+	if (old->terminal_pool != conf->terminal_pool)
+		coma_log("terminal-pool needs a restart");
+
+	if (relayout)
+		coma_frame_reconfigure();
 }
 
 static void
-config_fatal(const char *kw, const char *fmt, ...)
+config_error(const char *kw, const char *fmt, ...)
 {
+	int		len;
 	va_list		args;
 
-	fprintf(stderr, "config error on line %d for keyword '%s': ",
-	    config_line, kw);
+	/* Only the first error is worth reporting. */
+	if (config_failed)
+		return;
+
+	config_failed = 1;
+
+	len = snprintf(config_errmsg, sizeof(config_errmsg),
+	    "config error on line %d for keyword '%s': ", config_line, kw);
+	if (len == -1 || (size_t)len >= sizeof(config_errmsg))
+		return;
 
 	va_start(args, fmt);
-	vfprintf(stderr, fmt, args);
+	(void)vsnprintf(config_errmsg + len, sizeof(config_errmsg) - len,
+	    fmt, args);
 	va_end(args);
+}
 
-	fprintf(stderr, "\n");
+static void
+config_string(char **dst, const char *value)
+{
+	free(*dst);
+	*dst = NULL;
 
-	exit(1);
+	if (value != NULL && (*dst = strdup(value)) == NULL)
+		fatal("strdup");
+}
+
+static int
+config_string_equal(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a == b);
+
+	return (!strcmp(a, b));
+}
+
+static int
+config_list_equal(struct config_list *a, struct config_list *b)
+{
+	struct config_entry	*x, *y;
+
+	y = TAILQ_FIRST(b);
+
+	TAILQ_FOREACH(x, a, list) {
+		if (y == NULL || strcmp(x->key, y->key) ||
+		    strcmp(x->value, y->value))
+			return (0);
+		y = TAILQ_NEXT(y, list);
+	}
+
+	return (y == NULL);
+}
+
+static void
+config_list_free(struct config_list *list)
+{
+	struct config_entry	*entry;
+
+	while ((entry = TAILQ_FIRST(list)) != NULL) {
+		TAILQ_REMOVE(list, entry, list);
+		free(entry->key);
+		free(entry->value);
+		free(entry);
+	}
+}
+
+static void
+config_entry_add(struct config_list *list, const char *key,
+    const char *value)
+{
+	struct config_entry	*entry;
+
+	entry = coma_calloc(1, sizeof(*entry));
+
+	if ((entry->key = strdup(key)) == NULL ||
+	    (entry->value = strdup(value)) == NULL)
+		fatal("strdup");
+
+	TAILQ_INSERT_TAIL(list, entry, list);
+}
+
+static struct config_entry *
+config_entry_find(struct config_list *list, const char *key)
+{
+	struct config_entry	*entry;
+
+	TAILQ_FOREACH(entry, list, list) {
+		if (!strcmp(entry->key, key))
+			return (entry);
+	}
+
+	return (NULL);
+}
+
+/* Join args into out, space separated. */
+static int
+config_join(int argc, char **argv, char *out, size_t len)
+{
+	int		i;
+
+	out[0] = '\0';
+
+	for (i = 0; i < argc; i++) {
+		if (i > 0)
+			(void)strlcat(out, " ", len);
+		if (strlcat(out, argv[i], len) >= len)
+			return (-1);
+	}
+
+	return (0);
 }
 
 static void
 config_bind(int argc, char **argv)
 {
-	KeySym		sym;
+	if (XStringToKeysym(argv[2]) == NoSymbol) {
+		config_error(argv[0], "invalid key '%s'", argv[2]);
+		return;
+	}
 
-	if ((sym = XStringToKeysym(argv[2])) == NoSymbol)
-		config_fatal(argv[0], "invalid key '%s'", argv[2]);
+	if (!coma_wm_action_valid(argv[1])) {
+		config_error(argv[0], "unknown action '%s'", argv[1]);
+		return;
+	}
 
-	if (coma_wm_register_action(argv[1], sym) == -1)
-		config_fatal(argv[0], "unknown action '%s'", argv[1]);
+	config_entry_add(&config_new->binds, argv[1], argv[2]);
 }
 
 static void
 config_font(int argc, char **argv)
 {
-	free(font_name);
-
-	if ((font_name = strdup(argv[1])) == NULL)
-		fatal("strdup");
+	config_string(&config_new->font, argv[1]);
 }
 
 static void
 config_color(int argc, char **argv)
 {
-	int		valid;
-	char		*color, *p, *c;
+	int			valid;
+	struct config_entry	*entry;
+	char			*color, *p, *c;
 
-	if (*argv[2] != '"')
-		config_fatal(argv[0], "missing beginning '\"'");
+	if (*argv[2] != '"') {
+		config_error(argv[0], "missing beginning '\"'");
+		return;
+	}
 
 	color = argv[2] + 1;
 
-	if ((p = strchr(color, '"')) == NULL)
-		config_fatal(argv[0], "missing ending '\"'");
+	if ((p = strchr(color, '"')) == NULL) {
+		config_error(argv[0], "missing ending '\"'");
+		return;
+	}
 	*p = '\0';
 
-	if (*color != '#')
-		config_fatal(argv[0], "missing '#' in rgb color '%s'", color);
+	if (*color != '#') {
+		config_error(argv[0], "missing '#' in rgb color '%s'", color);
+		return;
+	}
 
-	if (strlen(color) != 7)
-		config_fatal(argv[0], "invalid rgb color '%s'", color);
+	if (strlen(color) != 7) {
+		config_error(argv[0], "invalid rgb color '%s'", color);
+		return;
+	}
 
 	for (c = color + 1; *c != '\0'; c++) {
 		valid = 0;
@@ -214,125 +901,244 @@ config_color(int argc, char **argv)
 			valid |= (*c >= 'a' && *c <= 'f');
 			valid |= (*c >= 'A' && *c <= 'F');
 			if (valid == 0) {
-				config_fatal(argv[0],
+				config_error(argv[0],
 				    "invalid rgb color '%s'", color);
+				return;
 			}
 		}
 	}
 
-	if (coma_wm_register_color(argv[1], color) == -1)
-		config_fatal(argv[0], "unknown color '%s'", argv[1]);
+	if (!coma_wm_color_valid(argv[1])) {
+		config_error(argv[0], "unknown color '%s'", argv[1]);
+		return;
+	}
+
+	/* The last one for a color wins. */
+	if ((entry = config_entry_find(&config_new->colors, argv[1])) != NULL)
+		config_string(&entry->value, color);
+	else
+		config_entry_add(&config_new->colors, argv[1], color);
 }
 
 static void
 config_prefix(int argc, char **argv)
 {
 	int		i;
+	KeySym		sym;
 	char		*mod, *key;
 
 	mod = argv[1];
 
-	if ((key = strchr(mod, '-')) == NULL)
-		config_fatal(argv[0], "missing '-' in prefix key");
+	if ((key = strchr(mod, '-')) == NULL) {
+		config_error(argv[0], "missing '-' in prefix key");
+		return;
+	}
 
 	*(key)++ = '\0';
 
-	if (*mod == '\0')
-		config_fatal(argv[0], "missing mod value before '-'");
+	if (*mod == '\0') {
+		config_error(argv[0], "missing mod value before '-'");
+		return;
+	}
 
-	if (*key == '\0')
-		config_fatal(argv[0], "missing key value after '-'");
+	if (*key == '\0') {
+		config_error(argv[0], "missing key value after '-'");
+		return;
+	}
 
-	if ((prefix_key = XStringToKeysym(key)) == NoSymbol)
-		config_fatal(argv[0], "invalid key '%s'", key);
+	if ((sym = XStringToKeysym(key)) == NoSymbol) {
+		config_error(argv[0], "invalid key '%s'", key);
+		return;
+	}
 
 	for (i = 0; modmasks[i].mod != NULL; i++) {
-		if (!strcmp(mod, modmasks[i].mod)) {
-			prefix_mod = modmasks[i].mask;
+		if (!strcmp(mod, modmasks[i].mod))
 			break;
-		}
 	}
 
-	if (modmasks[i].mask == 0)
-		config_fatal(argv[0], "invalid mod key '%s'", mod);
+	if (modmasks[i].mask == 0) {
+		config_error(argv[0], "invalid mod key '%s'", mod);
+		return;
+	}
+
+	config_new->prefix_key = sym;
+	config_new->prefix_mod = modmasks[i].mask;
 }
 
 static void
 config_terminal(int argc, char **argv)
 {
-	free(terminal);
+	config_string(&config_new->terminal, argv[1]);
+}
 
-	if ((terminal = strdup(argv[1])) == NULL)
-		fatal("strdup");
+static void
+config_terminal_pool(int argc, char **argv)
+{
+	config_new->terminal_pool =
+	    config_strtonum(argv[0], argv[1], 10, 0, 16);
+}
+
+static void
+config_terminal_profile(int argc, char **argv)
+{
+	char		value[128];
+
+	if (!coma_terminal_profile_key(argv[2])) {
+		config_error(argv[0], "unknown key '%s'", argv[2]);
+		return;
+	}
+
+	/* The value may be a command line, like for daemon. */
+	if (config_join(argc - 2, argv + 2, value, sizeof(value)) == -1) {
+		config_error(argv[0], "value too long");
+		return;
+	}
+
+	config_entry_add(&config_new->profiles, argv[1], value);
+}
+
+static void
+config_ssh_path(int argc, char **argv)
+{
+	config_string(&config_new->ssh_path, argv[1]);
+}
+
+static void
+config_ssh_idle(int argc, char **argv)
+{
+	config_new->ssh_idle =
+	    config_strtonum(argv[0], argv[1], 10, 0, INT_MAX);
 }
 
 static void
 config_screen_height(int argc, char **argv)
 {
-	screen_height = config_strtonum(argv[0], argv[1], 10, 1, USHRT_MAX);
+	config_new->screen_height =
+	    config_strtonum(argv[0], argv[1], 10, 1, USHRT_MAX);
 }
 
 static void
 config_frame_bar(int argc, char **argv)
 {
-	frame_bar = config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
+	config_new->frame_bar =
+	    config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
 }
 
 static void
 config_frame_gap(int argc, char **argv)
 {
-	frame_gap = config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
+	config_new->frame_gap =
+	    config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
 }
 
 static void
 config_frame_count(int argc, char **argv)
 {
-	frame_count = config_strtonum(argv[0], argv[1], 10, 1, INT_MAX);
+	config_new->frame_count =
+	    config_strtonum(argv[0], argv[1], 10, 1, INT_MAX);
 }
 
 static void
 config_frame_width(int argc, char **argv)
 {
-	frame_width = config_strtonum(argv[0], argv[1], 10, 1, USHRT_MAX);
+	config_new->frame_width =
+	    config_strtonum(argv[0], argv[1], 10, 1, USHRT_MAX);
 }
 
 static void
 config_frame_height(int argc, char **argv)
 {
-	frame_height = config_strtonum(argv[0], argv[1], 10, 1, USHRT_MAX);
+	config_new->frame_height =
+	    config_strtonum(argv[0], argv[1], 10, 1, USHRT_MAX);
 }
 
 static void
 config_frame_offset(int argc, char **argv)
 {
-	frame_offset = config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
+	config_new->frame_offset =
+	    config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
 }
 
 static void
 config_frame_border(int argc, char **argv)
 {
-	frame_border = config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
+	config_new->frame_border =
+	    config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
 }
 
 static void
 config_frame_layout(int argc, char **argv)
 {
-	coma_frame_layout(argv[1]);
+	config_string(&config_new->layout, argv[1]);
 }
 
 static void
 config_frame_create(int argc, char **argv)
 {
-	struct frame	*frame;
-	u_int16_t	x, y, w, h;
+	int		i;
+	char		value[32];
 
-	x = config_strtonum(argv[0], argv[1], 10, 0, USHRT_MAX);
-	y = config_strtonum(argv[0], argv[2], 10, 0, USHRT_MAX);
-	w = config_strtonum(argv[0], argv[3], 10, 0, USHRT_MAX);
-	h = config_strtonum(argv[0], argv[4], 10, 0, USHRT_MAX);
+	for (i = 1; i <= 4; i++)
+		(void)config_strtonum(argv[0], argv[i], 10, 0, USHRT_MAX);
 
-	frame = coma_frame_create(w, h, x, y);
-	coma_frame_register(frame);
+	if (config_join(4, argv + 1, value, sizeof(value)) == -1) {
+		config_error(argv[0], "value too long");
+		return;
+	}
+
+	config_entry_add(&config_new->frames, "frame", value);
+}
+
+static void
+config_layout(int argc, char **argv)
+{
+	struct config_entry	*entry;
+	char			err[128], spec[128];
+
+	/* Checking the columns modifies them, keep what was written. */
+	if (config_join(argc - 2, argv + 2, spec, sizeof(spec)) == -1) {
+		config_error(argv[0], "layout too long");
+		return;
+	}
+
+	if (coma_layout_check(argc - 2, argv + 2, err, sizeof(err)) == -1) {
+		config_error(argv[0], "%s", err);
+		return;
+	}
+
+	if ((entry = config_entry_find(&config_new->layouts, argv[1])) != NULL)
+		config_string(&entry->value, spec);
+	else
+		config_entry_add(&config_new->layouts, argv[1], spec);
+}
+
+static void
+config_rule(int argc, char **argv)
+{
+	char		err[128], spec[128];
+
+	if (config_join(argc - 1, argv + 1, spec, sizeof(spec)) == -1) {
+		config_error(argv[0], "rule too long");
+		return;
+	}
+
+	if (coma_rule_check(argc - 1, argv + 1, err, sizeof(err)) == -1) {
+		config_error(argv[0], "%s", err);
+		return;
+	}
+
+	config_entry_add(&config_new->rules, "rule", spec);
+}
+
+static void
+config_workspace(int argc, char **argv)
+{
+	if (config_entry_find(&config_new->workspaces, argv[1]) != NULL) {
+		config_error(argv[0], "workspace '%s' exists", argv[1]);
+		return;
+	}
+
+	config_entry_add(&config_new->workspaces, argv[1], "");
 }
 
 static char *
@@ -369,19 +1175,27 @@ config_strtonum(const char *kw, const char *str, int base,
 	long long	l;
 	char		*ep;
 
-	if (min > max)
-		config_fatal(kw, "min > max");
+	if (min > max) {
+		config_error(kw, "min > max");
+		return (min);
+	}
 
 	errno = 0;
 	l = strtoll(str, &ep, base);
-	if (errno != 0 || str == ep || *ep != '\0')
-		config_fatal(kw, "'%s' is not a valid integer", str);
+	if (errno != 0 || str == ep || *ep != '\0') {
+		config_error(kw, "'%s' is not a valid integer", str);
+		return (min);
+	}
 
-	if (l < min)
-		config_fatal(kw, "'%s' is too low", str);
+	if (l < min) {
+		config_error(kw, "'%s' is too low", str);
+		return (min);
+	}
 
-	if (l > max)
-		config_fatal(kw, "'%s' is too high", str);
+	if (l > max) {
+		config_error(kw, "'%s' is too high", str);
+		return (max);
+	}
 
 	return (l);
 }
@@ -0,0 +1,774 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The control socket lets scripts and external bars drive coma.
+ *
+ * The protocol is line based, every command is answered with zero or
+ * more tab separated data lines followed by either "ok" or "error: msg".
+ * Commands given between "begin" and "commit" are applied together
+ * with a single flush to the X server. Subscribed connections receive
+ * event lines as things happen.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "coma.h"
+
+#define CONTROL_LINE_MAX	1024
+#define CONTROL_OUTPUT_MAX	(1024 * 1024)
+#define CONTROL_ARGV		16
+
+#define CONTROL_CONN_CLOSE	0x0001
+#define CONTROL_CONN_TXN	0x0002
+
+struct control_cmd {
+	char			*line;
+	TAILQ_ENTRY(control_cmd)	list;
+};
+
+struct control_conn {
+	struct coma_io		io;
+	int			flags;
+	int			events;
+
+	size_t			ilen;
+	char			ibuf[CONTROL_LINE_MAX];
+
+	size_t			olen;
+	size_t			osize;
+	u_int8_t		*obuf;
+
+	TAILQ_HEAD(, control_cmd)	queue;
+	TAILQ_ENTRY(control_conn)	list;
+};
+
+static void	control_accept(struct coma_io *, int);
+static void	control_io(struct coma_io *, int);
+static void	control_fd_setup(int);
+static int	control_read(struct control_conn *);
+static int	control_write(struct control_conn *);
+static void	control_close(struct control_conn *);
+static void	control_line(struct control_conn *, char *);
+static void	control_execute(struct control_conn *, char *);
+static void	control_reply(struct control_conn *, const char *, ...);
+static void	control_append(struct control_conn *, const char *, va_list);
+
+static int	control_cmd_run(struct control_conn *, int, char **);
+static int	control_cmd_tag(struct control_conn *, int, char **);
+static int	control_cmd_move(struct control_conn *, int, char **);
+static int	control_cmd_frame(struct control_conn *, int, char **);
+static int	control_cmd_focus(struct control_conn *, int, char **);
+static int	control_cmd_stats(struct control_conn *, int, char **);
+static int	control_cmd_titles(struct control_conn *, int, char **);
+static int	control_cmd_untag(struct control_conn *, int, char **);
+static int	control_cmd_action(struct control_conn *, int, char **);
+static int	control_cmd_clients(struct control_conn *, int, char **);
+static int	control_cmd_subscribe(struct control_conn *, int, char **);
+static int	control_cmd_workspace(struct control_conn *, int, char **);
+
+static struct client	*control_client(struct control_conn *, const char *);
+
+static struct {
+	const char		*name;
+	int			args;
+	int			(*cb)(struct control_conn *, int, char **);
+} commands[] = {
+	{ "run",		1,	control_cmd_run },
+	{ "tag",		2,	control_cmd_tag },
+	{ "move",		2,	control_cmd_move },
+	{ "frame",		1,	control_cmd_frame },
+	{ "focus",		1,	control_cmd_focus },
+	{ "stats",		0,	control_cmd_stats },
+	{ "titles",		0,	control_cmd_titles },
+	{ "untag",		1,	control_cmd_untag },
+	{ "action",		1,	control_cmd_action },
+	{ "clients",		0,	control_cmd_clients },
+	{ "subscribe",		1,	control_cmd_subscribe },
+	{ "workspace",		1,	control_cmd_workspace },
+	{ NULL,			0,	NULL },
+};
+
+static struct {
+	const char	*name;
+	int		mask;
+} subscriptions[] = {
+	{ "focus",	COMA_CONTROL_EVENT_FOCUS },
+	{ "title",	COMA_CONTROL_EVENT_TITLE },
+	{ "client",	COMA_CONTROL_EVENT_CLIENT },
+	{ "all",	COMA_CONTROL_EVENT_FOCUS | COMA_CONTROL_EVENT_TITLE |
+			COMA_CONTROL_EVENT_CLIENT },
+	{ NULL,		0 },
+};
+
+static TAILQ_HEAD(, control_conn)	conns;
+static struct coma_io			listener;
+static struct control_conn		*control_busy = NULL;
+static int				subscribed = 0;
+static char				sockpath[PATH_MAX];
+
+void
+coma_control_init(void)
+{
+	int			len;
+	mode_t			mask;
+	struct sockaddr_un	sun;
+
+	TAILQ_INIT(&conns);
+
+	len = snprintf(sockpath, sizeof(sockpath), "%s/%s",
+	    homedir, COMA_CONTROL_SOCKET);
+	if (len == -1 || (size_t)len >= sizeof(sockpath))
+		fatal("failed to create path to control socket");
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+
+	len = snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", sockpath);
+	if (len == -1 || (size_t)len >= sizeof(sun.sun_path))
+		fatal("control socket path '%s' too long", sockpath);
+
+	if ((listener.fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		fatal("socket: %s", errno_s);
+
+	control_fd_setup(listener.fd);
+
+	(void)unlink(sockpath);
+
+	/* Only ever reachable by us, also between bind() and chmod(). */
+	mask = umask(S_IRWXG | S_IRWXO);
+
+	if (bind(listener.fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+		fatal("bind(%s): %s", sockpath, errno_s);
+
+	(void)umask(mask);
+
+	if (chmod(sockpath, 0600) == -1)
+		fatal("chmod(%s): %s", sockpath, errno_s);
+
+	if (listen(listener.fd, 16) == -1)
+		fatal("listen: %s", errno_s);
+
+	coma_spawn_setenv("COMA_SOCKET", sockpath);
+
+	listener.arg = NULL;
+	listener.events = POLLIN;
+	listener.cb = control_accept;
+
+	coma_wm_io_register(&listener);
+
+	coma_log("control socket at %s", sockpath);
+}
+
+void
+coma_control_cleanup(void)
+{
+	struct control_conn	*conn;
+
+	while ((conn = TAILQ_FIRST(&conns)) != NULL)
+		control_close(conn);
+
+	coma_wm_io_unregister(&listener);
+
+	(void)close(listener.fd);
+	(void)unlink(sockpath);
+}
+
+void
+coma_control_event(int event, const char *fmt, ...)
+{
+	va_list			args;
+	struct control_conn	*conn, *next;
+
+	if (!(subscribed & event))
+		return;
+
+	for (conn = TAILQ_FIRST(&conns); conn != NULL; conn = next) {
+		next = TAILQ_NEXT(conn, list);
+
+		if (!(conn->events & event) ||
+		    (conn->flags & CONTROL_CONN_CLOSE))
+			continue;
+
+		va_start(args, fmt);
+		control_append(conn, fmt, args);
+		va_end(args);
+
+		if (control_write(conn) == -1)
+			conn->flags |= CONTROL_CONN_CLOSE;
+
+		/*
+		 * A subscriber that stopped reading never sees POLLOUT,
+		 * close it now unless control_io() is working on it.
+		 */
+		if ((conn->flags & CONTROL_CONN_CLOSE) && conn != control_busy)
+			control_close(conn);
+	}
+}
+
+static void
+control_accept(struct coma_io *io, int revents)
+{
+	int			fd;
+	struct control_conn	*conn;
+
+	for (;;) {
+		if ((fd = accept(io->fd, NULL, NULL)) == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				coma_log("accept: %s", errno_s);
+			return;
+		}
+
+		control_fd_setup(fd);
+
+		conn = coma_calloc(1, sizeof(*conn));
+		TAILQ_INIT(&conn->queue);
+
+		conn->io.fd = fd;
+		conn->io.arg = conn;
+		conn->io.events = POLLIN;
+		conn->io.cb = control_io;
+
+		TAILQ_INSERT_TAIL(&conns, conn, list);
+		coma_wm_io_register(&conn->io);
+	}
+}
+
+static void
+control_io(struct coma_io *io, int revents)
+{
+	struct control_conn	*conn;
+
+	conn = io->arg;
+	control_busy = conn;
+
+	if (revents & (POLLERR | POLLNVAL))
+		conn->flags |= CONTROL_CONN_CLOSE;
+
+	if (!(conn->flags & CONTROL_CONN_CLOSE) && (revents & POLLOUT)) {
+		if (control_write(conn) == -1)
+			conn->flags |= CONTROL_CONN_CLOSE;
+	}
+
+	if (!(conn->flags & CONTROL_CONN_CLOSE) &&
+	    (revents & (POLLIN | POLLHUP))) {
+		coma_wm_batch_begin();
+		if (control_read(conn) == -1)
+			conn->flags |= CONTROL_CONN_CLOSE;
+		coma_wm_batch_end();
+
+		if (control_write(conn) == -1)
+			conn->flags |= CONTROL_CONN_CLOSE;
+	}
+
+	control_busy = NULL;
+
+	if (conn->flags & CONTROL_CONN_CLOSE)
+		control_close(conn);
+}
+
+static void
+control_fd_setup(int fd)
+{
+	int		flags;
+
+	if ((flags = fcntl(fd, F_GETFL, 0)) == -1)
+		fatal("fcntl: %s", errno_s);
+
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		fatal("fcntl: %s", errno_s);
+
+	coma_fd_cloexec(fd);
+}
+
+static int
+control_read(struct control_conn *conn)
+{
+	ssize_t		ret;
+	char		*line, *nl;
+
+	for (;;) {
+		ret = read(conn->io.fd, conn->ibuf + conn->ilen,
+		    sizeof(conn->ibuf) - conn->ilen);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (0);
+			return (-1);
+		}
+
+		if (ret == 0)
+			return (-1);
+
+		conn->ilen += ret;
+		line = conn->ibuf;
+
+		while ((nl = memchr(line, '\n',
+		    conn->ilen - (line - conn->ibuf))) != NULL) {
+			*nl = '\0';
+			control_line(conn, line);
+			line = nl + 1;
+		}
+
+		conn->ilen -= line - conn->ibuf;
+		memmove(conn->ibuf, line, conn->ilen);
+
+		if (conn->ilen == sizeof(conn->ibuf)) {
+			control_reply(conn, "error: line too long");
+			return (-1);
+		}
+	}
+}
+
+static int
+control_write(struct control_conn *conn)
+{
+	ssize_t		ret;
+
+	while (conn->olen > 0) {
+		ret = write(conn->io.fd, conn->obuf, conn->olen);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return (-1);
+		}
+
+		conn->olen -= ret;
+		memmove(conn->obuf, conn->obuf + ret, conn->olen);
+	}
+
+	if (conn->olen > 0)
+		conn->io.events |= POLLOUT;
+	else
+		conn->io.events &= ~POLLOUT;
+
+	if (conn->olen > CONTROL_OUTPUT_MAX)
+		return (-1);
+
+	return (0);
+}
+
+static void
+control_close(struct control_conn *conn)
+{
+	struct control_cmd	*cmd;
+
+	while ((cmd = TAILQ_FIRST(&conn->queue)) != NULL) {
+		TAILQ_REMOVE(&conn->queue, cmd, list);
+		free(cmd->line);
+		free(cmd);
+	}
+
+	TAILQ_REMOVE(&conns, conn, list);
+	coma_wm_io_unregister(&conn->io);
+
+	(void)close(conn->io.fd);
+
+	subscribed = 0;
+	free(conn->obuf);
+	free(conn);
+
+	TAILQ_FOREACH(conn, &conns, list)
+		subscribed |= conn->events;
+}
+
+static void
+control_line(struct control_conn *conn, char *line)
+{
+	struct control_cmd	*cmd;
+
+	if (*line == '\0')
+		return;
+
+	if (!strcmp(line, "begin")) {
+		if (conn->flags & CONTROL_CONN_TXN) {
+			control_reply(conn, "error: transaction active");
+			return;
+		}
+		conn->flags |= CONTROL_CONN_TXN;
+		control_reply(conn, "ok");
+		return;
+	}
+
+	if (!strcmp(line, "commit") || !strcmp(line, "abort")) {
+		if (!(conn->flags & CONTROL_CONN_TXN)) {
+			control_reply(conn, "error: no transaction");
+			return;
+		}
+
+		coma_wm_batch_begin();
+		while ((cmd = TAILQ_FIRST(&conn->queue)) != NULL) {
+			TAILQ_REMOVE(&conn->queue, cmd, list);
+			if (line[0] == 'c')
+				control_execute(conn, cmd->line);
+			free(cmd->line);
+			free(cmd);
+		}
+		coma_wm_batch_end();
+
+		conn->flags &= ~CONTROL_CONN_TXN;
+		control_reply(conn, "ok");
+		return;
+	}
+
+	if (conn->flags & CONTROL_CONN_TXN) {
+		cmd = coma_calloc(1, sizeof(*cmd));
+		if ((cmd->line = strdup(line)) == NULL)
+			fatal("strdup");
+		TAILQ_INSERT_TAIL(&conn->queue, cmd, list);
+		return;
+	}
+
+	control_execute(conn, line);
+}
+
+static void
+control_execute(struct control_conn *conn, char *line)
+{
+	int		i, argc;
+	char		*argv[CONTROL_ARGV];
+
+	coma_log("control: %s", line);
+
+	if ((argc = coma_split_arguments(line, argv, CONTROL_ARGV)) == 0)
+		return;
+
+	for (i = 0; commands[i].name != NULL; i++) {
+		if (!strcmp(commands[i].name, argv[0]))
+			break;
+	}
+
+	if (commands[i].name == NULL) {
+		control_reply(conn, "error: unknown command '%s'", argv[0]);
+		return;
+	}
+
+	if (argc - 1 < commands[i].args) {
+		control_reply(conn, "error: '%s' requires %d args",
+		    argv[0], commands[i].args);
+		return;
+	}
+
+	if (commands[i].cb(conn, argc, argv) == 0)
+		control_reply(conn, "ok");
+}
+
+static void
+control_reply(struct control_conn *conn, const char *fmt, ...)
+{
+	va_list		args;
+
+	va_start(args, fmt);
+	control_append(conn, fmt, args);
+	va_end(args);
+}
+
+static void
+control_append(struct control_conn *conn, const char *fmt, va_list args)
+{
+	int		len;
+	va_list		copy;
+
+	va_copy(copy, args);
+	len = vsnprintf(NULL, 0, fmt, copy);
+	va_end(copy);
+
+	if (len == -1 || (conn->flags & CONTROL_CONN_CLOSE))
+		return;
+
+	/* A peer that does not keep up is dropped, not buffered for. */
+	if (conn->olen + len + 1 > CONTROL_OUTPUT_MAX) {
+		conn->flags |= CONTROL_CONN_CLOSE;
+		return;
+	}
+
+	/* Room for the formatted line, its newline and vsnprintf's nul. */
+	if (conn->osize - conn->olen < (size_t)len + 2) {
+		conn->osize = conn->olen + len + 2 + CONTROL_LINE_MAX;
+		if ((conn->obuf = realloc(conn->obuf, conn->osize)) == NULL)
+			fatal("realloc: %s", errno_s);
+	}
+
+	(void)vsnprintf((char *)conn->obuf + conn->olen,
+	    conn->osize - conn->olen, fmt, args);
+
+	conn->olen += len;
+	conn->obuf[conn->olen++] = '\n';
+}
+
+static struct client *
+control_client(struct control_conn *conn, const char *str)
+{
+	char		*ep;
+	unsigned long	id;
+	struct client	*client;
+
+	if (!strcmp(str, "active")) {
+		if (client_active == NULL)
+			control_reply(conn, "error: no active client");
+		return (client_active);
+	}
+
+	errno = 0;
+	id = strtoul(str, &ep, 10);
+	if (errno != 0 || str == ep || *ep != '\0' || id > UINT_MAX) {
+		control_reply(conn, "error: invalid client '%s'", str);
+		return (NULL);
+	}
+
+	if ((client = coma_client_lookup(id)) == NULL)
+		control_reply(conn, "error: no such client %lu", id);
+
+	return (client);
+}
+
+static int
+control_cmd_action(struct control_conn *conn, int argc, char **argv)
+{
+	if (coma_wm_action(argv[1]) == -1) {
+		control_reply(conn, "error: unknown action '%s'", argv[1]);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+control_cmd_run(struct control_conn *conn, int argc, char **argv)
+{
+	char		*args[COMA_SHELL_ARGV];
+	int		i;
+
+	for (i = 1; i < argc && i < COMA_SHELL_ARGV; i++)
+		args[i - 1] = argv[i];
+
+	args[i - 1] = NULL;
+	coma_execute(args);
+
+	return (0);
+}
+
+static int
+control_cmd_focus(struct control_conn *conn, int argc, char **argv)
+{
+	struct client	*client;
+
+	if ((client = control_client(conn, argv[1])) == NULL)
+		return (-1);
+
+	coma_client_select(client);
+
+	return (0);
+}
+
+static int
+control_cmd_frame(struct control_conn *conn, int argc, char **argv)
+{
+	char		*ep;
+	unsigned long	id;
+	struct frame	*frame;
+
+	errno = 0;
+	id = strtoul(argv[1], &ep, 10);
+	if (errno != 0 || argv[1] == ep || *ep != '\0' || id > UINT_MAX ||
+	    (frame = coma_frame_lookup(id)) == NULL) {
+		control_reply(conn, "error: no such frame '%s'", argv[1]);
+		return (-1);
+	}
+
+	if (frame == frame_popup) {
+		if (frame_active != frame_popup)
+			coma_frame_popup_show();
+	} else {
+		if (frame_active == frame_popup)
+			coma_frame_popup_hide();
+		coma_frame_focus(frame, 1);
+	}
+
+	return (0);
+}
+
+static int
+control_cmd_workspace(struct control_conn *conn, int argc, char **argv)
+{
+	struct coma_workspace	*ws;
+
+	if ((ws = coma_workspace_find(argv[1])) == NULL) {
+		control_reply(conn, "error: no such workspace '%s'", argv[1]);
+		return (-1);
+	}
+
+	coma_workspace_switch(ws);
+
+	return (0);
+}
+
+static int
+control_cmd_move(struct control_conn *conn, int argc, char **argv)
+{
+	char		*ep;
+	unsigned long	id;
+	struct frame	*frame;
+	struct client	*client;
+
+	if ((client = control_client(conn, argv[1])) == NULL)
+		return (-1);
+
+	errno = 0;
+	id = strtoul(argv[2], &ep, 10);
+	if (errno != 0 || argv[2] == ep || *ep != '\0' || id > UINT_MAX ||
+	    (frame = coma_frame_lookup(id)) == NULL) {
+		control_reply(conn, "error: no such frame '%s'", argv[2]);
+		return (-1);
+	}
+
+	if ((frame == frame_popup || client->frame == frame_popup) &&
+	    frame_active != frame_popup) {
+		control_reply(conn, "error: popup is not active");
+		return (-1);
+	}
+
+	coma_frame_client_move(client, frame);
+
+	return (0);
+}
+
+static int
+control_cmd_tag(struct control_conn *conn, int argc, char **argv)
+{
+	struct client	*client;
+
+	if ((client = control_client(conn, argv[1])) == NULL)
+		return (-1);
+
+	coma_client_tag(client, argv[2]);
+
+	return (0);
+}
+
+static int
+control_cmd_untag(struct control_conn *conn, int argc, char **argv)
+{
+	struct client	*client;
+
+	if ((client = control_client(conn, argv[1])) == NULL)
+		return (-1);
+
+	coma_client_tag(client, NULL);
+
+	return (0);
+}
+
+static int
+control_cmd_clients(struct control_conn *conn, int argc, char **argv)
+{
+	struct client	*client;
+
+	TAILQ_FOREACH(client, &clients, glist) {
+		control_reply(conn, "%u\t0x%08lx\t%u\t%s\t%s\t%s\t%s%s",
+		    client->id, client->window, client->frame->id,
+		    client->host ? client->host : "-",
+		    client->pwd ? client->pwd : "-",
+		    client->cmd ? client->cmd : "-",
+		    client->tag ? client->tag : "-",
+		    client == client_active ? "\tactive" : "");
+	}
+
+	return (0);
+}
+
+static int
+control_cmd_titles(struct control_conn *conn, int argc, char **argv)
+{
+	struct client	*client;
+
+	TAILQ_FOREACH(client, &clients, glist) {
+		control_reply(conn, "%u\t0x%08lx\t%u\t%llu\t%llu\t%s",
+		    client->id, client->window,
+		    coma_client_title_rate(client),
+		    (unsigned long long)client->title_changes,
+		    (unsigned long long)client->title_deferred,
+		    client->title != NULL ? client->title : "-");
+	}
+
+	return (0);
+}
+
+static int
+control_cmd_stats(struct control_conn *conn, int argc, char **argv)
+{
+	FILE		*fp;
+	char		*buf;
+	size_t		len;
+
+	if ((fp = open_memstream(&buf, &len)) == NULL) {
+		control_reply(conn, "error: %s", errno_s);
+		return (-1);
+	}
+
+	coma_stats_dump(fp);
+	(void)fclose(fp);
+
+	if (len > 0 && buf[len - 1] == '\n')
+		buf[len - 1] = '\0';
+
+	control_reply(conn, "%s", buf);
+	free(buf);
+
+	return (0);
+}
+
+static int
+control_cmd_subscribe(struct control_conn *conn, int argc, char **argv)
+{
+	int		i, j;
+
+	for (i = 1; i < argc; i++) {
+		for (j = 0; subscriptions[j].name != NULL; j++) {
+			if (!strcmp(subscriptions[j].name, argv[i]))
+				break;
+		}
+
+		if (subscriptions[j].name == NULL) {
+			control_reply(conn, "error: unknown event '%s'",
+			    argv[i]);
+			return (-1);
+		}
+
+		conn->events |= subscriptions[j].mask;
+	}
+
+	subscribed |= conn->events;
+
+	return (0);
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Publishes the EWMH root window properties so pagers and other tools
+ * can find our clients without walking the window tree.
+ *
+ * New clients are appended to _NET_CLIENT_LIST as they are created,
+ * removals only mark the list dirty and it is rewritten once after
+ * the current batch of events has been handled.
+ */
+
+#include <sys/types.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "coma.h"
+
+static Atom	ewmh_atom(const char *);
+static void	ewmh_cardinal(Window, Atom, long);
+
+static Atom	atom_utf8_string = None;
+static Atom	atom_net_wm_name = None;
+static Atom	atom_net_supported = None;
+static Atom	atom_net_client_list = None;
+static Atom	atom_net_wm_desktop = None;
+static Atom	atom_net_active_window = None;
+static Atom	atom_net_current_desktop = None;
+static Atom	atom_net_number_of_desktops = None;
+static Atom	atom_net_supporting_wm_check = None;
+
+static Window	check = None;
+static Window	active = None;
+static int	dirty = 0;
+
+void
+coma_ewmh_init(void)
+{
+	Window		root;
+	Atom		supported[7];
+
+	root = DefaultRootWindow(dpy);
+
+	atom_utf8_string = ewmh_atom("UTF8_STRING");
+	atom_net_wm_name = ewmh_atom("_NET_WM_NAME");
+	atom_net_supported = ewmh_atom("_NET_SUPPORTED");
+	atom_net_client_list = ewmh_atom("_NET_CLIENT_LIST");
+	atom_net_wm_desktop = ewmh_atom("_NET_WM_DESKTOP");
+	atom_net_active_window = ewmh_atom("_NET_ACTIVE_WINDOW");
+	atom_net_current_desktop = ewmh_atom("_NET_CURRENT_DESKTOP");
+	atom_net_number_of_desktops = ewmh_atom("_NET_NUMBER_OF_DESKTOPS");
+	atom_net_supporting_wm_check = ewmh_atom("_NET_SUPPORTING_WM_CHECK");
+
+	supported[0] = atom_net_wm_name;
+	supported[1] = atom_net_client_list;
+	supported[2] = atom_net_wm_desktop;
+	supported[3] = atom_net_active_window;
+	supported[4] = atom_net_current_desktop;
+	supported[5] = atom_net_number_of_desktops;
+	supported[6] = atom_net_supporting_wm_check;
+
+	check = XCreateSimpleWindow(dpy, root, -1, -1, 1, 1, 0, 0, 0);
+
+	XChangeProperty(dpy, check, atom_net_supporting_wm_check, XA_WINDOW,
+	    32, PropModeReplace, (unsigned char *)&check, 1);
+	XChangeProperty(dpy, check, atom_net_wm_name, atom_utf8_string,
+	    8, PropModeReplace, (unsigned char *)"coma", 4);
+	XChangeProperty(dpy, root, atom_net_supporting_wm_check, XA_WINDOW,
+	    32, PropModeReplace, (unsigned char *)&check, 1);
+
+	XChangeProperty(dpy, root, atom_net_supported, XA_ATOM, 32,
+	    PropModeReplace, (unsigned char *)supported, 7);
+
+	coma_ewmh_desktops();
+
+	/* Clients are appended again as they are discovered. */
+	XChangeProperty(dpy, root, atom_net_client_list, XA_WINDOW, 32,
+	    PropModeReplace, NULL, 0);
+	XChangeProperty(dpy, root, atom_net_active_window, XA_WINDOW, 32,
+	    PropModeReplace, (unsigned char *)&active, 1);
+}
+
+void
+coma_ewmh_cleanup(void)
+{
+	Window		root;
+
+	root = DefaultRootWindow(dpy);
+
+	XDeleteProperty(dpy, root, atom_net_supported);
+	XDeleteProperty(dpy, root, atom_net_client_list);
+	XDeleteProperty(dpy, root, atom_net_active_window);
+	XDeleteProperty(dpy, root, atom_net_supporting_wm_check);
+
+	XDestroyWindow(dpy, check);
+}
+
+void
+coma_ewmh_client_add(struct client *client)
+{
+	XChangeProperty(dpy, DefaultRootWindow(dpy), atom_net_client_list,
+	    XA_WINDOW, 32, PropModeAppend,
+	    (unsigned char *)&client->window, 1);
+}
+
+void
+coma_ewmh_client_remove(struct client *client)
+{
+	dirty = 1;
+
+	if (active == client->window)
+		coma_ewmh_active(NULL);
+}
+
+/* Workspaces are the desktops, in the order they were defined. */
+void
+coma_ewmh_desktops(void)
+{
+	Window		root;
+	long		count;
+
+	root = DefaultRootWindow(dpy);
+
+	for (count = 0; coma_workspace_nth(count) != NULL; count++)
+		;
+
+	ewmh_cardinal(root, atom_net_number_of_desktops, count);
+	ewmh_cardinal(root, atom_net_current_desktop,
+	    coma_workspace_index(workspace_active));
+}
+
+/* Called whenever the client is put in a frame, of any workspace. */
+void
+coma_ewmh_client_desktop(struct client *client)
+{
+	ewmh_cardinal(client->window, atom_net_wm_desktop,
+	    coma_workspace_index(client->frame->workspace));
+}
+
+void
+coma_ewmh_active(struct client *client)
+{
+	Window		window;
+
+	window = client != NULL ? client->window : None;
+
+	if (window == active)
+		return;
+
+	active = window;
+	XChangeProperty(dpy, DefaultRootWindow(dpy), atom_net_active_window,
+	    XA_WINDOW, 32, PropModeReplace, (unsigned char *)&active, 1);
+}
+
+void
+coma_ewmh_flush(void)
+{
+	size_t		idx;
+	Window		*list;
+	struct client	*client;
+
+	if (dirty == 0)
+		return;
+
+	idx = 0;
+	TAILQ_FOREACH(client, &clients, glist)
+		idx++;
+
+	list = coma_calloc(idx + 1, sizeof(*list));
+
+	idx = 0;
+	TAILQ_FOREACH(client, &clients, glist)
+		list[idx++] = client->window;
+
+	XChangeProperty(dpy, DefaultRootWindow(dpy), atom_net_client_list,
+	    XA_WINDOW, 32, PropModeReplace, (unsigned char *)list, idx);
+	XFlush(dpy);
+
+	free(list);
+	dirty = 0;
+}
+
+static Atom
+ewmh_atom(const char *name)
+{
+	Atom	prop;
+
+	if ((prop = XInternAtom(dpy, name, False)) == None)
+		fatal("failed to query Atom '%s'", name);
+
+	return (prop);
+}
+
+static void
+ewmh_cardinal(Window win, Atom prop, long value)
+{
+	XChangeProperty(dpy, win, prop, XA_CARDINAL, 32,
+	    PropModeReplace, (unsigned char *)&value, 1);
+}
@@ -14,6 +14,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/param.h>
 #include <sys/types.h>
 
 #include <stdlib.h>
@@ -27,97 +28,387 @@
 
 #include "coma.h"
 
-#define CLIENT_MOVE_LEFT		1
-#define CLIENT_MOVE_RIGHT		2
-
-#define LARGE_SINGLE_WINDOW		0
-#define LARGE_DUAL_WINDOWS		1
-
-static void	frame_layout_default(void);
-static void	frame_layout_small_large(int);
+#define FRAME_OUTPUT_SEEN	0x0001
+#define FRAME_OUTPUT_CHANGED	0x0002
+
+struct coma_output {
+	char			*name;
+	int			flags;
+	u_int16_t		x;
+	u_int16_t		y;
+	u_int16_t		w;
+	u_int16_t		h;
+	struct coma_layout_geom	geom;
+	TAILQ_ENTRY(coma_output)	list;
+};
+
+static void	frame_layout_env(struct coma_output *);
+static int	frame_output_eval(struct coma_layout *,
+		    struct coma_output *, int);
+static void	frame_output_build(struct coma_output *);
+static void	frame_output_replace(struct coma_output *,
+		    struct coma_output *);
+static void	frame_outputs_relayout(void);
+static void	frame_outputs_apply(void);
+static void	frame_outputs_apply_hidden(void);
+static void	frame_release(void);
+static void	frame_popup_place(void);
 static void	frame_bar_sort(struct frame *);
 static void	frame_bar_create(struct frame *);
 
+static void		frame_move(int);
+static void		frame_split(int);
+static void		frame_resize(int);
+static void		frame_apply(struct frame *);
+static void		frame_relayout(struct frame *);
+static int		frame_rect(struct frame *, u_int16_t, u_int16_t,
+			    u_int16_t, u_int16_t);
+static struct frame	*frame_leaf(struct frame *, int);
+static struct frame	*frame_output_first(struct coma_output *);
+static struct coma_output	*frame_output_at(u_int16_t, u_int16_t);
+static struct frame	*frame_output_next(struct frame *);
+static struct coma_layout	*frame_layout_current(void);
 static void		frame_client_move(int);
-static struct frame	*frame_find_left(void);
-static struct frame	*frame_find_right(void);
+static void		frame_adjacency(void);
+static void		frame_adjacency_group(struct frame **, size_t);
+static int		frame_neighbor(struct frame *, struct frame *, int,
+			    int *, int *);
 
 static struct frame_list	frames;
+static struct frame_list	splits;
 static u_int32_t		frame_id = 1;
-static u_int16_t		zoom_width = 0;
 static struct frame		*popup_restore = NULL;
+static char			*layout_name = NULL;
+static int			layout_env_set = 0;
+static struct coma_layout_env	layout_env;
+static TAILQ_HEAD(, coma_output)	outputs;
+static struct coma_workspace	*frame_workspace = NULL;
 
 int				frame_count = -1;
 int				frame_offset = -1;
 u_int16_t			frame_height = 0;
-u_int16_t			frame_y_offset = 0;
 struct frame			*frame_popup = NULL;
 struct frame			*frame_active = NULL;
 u_int16_t			frame_gap = COMA_FRAME_GAP;
 u_int16_t			frame_bar = COMA_FRAME_BAR;
 u_int16_t			frame_width = COMA_FRAME_WIDTH;
 u_int16_t			frame_border = COMA_FRAME_BORDER;
-int				frame_layout = COMA_FRAME_LAYOUT_DEFAULT;
 
 void
 coma_frame_init(void)
 {
 	TAILQ_INIT(&frames);
+	TAILQ_INIT(&splits);
+	TAILQ_INIT(&outputs);
 }
 
 void
 coma_frame_setup(void)
 {
-	switch (frame_layout) {
-	case COMA_FRAME_LAYOUT_DEFAULT:
-		frame_layout_default();
-		break;
-	case COMA_FRAME_LAYOUT_SMALL_LARGE:
-		frame_layout_small_large(LARGE_SINGLE_WINDOW);
-		break;
-	case COMA_FRAME_LAYOUT_SMALL_DUAL:
-		frame_layout_small_large(LARGE_DUAL_WINDOWS);
-		break;
-	default:
-		fatal("unknown frame layout %d", frame_layout);
+	struct frame		*frame;
+	struct coma_layout	*layout;
+	struct coma_output	*output;
+
+	if (TAILQ_EMPTY(&outputs))
+		fatal("no outputs to put frames on");
+
+	/* Frames from frame-create belong to the output they are on. */
+	TAILQ_FOREACH(frame, &frames, list) {
+		if (frame->output == NULL)
+			frame->output = frame_output_at(frame->x, frame->y);
+		frame->workspace = frame_workspace;
+		frame->slot = ++frame_workspace->configured;
+	}
+
+	layout = frame_layout_current();
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		(void)frame_output_eval(layout, output, 1);
+		frame_output_build(output);
+		output->flags &= ~FRAME_OUTPUT_CHANGED;
 	}
 
+	frame_popup_place();
+
 	frame_popup->id = UINT_MAX;
+	frame_popup->slot = UINT_MAX;
 	frame_active = TAILQ_FIRST(&frames);
 
+	frame_adjacency();
+
 	coma_log("frame active is %u", frame_active->id);
 }
 
+/* Layouts may be defined after this, it is looked up at setup. */
 void
 coma_frame_layout(const char *mode)
 {
-	if (!strcmp(mode, "default")) {
-		frame_layout = COMA_FRAME_LAYOUT_DEFAULT;
-	} else if (!strcmp(mode, "small-large")) {
-		frame_layout = COMA_FRAME_LAYOUT_SMALL_LARGE;
-	} else if (!strcmp(mode, "small-dual")) {
-		frame_layout = COMA_FRAME_LAYOUT_SMALL_DUAL;
-	} else {
-		fatal("unknown frame-layout '%s'", mode);
+	free(layout_name);
+
+	if ((layout_name = strdup(mode)) == NULL)
+		fatal("strdup");
+}
+
+/*
+ * The frame settings or layouts changed, build the frames of every
+ * output again with what is configured now.
+ */
+void
+coma_frame_reconfigure(void)
+{
+	struct client		*client;
+	struct coma_output	*output;
+
+	/* Before coma_frame_setup() there is nothing to update. */
+	if (frame_popup == NULL)
+		return;
+
+	if (layout_name != NULL && coma_layout_lookup(layout_name) == NULL) {
+		coma_log("layout '%s' is gone, using '%s'", layout_name,
+		    COMA_FRAME_LAYOUT_DEFAULT);
+		free(layout_name);
+		layout_name = NULL;
+	}
+
+	layout_env_set = 0;
+
+	TAILQ_FOREACH(client, &clients, glist) {
+		client->bw = frame_border;
+		XSetWindowBorderWidth(dpy, client->window, client->bw);
+	}
+
+	TAILQ_FOREACH(output, &outputs, list)
+		output->flags |= FRAME_OUTPUT_CHANGED;
+
+	/* The popup keeps its spot, but its bar may be different. */
+	frame_popup->rw = 0;
+
+	frame_outputs_relayout();
+}
+
+/*
+ * Move to another layout without a restart, all clients are kept and
+ * spread over the new frames in the order their frames had. Nothing
+ * changes unless the layout fits every output.
+ */
+int
+coma_frame_layout_switch(const char *name)
+{
+	struct coma_layout		*layout;
+	struct coma_output		*output;
+
+	if ((layout = coma_layout_lookup(name)) == NULL) {
+		coma_log("unknown layout '%s'", name);
+		return (-1);
 	}
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		if (frame_output_eval(layout, output, 0) == -1) {
+			coma_log("layout '%s' does not fit %s",
+			    name, output->name);
+			return (-1);
+		}
+		output->flags |= FRAME_OUTPUT_CHANGED;
+	}
+
+	coma_frame_layout(name);
+	frame_outputs_relayout();
+
+	coma_log("switched to layout '%s'", name);
+
+	return (0);
 }
 
 void
 coma_frame_cleanup(void)
 {
-	struct frame	*frame, *next;
+	struct coma_output	*output;
 
-	for (frame = TAILQ_FIRST(&frames); frame != NULL; frame = next) {
-		next = TAILQ_NEXT(frame, list);
-		TAILQ_REMOVE(&frames, frame, list);
-		XDestroyWindow(dpy, frame->bar);
-		XftDrawDestroy(frame->xft_draw);
-		free(frame);
+	coma_workspace_hidden(frame_release);
+	frame_release();
+
+	while ((output = TAILQ_FIRST(&outputs)) != NULL) {
+		TAILQ_REMOVE(&outputs, output, list);
+		free(output->name);
+		free(output);
 	}
 
-	XDestroyWindow(dpy, frame_popup->bar);
-	XftDrawDestroy(frame_popup->xft_draw);
-	free(frame_popup);
+	free(layout_name);
+	layout_name = NULL;
+}
+
+/* Park the clients and bars of the active workspace. */
+void
+coma_frame_workspace_hide(void)
+{
+	struct frame	*frame;
+	struct client	*client;
+
+	if (frame_active->flags & COMA_FRAME_ZOOMED)
+		coma_frame_zoom();
+
+	TAILQ_FOREACH(frame, &frames, list) {
+		TAILQ_FOREACH(client, &frame->clients, list)
+			coma_client_hide(client);
+		XUnmapWindow(dpy, frame->bar);
+	}
+
+	TAILQ_FOREACH(client, &frame_popup->clients, list)
+		coma_client_hide(client);
+
+	XUnmapWindow(dpy, frame_popup->bar);
+}
+
+/*
+ * Bring back the workspace that was just loaded. Only the client on
+ * top in each frame is mapped, the others follow when focused.
+ */
+void
+coma_frame_workspace_show(void)
+{
+	struct frame	*frame;
+	struct client	*client;
+
+	TAILQ_FOREACH(frame, &frames, list) {
+		if (frame->bar == None)
+			frame_bar_create(frame);
+		else
+			XMapWindow(dpy, frame->bar);
+
+		if ((client = frame->focus) == NULL)
+			client = TAILQ_FIRST(&frame->clients);
+		if (client != NULL)
+			coma_client_show(client);
+	}
+
+	if (frame_popup->bar == None)
+		frame_bar_create(frame_popup);
+
+	if (frame_active == frame_popup) {
+		XMapRaised(dpy, frame_popup->bar);
+		if (frame_popup->focus != NULL)
+			coma_client_show(frame_popup->focus);
+	} else {
+		XUnmapWindow(dpy, frame_popup->bar);
+	}
+
+	/* Whatever had the focus is on another workspace now. */
+	client_active = NULL;
+	coma_frame_focus(frame_active, 1);
+	coma_frame_bars_update();
+}
+
+void
+coma_frame_state_save(struct coma_workspace *ws)
+{
+	TAILQ_INIT(&ws->frames);
+	TAILQ_CONCAT(&ws->frames, &frames, list);
+
+	TAILQ_INIT(&ws->splits);
+	TAILQ_CONCAT(&ws->splits, &splits, list);
+
+	ws->popup = frame_popup;
+	ws->active = frame_active;
+	ws->restore = popup_restore;
+}
+
+void
+coma_frame_state_load(struct coma_workspace *ws)
+{
+	TAILQ_INIT(&frames);
+	TAILQ_CONCAT(&frames, &ws->frames, list);
+
+	TAILQ_INIT(&splits);
+	TAILQ_CONCAT(&splits, &ws->splits, list);
+
+	frame_popup = ws->popup;
+	frame_active = ws->active;
+	popup_restore = ws->restore;
+	frame_workspace = ws;
+}
+
+/* Called before the outputs are (re)announced with coma_frame_output. */
+void
+coma_frame_outputs_begin(void)
+{
+	struct coma_output	*output;
+
+	TAILQ_FOREACH(output, &outputs, list)
+		output->flags &= ~FRAME_OUTPUT_SEEN;
+}
+
+/*
+ * An output with its area on the root window. Outputs are kept in the
+ * order they are announced in, the first one holds the popup frame.
+ * An output showing the same area as one announced before it is a
+ * mirror on a crtc of its own and shares the frames of that one.
+ */
+void
+coma_frame_output(const char *name, u_int16_t x, u_int16_t y,
+    u_int16_t w, u_int16_t h)
+{
+	struct coma_output	*output;
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		if (!(output->flags & FRAME_OUTPUT_SEEN) ||
+		    !strcmp(output->name, name))
+			continue;
+		if (output->x == x && output->y == y &&
+		    output->w == w && output->h == h)
+			return;
+	}
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		if (!strcmp(output->name, name))
+			break;
+	}
+
+	if (output == NULL) {
+		output = coma_calloc(1, sizeof(*output));
+		if ((output->name = strdup(name)) == NULL)
+			fatal("strdup");
+		output->flags = FRAME_OUTPUT_CHANGED;
+	} else {
+		TAILQ_REMOVE(&outputs, output, list);
+	}
+
+	TAILQ_INSERT_TAIL(&outputs, output, list);
+
+	if (output->x != x || output->y != y ||
+	    output->w != w || output->h != h) {
+		coma_log("output %s at %ux%u+%u+%u", name, w, h, x, y);
+		output->flags |= FRAME_OUTPUT_CHANGED;
+	}
+
+	output->x = x;
+	output->y = y;
+	output->w = w;
+	output->h = h;
+	output->flags |= FRAME_OUTPUT_SEEN;
+}
+
+/*
+ * Rebuild the frames of outputs that are new or changed size and move
+ * the clients of outputs that went away. Frames on outputs that were
+ * left alone are not touched.
+ */
+void
+coma_frame_outputs_end(void)
+{
+	struct coma_output	*output;
+
+	/* Before coma_frame_setup() there is nothing to update. */
+	if (frame_popup == NULL)
+		return;
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		if (!(output->flags & FRAME_OUTPUT_SEEN) ||
+		    (output->flags & FRAME_OUTPUT_CHANGED))
+			break;
+	}
+
+	if (output != NULL)
+		frame_outputs_relayout();
 }
 
 void
@@ -137,18 +428,9 @@ coma_frame_popup_hide(void)
 	TAILQ_FOREACH(client, &frame_popup->clients, list)
 		coma_client_hide(client);
 
-	if (frame_popup->split != NULL) {
-		TAILQ_FOREACH(client,
-		    &frame_popup->split->clients, list) {
-			coma_client_hide(client);
-		}
-	}
-
 	coma_frame_select_any();
 
 	XUnmapWindow(dpy, frame_popup->bar);
-	if (frame_popup->split != NULL)
-		XUnmapWindow(dpy, frame_popup->split->bar);
 
 	if (popup_restore != NULL) {
 		coma_frame_focus(popup_restore, 1);
@@ -172,21 +454,9 @@ coma_frame_popup_show(void)
 	TAILQ_FOREACH(client, &frame_popup->clients, list)
 		coma_client_unhide(client);
 
-	if (frame_popup->split != NULL) {
-		TAILQ_FOREACH(client,
-		    &frame_popup->split->clients, list) {
-			coma_client_unhide(client);
-		}
-	}
-
 	XMapRaised(dpy, frame_popup->bar);
 	coma_frame_bar_update(frame_popup);
 
-	if (frame_popup->split != NULL) {
-		XMapRaised(dpy, frame_popup->split->bar);
-		coma_frame_bar_update(frame_popup->split);
-	}
-
 	if (focus != NULL)
 		coma_client_focus(focus);
 }
@@ -194,27 +464,25 @@ coma_frame_popup_show(void)
 void
 coma_frame_next(void)
 {
-	struct frame	*next;
-
-	if (!(frame_active->flags & COMA_FRAME_INLIST) ||
-	    frame_active->flags & COMA_FRAME_ZOOMED)
-		return;
-
-	if ((next = frame_find_right()) != NULL)
-		coma_frame_focus(next, 1);
+	frame_move(COMA_FRAME_RIGHT);
 }
 
 void
 coma_frame_prev(void)
 {
-	struct frame	*prev;
+	frame_move(COMA_FRAME_LEFT);
+}
 
-	if (!(frame_active->flags & COMA_FRAME_INLIST) ||
-	    frame_active->flags & COMA_FRAME_ZOOMED)
-		return;
+void
+coma_frame_up(void)
+{
+	frame_move(COMA_FRAME_UP);
+}
 
-	if ((prev = frame_find_left()) != NULL)
-		coma_frame_focus(prev, 1);
+void
+coma_frame_down(void)
+{
+	frame_move(COMA_FRAME_DOWN);
 }
 
 void
@@ -257,76 +525,85 @@ coma_frame_client_prev(void)
 void
 coma_frame_client_move_left(void)
 {
-	frame_client_move(CLIENT_MOVE_LEFT);
+	frame_client_move(COMA_FRAME_LEFT);
 }
 
 void
 coma_frame_client_move_right(void)
 {
-	frame_client_move(CLIENT_MOVE_RIGHT);
+	frame_client_move(COMA_FRAME_RIGHT);
 }
 
 void
-coma_frame_split(void)
+coma_frame_client_move(struct client *client, struct frame *other)
 {
-	struct frame	*frame;
-	struct client	*client;
-	u_int16_t	height, used, y;
+	struct frame	*prev;
 
-	if (frame_active == frame_popup)
-		return;
+	prev = client->frame;
 
-	if (frame_active->split != NULL)
+	if (prev == other)
 		return;
 
-	height = frame_border + frame_active->h + frame_border + frame_bar;
-	used = (frame_border * 4) + (frame_bar * 2) + frame_gap;
-	height = (height - used) / 2;
-
-	y = frame_active->y + frame_border + height + frame_border +
-	    frame_bar + frame_gap;
-
-	frame = coma_frame_create(frame_active->w, height, frame_active->x, y);
-
-	if (frame_active->flags & COMA_FRAME_INLIST)
-		TAILQ_INSERT_TAIL(&frames, frame, list);
-
-	frame->split = frame_active;
-	frame->flags = frame_active->flags;
+	if (prev->focus == client) {
+		if ((prev->focus = TAILQ_NEXT(client, list)) == NULL)
+			prev->focus = TAILQ_FIRST(&prev->clients);
+		if (prev->focus == client)
+			prev->focus = NULL;
+	}
 
-	frame_active->split = frame;
-	frame_active->h = height;
+	TAILQ_REMOVE(&prev->clients, client, list);
+	TAILQ_INSERT_HEAD(&other->clients, client, list);
 
-	frame_active->orig_h = frame_active->h;
+	client->frame = other;
+	client->x = other->x;
 
-	frame_bar_create(frame_active);
-	frame_bar_create(frame);
+	coma_client_adjust(client);
 
-	TAILQ_FOREACH(client, &frame_active->clients, list)
-		coma_client_adjust(client);
+	frame_active = other;
+	coma_client_focus(client);
+	coma_client_warp_pointer(client);
 
-	coma_frame_bar_update(frame);
+	coma_frame_bar_update(prev);
 	coma_frame_bar_update(frame_active);
+}
 
-	frame_active = frame;
-	coma_spawn_terminal();
+void
+coma_frame_split(void)
+{
+	frame_split(COMA_FRAME_SPLIT_HORIZONTAL);
+}
+
+void
+coma_frame_vsplit(void)
+{
+	frame_split(COMA_FRAME_SPLIT_VERTICAL);
 }
 
+/*
+ * Merge the active frame with the other side of its split. Of two
+ * frames the top or left one stays, otherwise the active frame goes
+ * and its clients end up in the closest frame on the other side.
+ */
 void
 coma_frame_merge(void)
 {
-	struct frame	*survives, *dies;
+	int		idx;
+	struct frame	*node, *keep, *dies, *survives;
 	struct client	*client, *focus, *next;
 
-	if (frame_active->split == NULL)
+	if ((node = frame_active->parent) == NULL)
 		return;
 
-	if (frame_active->y < frame_active->split->y) {
-		survives = frame_active;
-		dies = frame_active->split;
+	idx = node->child[0] == frame_active ? 0 : 1;
+	keep = node->child[!idx];
+
+	if (keep->split == COMA_FRAME_SPLIT_NONE) {
+		survives = node->child[0];
+		dies = node->child[1];
+		keep = survives;
 	} else {
 		dies = frame_active;
-		survives = frame_active->split;
+		survives = frame_leaf(keep, idx);
 	}
 
 	focus = dies->focus;
@@ -347,12 +624,23 @@ coma_frame_merge(void)
 	XftDrawDestroy(dies->xft_draw);
 	free(dies);
 
-	survives->split = NULL;
-	survives->h = frame_height;
-	survives->orig_h = survives->h;
+	/* What is left takes the place of the split. */
+	keep->parent = node->parent;
+	if (node->parent != NULL) {
+		idx = node->parent->child[0] == node ? 0 : 1;
+		node->parent->child[idx] = keep;
+	}
+
+	TAILQ_REMOVE(&splits, node, list);
+	frame_rect(keep, node->rx, node->ry, node->rw, node->rh);
+	free(node);
+
+	frame_relayout(keep);
+	frame_adjacency();
 
 	frame_active = survives;
 
+	/* These moved, they need to hear about it even if nothing else did. */
 	TAILQ_FOREACH(client, &frame_active->clients, list)
 		coma_client_adjust(client);
 
@@ -361,17 +649,32 @@ coma_frame_merge(void)
 		coma_client_warp_pointer(focus);
 	}
 
-	frame_bar_create(frame_active);
 	coma_frame_bar_update(frame_active);
 }
 
 void
 coma_frame_split_next(void)
 {
-	if (frame_active->split == NULL)
+	int		idx;
+	struct frame	*node;
+
+	if ((node = frame_active->parent) == NULL)
 		return;
 
-	coma_frame_focus(frame_active->split, 1);
+	idx = node->child[0] == frame_active ? 0 : 1;
+	coma_frame_focus(frame_leaf(node->child[!idx], idx), 1);
+}
+
+void
+coma_frame_grow(void)
+{
+	frame_resize(COMA_FRAME_RESIZE_STEP);
+}
+
+void
+coma_frame_shrink(void)
+{
+	frame_resize(-COMA_FRAME_RESIZE_STEP);
 }
 
 void
@@ -467,6 +770,7 @@ void
 coma_frame_zoom(void)
 {
 	struct client		*client;
+	struct coma_output	*output;
 
 	if (frame_active->focus == NULL)
 		return;
@@ -481,10 +785,11 @@ coma_frame_zoom(void)
 		frame_active->y = frame_active->orig_y;
 		frame_active->flags &= ~COMA_FRAME_ZOOMED;
 	} else {
-		frame_active->w = zoom_width;
-		frame_active->h = frame_height;
-		frame_active->x = frame_offset;
-		frame_active->y = frame_y_offset;
+		output = frame_active->output;
+		frame_active->w = output->geom.zoom_width;
+		frame_active->h = output->geom.height;
+		frame_active->x = output->x + output->geom.offset;
+		frame_active->y = output->y + output->geom.y_offset;
 		frame_active->flags |= COMA_FRAME_ZOOMED;
 	}
 
@@ -549,8 +854,8 @@ coma_frame_bar_update(struct frame *frame)
 	XftColor		*bar_active, *bar_inactive;
 	XftColor		*active, *inactive, *color, *dir;
 
-	/* Can be called before bars are setup. */
-	if (frame->bar == None)
+	/* Can be called before bars are setup or for a parked workspace. */
+	if (frame->bar == None || frame->workspace != frame_workspace)
 		return;
 
 	pos = 1;
@@ -682,130 +987,50 @@ coma_frame_bar_click(Window bar, u_int16_t offset)
 	}
 }
 
-void
-coma_frame_update_titles(void)
+struct frame *
+coma_frame_lookup(u_int32_t id)
 {
 	struct frame	*frame;
-	struct client	*client;
+
+	if (frame_popup->id == id)
+		return (frame_popup);
 
 	TAILQ_FOREACH(frame, &frames, list) {
-		TAILQ_FOREACH(client, &frame->clients, list)
-			coma_client_update_title(client);
-		coma_frame_bar_update(frame);
+		if (frame->id == id)
+			return (frame);
 	}
 
-	TAILQ_FOREACH(client, &frame_popup->clients, list)
-		coma_client_update_title(client);
-
-	coma_frame_bar_update(frame_popup);
-
-	if (frame_popup->split != NULL) {
-		TAILQ_FOREACH(client, &frame_popup->split->clients, list)
-			coma_client_update_title(client);
-		coma_frame_bar_update(frame_popup->split);
-	}
+	return (NULL);
 }
 
-static void
-frame_layout_default(void)
+/* The first frame in the given slot, see struct frame. */
+struct frame *
+coma_frame_slot(u_int32_t slot)
 {
 	struct frame	*frame;
-	u_int16_t	i, count, width, offset, x;
 
-	count = 0;
-
-	if (frame_offset != -1)
-		width = screen_width - frame_offset;
-	else
-		width = screen_width;
-
-	if (frame_height == 0) {
-		frame_y_offset = frame_gap;
-		frame_height = screen_height - (frame_gap * 2) - frame_bar -
-		    (frame_border * 2);
-	} else {
-		frame_y_offset = (screen_height -
-		    (frame_bar + frame_height + (frame_border * 2))) / 2;
-	}
+	if (frame_popup->slot == slot)
+		return (frame_popup);
 
-	while (width > frame_width) {
-		if (frame_count != -1 && count == frame_count)
-			break;
-		count++;
-		width -= frame_width;
+	TAILQ_FOREACH(frame, &frames, list) {
+		if (frame->slot == slot)
+			return (frame);
 	}
 
-	if (frame_offset != -1) {
-		offset = frame_offset;
-	} else {
-		offset = width / 2;
-	}
+	return (NULL);
+}
 
-	if (offset > (frame_gap * count))
-		offset -= frame_gap;
+void
+coma_frame_focus(struct frame *frame, int warp)
+{
+	struct frame		*prev;
+	struct client		*client;
 
-	x = offset;
-	zoom_width = 0;
+	prev = frame_active;
+	frame_active = frame;
 
-	for (i = 0; i < count; i++) {
-		frame = coma_frame_create(frame_width,
-		    frame_height, offset, frame_y_offset);
-		coma_frame_register(frame);
-		offset += frame_width + frame_gap + (frame_border * 2);
-		zoom_width += frame_width + frame_gap + (frame_border * 2);
-	}
-
-	if (frame_offset != -1) {
-		width = screen_width / 2;
-		if (frame_offset < width) {
-			i = frame_offset;
-			width = screen_width;
-			offset = frame_offset - (i / 2);
-			width -= i;
-		} else {
-			i = frame_offset - width;
-			offset = width + (i / 2);
-			width -= i * 2;
-		}
-	} else {
-		offset = frame_gap;
-		width = screen_width - (frame_gap * 2) - (frame_border * 2);
-	}
-
-	frame_offset = x;
-	zoom_width -= frame_gap + (frame_border * 2);
-
-	frame_popup = coma_frame_create(zoom_width,
-	    frame_height, x, frame_y_offset);
-}
-
-struct frame *
-coma_frame_lookup(u_int32_t id)
-{
-	struct frame	*frame;
-
-	if (frame_popup->id == id)
-		return (frame_popup);
-
-	TAILQ_FOREACH(frame, &frames, list) {
-		if (frame->id == id)
-			return (frame);
-	}
-
-	return (NULL);
-}
-
-void
-coma_frame_focus(struct frame *frame, int warp)
-{
-	struct frame		*prev;
-	struct client		*client;
-
-	prev = frame_active;
-	frame_active = frame;
-
-	if ((client = frame->focus) == NULL)
-		client = TAILQ_FIRST(&frame->clients);
+	if ((client = frame->focus) == NULL)
+		client = TAILQ_FIRST(&frame->clients);
 
 	if (client != NULL) {
 		coma_client_focus(client);
@@ -826,6 +1051,7 @@ coma_frame_create(u_int16_t width, u_int16_t height, u_int16_t x, u_int16_t y)
 
 	frame->bar = None;
 	frame->id = frame_id++;
+	frame->workspace = frame_workspace;
 
 	frame->x = x;
 	frame->y = y;
@@ -837,6 +1063,11 @@ coma_frame_create(u_int16_t width, u_int16_t height, u_int16_t x, u_int16_t y)
 	frame->orig_w = width;
 	frame->orig_h = height;
 
+	frame->rx = x;
+	frame->ry = y;
+	frame->rw = width + (frame_border * 2);
+	frame->rh = height + (frame_border * 2) + frame_bar;
+
 	frame->screen = DefaultScreen(dpy);
 	frame->visual = DefaultVisual(dpy, frame->screen);
 	frame->colormap = DefaultColormap(dpy, frame->screen);
@@ -846,61 +1077,25 @@ coma_frame_create(u_int16_t width, u_int16_t height, u_int16_t x, u_int16_t y)
 	return (frame);
 }
 
-void
-coma_frame_register(struct frame *frame)
-{
-	frame->flags = COMA_FRAME_INLIST;
-	TAILQ_INSERT_TAIL(&frames, frame, list);
-}
-
-static void
-frame_layout_small_large(int dual)
+/* The nth frame (from 1) in the order frame-next walks them. */
+struct frame *
+coma_frame_nth(int n)
 {
 	struct frame	*frame;
-	u_int16_t	offset, width;
-
-	zoom_width = 0;
-
-	if (frame_offset == -1) {
-		offset = frame_gap;
-		frame_offset = offset;
-	} else {
-		offset = frame_offset;
-	}
-
-	frame_y_offset = frame_gap;
-	frame_height = screen_height - (frame_gap * 2) - frame_bar -
-	    (frame_border * 2);
-
-	/* Small frame on the left hand-side. */
-	frame = coma_frame_create(frame_width, frame_height,
-	    offset, frame_y_offset);
-	coma_frame_register(frame);
-	offset += frame_width + frame_gap + (frame_border * 2);
-
-	/* Rest of the screen covered by large/dual frame(s). */
-	if (dual) {
-		width = ((screen_width - offset - frame_gap) / 2) -
-		    frame_border;
-	} else {
-		width = screen_width - offset - frame_gap - (frame_border * 2);
-	}
-
-	frame = coma_frame_create(width, frame_height, offset, frame_y_offset);
-	coma_frame_register(frame);
 
-	if (dual) {
-		offset += width;
-		frame = coma_frame_create(width, frame_height, offset,
-		    frame_y_offset);
-		coma_frame_register(frame);
+	TAILQ_FOREACH(frame, &frames, list) {
+		if (--n == 0)
+			return (frame);
 	}
 
-	/* Popup covers entire screen. */
-	frame_popup = coma_frame_create(screen_width - (frame_border * 2) -
-	    (frame_gap * 2), frame_height, frame_gap, frame_y_offset);
+	return (NULL);
+}
 
-	zoom_width = screen_width - (frame_gap * 2);
+void
+coma_frame_register(struct frame *frame)
+{
+	frame->flags = COMA_FRAME_INLIST;
+	TAILQ_INSERT_TAIL(&frames, frame, list);
 }
 
 static void
@@ -950,49 +1145,566 @@ frame_bar_sort(struct frame *frame)
 	}
 }
 
+static void
+frame_split(int how)
+{
+	struct frame	*leaf, *node, *frame;
+	int		size;
+
+	leaf = frame_active;
+
+	if (leaf == frame_popup || leaf->flags & COMA_FRAME_ZOOMED)
+		return;
+
+	if (how == COMA_FRAME_SPLIT_HORIZONTAL) {
+		size = (leaf->rh - frame_gap) / 2 -
+		    (frame_border * 2) - frame_bar;
+	} else {
+		size = (leaf->rw - frame_gap) / 2 - (frame_border * 2);
+	}
+
+	if (size < COMA_FRAME_MIN_SIZE)
+		return;
+
+	/* The split takes the place of the frame in the tree. */
+	node = coma_calloc(1, sizeof(*node));
+	node->bar = None;
+	node->split = how;
+	node->ratio = 50;
+	node->parent = leaf->parent;
+	node->output = leaf->output;
+	frame_rect(node, leaf->rx, leaf->ry, leaf->rw, leaf->rh);
+	TAILQ_INSERT_TAIL(&splits, node, list);
+
+	if (leaf->parent != NULL) {
+		if (leaf->parent->child[0] == leaf)
+			leaf->parent->child[0] = node;
+		else
+			leaf->parent->child[1] = node;
+	}
+
+	frame = coma_frame_create(0, 0, leaf->x, leaf->y);
+	frame->flags = leaf->flags;
+	frame->output = leaf->output;
+	frame->slot = leaf->slot;
+
+	if (leaf->flags & COMA_FRAME_INLIST)
+		TAILQ_INSERT_AFTER(&frames, leaf, frame, list);
+
+	node->child[0] = leaf;
+	node->child[1] = frame;
+	leaf->parent = node;
+	frame->parent = node;
+
+	frame_relayout(node);
+	frame_adjacency();
+
+	coma_frame_bar_update(leaf);
+	coma_frame_bar_update(frame);
+
+	frame_active = frame;
+	coma_spawn_terminal();
+}
+
+/* Move the split above the active frame, making the frame grow. */
+static void
+frame_resize(int step)
+{
+	int		ratio;
+	struct frame	*node;
+
+	if ((node = frame_active->parent) == NULL)
+		return;
+
+	if (frame_active->flags & COMA_FRAME_ZOOMED)
+		return;
+
+	if (node->child[1] == frame_active)
+		step = -step;
+
+	ratio = node->ratio + step;
+	if (ratio < COMA_FRAME_RATIO_MIN ||
+	    ratio > 100 - COMA_FRAME_RATIO_MIN)
+		return;
+
+	node->ratio = ratio;
+
+	frame_relayout(node);
+	frame_adjacency();
+}
+
+/*
+ * Divide the area of node over what is below it. Parts of the tree
+ * that end up with the same area as before are left alone.
+ */
+static void
+frame_relayout(struct frame *node)
+{
+	int		size;
+	struct frame	*a, *b;
+
+	if (node->split == COMA_FRAME_SPLIT_NONE) {
+		frame_apply(node);
+		return;
+	}
+
+	a = node->child[0];
+	b = node->child[1];
+
+	if (node->split == COMA_FRAME_SPLIT_HORIZONTAL) {
+		size = ((node->rh - frame_gap) * node->ratio) / 100;
+		if (frame_rect(a, node->rx, node->ry, node->rw, size))
+			frame_relayout(a);
+		if (frame_rect(b, node->rx, node->ry + size + frame_gap,
+		    node->rw, node->rh - size - frame_gap))
+			frame_relayout(b);
+	} else {
+		size = ((node->rw - frame_gap) * node->ratio) / 100;
+		if (frame_rect(a, node->rx, node->ry, size, node->rh))
+			frame_relayout(a);
+		if (frame_rect(b, node->rx + size + frame_gap, node->ry,
+		    node->rw - size - frame_gap, node->rh))
+			frame_relayout(b);
+	}
+}
+
+/* Set the area of a frame, returns 1 if it changed. */
+static int
+frame_rect(struct frame *frame, u_int16_t x, u_int16_t y,
+    u_int16_t w, u_int16_t h)
+{
+	if (frame->rx == x && frame->ry == y && frame->rw == w &&
+	    frame->rh == h && (frame->split || frame->bar != None))
+		return (0);
+
+	frame->rx = x;
+	frame->ry = y;
+	frame->rw = w;
+	frame->rh = h;
+
+	return (1);
+}
+
+/* Fit a frame and its clients into its area. */
+static void
+frame_apply(struct frame *frame)
+{
+	struct client	*client;
+
+	frame->orig_x = frame->rx;
+	frame->orig_y = frame->ry;
+	frame->orig_w = frame->rw - (frame_border * 2);
+	frame->orig_h = frame->rh - (frame_border * 2) - frame_bar;
+
+	if (frame->flags & COMA_FRAME_ZOOMED)
+		return;
+
+	frame->x = frame->orig_x;
+	frame->y = frame->orig_y;
+	frame->w = frame->orig_w;
+	frame->h = frame->orig_h;
+
+	frame_bar_create(frame);
+
+	TAILQ_FOREACH(client, &frame->clients, list)
+		coma_client_adjust(client);
+}
+
+/* The leaf furthest to one side (0 top or left, 1 bottom or right). */
 static struct frame *
-frame_find_left(void)
+frame_leaf(struct frame *node, int side)
 {
-	struct frame	*frame, *candidate;
+	while (node->split != COMA_FRAME_SPLIT_NONE)
+		node = node->child[side];
 
-	candidate = NULL;
+	return (node);
+}
 
-	TAILQ_FOREACH_REVERSE(frame, &frames, frame_list, list) {
-		if (frame->x < frame_active->x) {
-			if (candidate == NULL)
-				candidate = frame;
-			if (frame->y == frame_active->y)
-				return (frame);
-		}
+static struct coma_layout *
+frame_layout_current(void)
+{
+	const char		*name;
+	struct coma_layout	*layout;
+
+	name = layout_name != NULL ? layout_name : COMA_FRAME_LAYOUT_DEFAULT;
+
+	if ((layout = coma_layout_lookup(name)) == NULL)
+		fatal("unknown frame-layout '%s'", name);
+
+	return (layout);
+}
+
+/*
+ * The frame settings from the configuration, taken once since applying
+ * a layout overwrites some of them with what it worked out.
+ */
+static void
+frame_layout_env(struct coma_output *output)
+{
+	if (layout_env_set == 0) {
+		layout_env.gap = frame_gap;
+		layout_env.bar = frame_bar;
+		layout_env.border = frame_border;
+		layout_env.width = frame_width;
+		layout_env.height = frame_height;
+		layout_env.offset = frame_offset;
+		layout_env.count = frame_count;
+		layout_env_set = 1;
+	}
+
+	layout_env.screen_width = output->w;
+	layout_env.screen_height = output->h;
+}
+
+/*
+ * Evaluate layout for an output. With fallback set an output that is
+ * too small for it gets a single frame instead.
+ */
+static int
+frame_output_eval(struct coma_layout *layout, struct coma_output *output,
+    int fallback)
+{
+	frame_layout_env(output);
+
+	if (coma_layout_eval(layout, &layout_env, &output->geom) == 0)
+		return (0);
+
+	if (fallback == 0)
+		return (-1);
+
+	coma_log("layout '%s' does not fit %s, using '%s'",
+	    coma_layout_name(layout), output->name,
+	    COMA_FRAME_LAYOUT_FALLBACK);
+
+	if ((layout = coma_layout_lookup(COMA_FRAME_LAYOUT_FALLBACK)) == NULL ||
+	    coma_layout_eval(layout, &layout_env, &output->geom) == -1)
+		fatal("output %s is too small for any frame", output->name);
+
+	return (0);
+}
+
+static void
+frame_output_build(struct coma_output *output)
+{
+	size_t			idx;
+	u_int32_t		slot;
+	struct frame		*frame;
+	struct coma_output	*prev;
+	struct coma_layout_rect	*r;
+
+	/* Numbered as a fresh start with these outputs would number them. */
+	slot = frame_workspace->configured;
+	TAILQ_FOREACH(prev, &outputs, list) {
+		if (prev == output)
+			break;
+		if (prev->flags & FRAME_OUTPUT_SEEN)
+			slot += prev->geom.count;
+	}
+
+	for (idx = 0; idx < output->geom.count; idx++) {
+		r = &output->geom.frames[idx];
+		frame = coma_frame_create(r->w, r->h,
+		    output->x + r->x, output->y + r->y);
+		frame->output = output;
+		frame->slot = ++slot;
+		coma_frame_register(frame);
+	}
+}
+
+static struct frame *
+frame_output_first(struct coma_output *output)
+{
+	struct frame	*frame;
+
+	TAILQ_FOREACH(frame, &frames, list) {
+		if (frame->output == output)
+			return (frame);
+	}
+
+	return (NULL);
+}
+
+/* The output x,y is on, the first one if none is. */
+static struct coma_output *
+frame_output_at(u_int16_t x, u_int16_t y)
+{
+	struct coma_output	*output;
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		if (x >= output->x && x < output->x + output->w &&
+		    y >= output->y && y < output->y + output->h)
+			return (output);
 	}
 
-	return (candidate);
+	return (TAILQ_FIRST(&outputs));
 }
 
 static struct frame *
-frame_find_right(void)
+frame_output_next(struct frame *frame)
+{
+	struct frame	*next;
+
+	for (next = TAILQ_NEXT(frame, list); next != NULL;
+	    next = TAILQ_NEXT(next, list)) {
+		if (next->output == frame->output)
+			return (next);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Throw away the frames of output. If dst is the output itself new
+ * frames are built from its geometry first, either way the clients
+ * end up in the frames of dst in the order their frames had.
+ */
+static void
+frame_output_replace(struct coma_output *output, struct coma_output *dst)
+{
+	struct frame_list	old;
+	struct client		*client;
+	struct frame		*frame, *next, *target;
+
+	TAILQ_INIT(&old);
+
+	for (frame = TAILQ_FIRST(&frames); frame != NULL; frame = next) {
+		next = TAILQ_NEXT(frame, list);
+		if (frame->output != output)
+			continue;
+		TAILQ_REMOVE(&frames, frame, list);
+		TAILQ_INSERT_TAIL(&old, frame, list);
+	}
+
+	for (frame = TAILQ_FIRST(&splits); frame != NULL; frame = next) {
+		next = TAILQ_NEXT(frame, list);
+		if (frame->output != output)
+			continue;
+		TAILQ_REMOVE(&splits, frame, list);
+		free(frame);
+	}
+
+	if (dst == output)
+		frame_output_build(output);
+
+	target = frame_output_first(dst);
+
+	while ((frame = TAILQ_FIRST(&old)) != NULL) {
+		TAILQ_REMOVE(&old, frame, list);
+
+		if (target->focus == NULL)
+			target->focus = frame->focus;
+
+		/* The popup goes back to where the clients went. */
+		if (popup_restore == frame)
+			popup_restore = target;
+
+		while ((client = TAILQ_FIRST(&frame->clients)) != NULL) {
+			TAILQ_REMOVE(&frame->clients, client, list);
+			client->frame = target;
+			TAILQ_INSERT_TAIL(&target->clients, client, list);
+			coma_client_adjust(client);
+		}
+
+		if (frame->bar != None) {
+			XDestroyWindow(dpy, frame->bar);
+			XftDrawDestroy(frame->xft_draw);
+		}
+
+		free(frame);
+
+		/* Anything beyond the new frames ends up in the last one. */
+		if ((next = frame_output_next(target)) != NULL)
+			target = next;
+	}
+
+	for (frame = frame_output_first(dst); frame != NULL;
+	    frame = frame_output_next(frame)) {
+		if (dst == output)
+			frame_bar_create(frame);
+		if (frame->focus != NULL)
+			XRaiseWindow(dpy, frame->focus->window);
+	}
+}
+
+/* Apply changed and removed outputs, see coma_frame_outputs_end(). */
+static void
+frame_outputs_relayout(void)
+{
+	struct coma_layout	*layout;
+	struct client		*focus;
+	struct coma_output	*output, *next;
+
+	if (frame_active->flags & COMA_FRAME_ZOOMED)
+		coma_frame_zoom();
+
+	if (frame_active == frame_popup)
+		coma_frame_popup_hide();
+
+	if ((focus = client_active) != NULL && focus->frame == frame_popup)
+		focus = NULL;
+
+	layout = frame_layout_current();
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		if ((output->flags & FRAME_OUTPUT_SEEN) &&
+		    (output->flags & FRAME_OUTPUT_CHANGED))
+			(void)frame_output_eval(layout, output, 1);
+	}
+
+	frame_outputs_apply();
+	coma_workspace_hidden(frame_outputs_apply_hidden);
+
+	for (output = TAILQ_FIRST(&outputs); output != NULL; output = next) {
+		next = TAILQ_NEXT(output, list);
+		output->flags &= ~FRAME_OUTPUT_CHANGED;
+
+		if (output->flags & FRAME_OUTPUT_SEEN)
+			continue;
+
+		coma_log("output %s went away", output->name);
+
+		TAILQ_REMOVE(&outputs, output, list);
+		free(output->name);
+		free(output);
+	}
+
+	/* The old active frame may be gone, nothing may look at it. */
+	frame_active = focus != NULL ? focus->frame : TAILQ_FIRST(&frames);
+
+	frame_adjacency();
+
+	if (focus != NULL)
+		coma_client_focus(focus);
+	else
+		coma_frame_focus(frame_active, 0);
+
+	coma_frame_bars_update();
+}
+
+/* Put the frames that are loaded on the new outputs. */
+static void
+frame_outputs_apply(void)
+{
+	struct coma_output	*output, *primary;
+
+	primary = NULL;
+	TAILQ_FOREACH(output, &outputs, list) {
+		if (!(output->flags & FRAME_OUTPUT_SEEN))
+			continue;
+
+		if (primary == NULL)
+			primary = output;
+
+		if (output->flags & FRAME_OUTPUT_CHANGED)
+			frame_output_replace(output, output);
+	}
+
+	if (primary == NULL)
+		fatal("no outputs left to put frames on");
+
+	TAILQ_FOREACH(output, &outputs, list) {
+		if (!(output->flags & FRAME_OUTPUT_SEEN))
+			frame_output_replace(output, primary);
+	}
+
+	frame_popup_place();
+}
+
+/* The same for a parked workspace, which stays out of sight. */
+static void
+frame_outputs_apply_hidden(void)
 {
-	struct frame	*frame, *candidate;
+	struct frame	*frame;
+	int		flags;
+
+	flags = frame_active->output->flags;
+
+	frame_outputs_apply();
 
-	candidate = NULL;
+	if (frame_active != frame_popup && (!(flags & FRAME_OUTPUT_SEEN) ||
+	    (flags & FRAME_OUTPUT_CHANGED)))
+		frame_active = TAILQ_FIRST(&frames);
+
+	frame_adjacency();
 
 	TAILQ_FOREACH(frame, &frames, list) {
-		if (frame->x > frame_active->x) {
-			if (candidate == NULL)
-				candidate = frame;
-			if (frame->y == frame_active->y)
-				return (frame);
+		if (frame->bar != None)
+			XUnmapWindow(dpy, frame->bar);
+	}
+}
+
+/* Free the frames that are loaded. */
+static void
+frame_release(void)
+{
+	struct frame	*frame;
+
+	while ((frame = TAILQ_FIRST(&frames)) != NULL) {
+		TAILQ_REMOVE(&frames, frame, list);
+		if (frame->bar != None) {
+			XDestroyWindow(dpy, frame->bar);
+			XftDrawDestroy(frame->xft_draw);
 		}
+		free(frame);
+	}
+
+	while ((frame = TAILQ_FIRST(&splits)) != NULL) {
+		TAILQ_REMOVE(&splits, frame, list);
+		free(frame);
 	}
 
-	return (candidate);
+	if (frame_popup->bar != None) {
+		XDestroyWindow(dpy, frame_popup->bar);
+		XftDrawDestroy(frame_popup->xft_draw);
+	}
+
+	free(frame_popup);
+	frame_popup = NULL;
+	popup_restore = NULL;
 }
 
+/* The popup frame lives on the first output. */
 static void
-frame_client_move(int which)
+frame_popup_place(void)
 {
-	struct client	*client;
-	struct frame	*other, *prev;
+	u_int16_t		x, y;
+	struct coma_output	*output;
+	struct coma_layout_rect	*r;
+
+	output = TAILQ_FIRST(&outputs);
+
+	r = &output->geom.popup;
+	x = output->x + r->x;
+	y = output->y + r->y;
+
+	if (frame_popup == NULL) {
+		frame_popup = coma_frame_create(r->w, r->h, x, y);
+	} else if (frame_rect(frame_popup, x, y, r->w + (frame_border * 2),
+	    r->h + (frame_border * 2) + frame_bar)) {
+		frame_apply(frame_popup);
+		XUnmapWindow(dpy, frame_popup->bar);
+	}
+
+	frame_popup->output = output;
+	frame_offset = output->x + output->geom.offset;
+}
+
+static void
+frame_move(int dir)
+{
+	struct frame	*next;
+
+	if (frame_active->flags & COMA_FRAME_ZOOMED)
+		return;
+
+	if ((next = frame_active->adj[dir]) != NULL)
+		coma_frame_focus(next, 1);
+}
+
+static void
+frame_client_move(int dir)
+{
+	struct frame	*other;
 
 	if (!(frame_active->flags & COMA_FRAME_INLIST))
 		return;
@@ -1000,44 +1712,111 @@ frame_client_move(int which)
 	if (TAILQ_EMPTY(&frame_active->clients))
 		return;
 
-	prev = frame_active;
+	if ((other = frame_active->adj[dir]) == NULL)
+		return;
 
-	switch (which) {
-	case CLIENT_MOVE_LEFT:
-		other = frame_find_left();
-		break;
-	case CLIENT_MOVE_RIGHT:
-		other = frame_find_right();
-		break;
-	default:
-		other = NULL;
-		break;
-	}
+	coma_frame_client_move(frame_active->focus, other);
+}
 
-	if (other == NULL)
-		return;
+/*
+ * Work out the neighbours of every frame, done whenever the frames
+ * change so moving around never has to look at the others.
+ */
+static void
+frame_adjacency(void)
+{
+	size_t			n;
+	struct frame		*frame, **list;
 
-	client = frame_active->focus;
-	frame_active->focus = TAILQ_NEXT(client, list);
+	n = 0;
+	TAILQ_FOREACH(frame, &frames, list)
+		n++;
 
-	if (frame_active->focus == NULL)
-		frame_active->focus = TAILQ_FIRST(&frame_active->clients);
+	list = coma_calloc(n == 0 ? 1 : n, sizeof(*list));
 
-	if (frame_active->focus)
-		coma_client_focus(frame_active->focus);
+	n = 0;
+	TAILQ_FOREACH(frame, &frames, list)
+		list[n++] = frame;
 
-	TAILQ_REMOVE(&frame_active->clients, client, list);
-	TAILQ_INSERT_HEAD(&other->clients, client, list);
+	frame_adjacency_group(list, n);
+	free(list);
+}
 
-	client->frame = other;
-	client->x = other->x;
+static void
+frame_adjacency_group(struct frame **list, size_t n)
+{
+	struct frame	*f, *best;
+	size_t		i, j;
+	int		dir, dist, overlap, bdist, boverlap;
+
+	for (i = 0; i < n; i++) {
+		f = list[i];
+
+		for (dir = 0; dir < COMA_FRAME_DIRECTIONS; dir++) {
+			best = NULL;
+			bdist = 0;
+			boverlap = 0;
+
+			for (j = 0; j < n; j++) {
+				if (i == j || !frame_neighbor(f, list[j], dir,
+				    &dist, &overlap))
+					continue;
+
+				/* Closest first, then the most shared edge. */
+				if (best == NULL || dist < bdist ||
+				    (dist == bdist && overlap > boverlap)) {
+					best = list[j];
+					bdist = dist;
+					boverlap = overlap;
+				}
+			}
 
-	coma_client_adjust(client);
+			f->adj[dir] = best;
+		}
+	}
+}
 
-	frame_active = other;
-	coma_client_focus(client);
-	coma_client_warp_pointer(client);
+/*
+ * Is other on the dir side of frame, sharing part of that edge? If so
+ * dist is how far away it is and overlap how much of the edge it has.
+ */
+static int
+frame_neighbor(struct frame *frame, struct frame *other, int dir,
+    int *dist, int *overlap)
+{
+	int		a0, a1, b0, b1;
 
-	coma_frame_bar_update(prev);
-	coma_frame_bar_update(frame_active);
+	if (dir == COMA_FRAME_LEFT || dir == COMA_FRAME_RIGHT) {
+		a0 = frame->y;
+		a1 = frame->y + frame->h + frame_bar;
+		b0 = other->y;
+		b1 = other->y + other->h + frame_bar;
+	} else {
+		a0 = frame->x;
+		a1 = frame->x + frame->w;
+		b0 = other->x;
+		b1 = other->x + other->w;
+	}
+
+	*overlap = MIN(a1, b1) - MAX(a0, b0);
+	if (*overlap <= 0)
+		return (0);
+
+	/* Past the middle of frame counts as being on that side. */
+	switch (dir) {
+	case COMA_FRAME_LEFT:
+		*dist = frame->x - other->x;
+		return (other->x + other->w <= frame->x + frame->w / 2);
+	case COMA_FRAME_RIGHT:
+		*dist = other->x - frame->x;
+		return (other->x >= frame->x + frame->w / 2);
+	case COMA_FRAME_UP:
+		*dist = frame->y - other->y;
+		return (other->y + other->h <= frame->y + frame->h / 2);
+	case COMA_FRAME_DOWN:
+		*dist = other->y - frame->y;
+		return (other->y >= frame->y + frame->h / 2);
+	}
+
+	return (0);
 }
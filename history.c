@@ -0,0 +1,1095 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Command history for the run prompt, kept per host.
+ *
+ * The file starts with a compacted section: a header, a table of record
+ * offsets and one record per unique host and command sorted by both, so
+ * it is searched in place after mmap() without parsing anything. New
+ * commands are appended as records of their own and folded into the
+ * compacted section once there are enough of them. That rewrite runs
+ * on a thread of its own, the records added meanwhile are carried over
+ * into the new file once it is done.
+ *
+ * Suggestions are ranked on how often and how recently a command ran,
+ * the ranking for an empty prefix is cached as it walks all commands
+ * for a host.
+ */
+
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <bsd/string.h>
+#endif
+
+#include "coma.h"
+
+#define HISTORY_MAGIC		"COMAHST1"
+#define HISTORY_MAGIC_LEN	8
+
+/* Appended records before they are folded into the compacted section. */
+#define HISTORY_TAIL_MAX	1024
+
+/* Unique commands kept, the least used ones go first. */
+#define HISTORY_MAX		100000
+#define HISTORY_CMD_MAX		4096
+
+#define HISTORY_SUGGEST_MAX	16
+#define HISTORY_CACHE_TTL	(10 * 60)
+
+/* The compacted section, records being compacted and pending ones. */
+#define HISTORY_SOURCES		3
+#define HISTORY_ALIGN(x)	(((x) + 3) & ~(size_t)3)
+
+struct history_header {
+	u_int8_t		magic[HISTORY_MAGIC_LEN];
+	u_int32_t		count;
+	u_int32_t		tail;
+} __attribute__((packed));
+
+struct history_record {
+	u_int32_t		count;
+	u_int32_t		last;
+	u_int16_t		hlen;
+	u_int16_t		clen;
+} __attribute__((packed));
+
+struct history_entry {
+	char			*buf;
+	const char		*host;
+	const char		*cmd;
+	size_t			hlen;
+	size_t			clen;
+	u_int32_t		count;
+	u_int32_t		last;
+};
+
+static int	history_load(void);
+static int	history_create(void);
+static void	history_unmap(void);
+static void	history_reset(void);
+static void	history_compact(void);
+static void	history_compact_finish(int);
+static int	history_compact_tail(void);
+static void	*history_compact_thread(void *);
+static void	history_tail_add(const struct history_entry *);
+static size_t	history_record(const u_int8_t *, size_t, size_t,
+		    struct history_entry *);
+static int	history_get(size_t, struct history_entry *);
+static int	history_cmp(const struct history_entry *,
+		    const struct history_entry *);
+static int	history_prefix(const struct history_entry *,
+		    const struct history_entry *);
+static int	history_score_cmp(const void *, const void *);
+static int	history_key_cmp(const void *, const void *);
+static size_t	history_bound(const struct history_entry *);
+static size_t	history_tail_bound(const struct history_entry *, size_t,
+		    const struct history_entry *);
+static void	history_bounds(const struct history_entry *, size_t *);
+static int	history_head(int, size_t, struct history_entry *);
+static int	history_next(const struct history_entry *, size_t *,
+		    struct history_entry *);
+static int	history_find(const struct history_entry *,
+		    struct history_entry *);
+static size_t	history_merge(const struct history_entry *,
+		    struct history_entry *, size_t);
+static size_t	history_cached(const struct history_entry *,
+		    struct history_entry *, size_t);
+static void	history_cache_add(const struct history_entry *);
+static int	history_write(int, const struct history_entry *);
+
+static u_int64_t	history_score(const struct history_entry *, time_t);
+
+static time_t			score_now;
+static int			fd = -1;
+static u_int8_t			*map = NULL;
+static size_t			maplen = 0;
+static size_t			count = 0;
+static size_t			tail = 0;
+static struct history_entry	*pending = NULL;
+static size_t			pending_count = 0;
+static size_t			pending_size = 0;
+static size_t			appended = 0;
+static char			path[PATH_MAX];
+static char			tmppath[PATH_MAX];
+static struct coma_stat		*suggests = NULL;
+
+/* Owned by the compaction thread while compacting is set. */
+static pthread_t		compactor;
+static pthread_mutex_t		lock = PTHREAD_MUTEX_INITIALIZER;
+static int			compacting = 0;
+static int			compacted = 0;
+static int			compact_result = -1;
+static off_t			compact_off = 0;
+static struct history_entry	*frozen = NULL;
+static size_t			frozen_count = 0;
+
+static struct history_entry	cache[HISTORY_SUGGEST_MAX];
+static size_t			cache_count = 0;
+static time_t			cache_time = 0;
+static char			cache_host[UCHAR_MAX + 1];
+
+void
+coma_history_init(void)
+{
+	int		len;
+
+	len = snprintf(path, sizeof(path), "%s/%s",
+	    homedir, COMA_HISTORY_FILE);
+	if (len == -1 || (size_t)len >= sizeof(path))
+		fatal("history path too long");
+
+	len = snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+	if (len == -1 || (size_t)len >= sizeof(tmppath))
+		fatal("history path too long");
+
+	suggests = coma_stats_create("history:suggest");
+
+	if (history_load() == -1) {
+		coma_log("history disabled");
+		history_unmap();
+	}
+}
+
+void
+coma_history_cleanup(void)
+{
+	history_compact_finish(1);
+	history_reset();
+}
+
+/* Remember that cmd was run on host. */
+void
+coma_history_add(const char *host, const char *cmd)
+{
+	struct history_entry	entry;
+
+	history_compact_finish(0);
+
+	if (fd == -1)
+		return;
+
+	entry.buf = NULL;
+	entry.host = host;
+	entry.cmd = cmd;
+	entry.hlen = strlen(host);
+	entry.clen = strlen(cmd);
+	entry.count = 1;
+	entry.last = time(NULL);
+
+	if (entry.hlen == 0 || entry.hlen > UCHAR_MAX ||
+	    entry.clen == 0 || entry.clen > HISTORY_CMD_MAX)
+		return;
+
+	if (history_write(fd, &entry) == -1) {
+		coma_log("history write: %s", errno_s);
+		return;
+	}
+
+	history_tail_add(&entry);
+
+	if (cache_time != 0 && !strcmp(cache_host, host))
+		history_cache_add(&entry);
+
+	if (++appended >= HISTORY_TAIL_MAX)
+		history_compact();
+}
+
+/*
+ * Collect up to max commands previously run on host that start with
+ * prefix, best first. The commands are copied into buf and pointed to
+ * from out. Returns the number of commands found.
+ */
+size_t
+coma_history_suggest(const char *host, const char *prefix,
+    char *buf, size_t len, char **out, size_t max)
+{
+	struct coma_sample	sample;
+	struct history_entry	key, found[HISTORY_SUGGEST_MAX];
+	size_t			idx, n, off;
+
+	if (max > HISTORY_SUGGEST_MAX)
+		max = HISTORY_SUGGEST_MAX;
+
+	history_compact_finish(0);
+
+	if (fd == -1 || max == 0)
+		return (0);
+
+	key.host = host;
+	key.hlen = strlen(host);
+	key.cmd = prefix;
+	key.clen = strlen(prefix);
+
+	coma_stats_begin(&sample);
+
+	if (key.clen == 0)
+		n = history_cached(&key, found, max);
+	else
+		n = history_merge(&key, found, max);
+
+	off = 0;
+	for (idx = 0; idx < n; idx++) {
+		if (off + found[idx].clen + 1 > len)
+			break;
+		memcpy(buf + off, found[idx].cmd, found[idx].clen);
+		buf[off + found[idx].clen] = '\0';
+		out[idx] = buf + off;
+		off += found[idx].clen + 1;
+	}
+
+	coma_stats_end(suggests, &sample);
+
+	return (idx);
+}
+
+/*
+ * Walk the compacted section, the records being compacted and the
+ * pending records side by side for all commands on key->host starting
+ * with key->cmd and keep the best max of them in out, best first.
+ */
+static size_t
+history_merge(const struct history_entry *key, struct history_entry *out,
+    size_t max)
+{
+	time_t			now;
+	u_int64_t		score, scores[HISTORY_SUGGEST_MAX];
+	struct history_entry	cur;
+	size_t			n, pos, at[HISTORY_SOURCES];
+
+	now = time(NULL);
+
+	n = 0;
+	history_bounds(key, at);
+
+	while (history_next(key, at, &cur) == 0) {
+		/* Whatever was typed is not much of a suggestion. */
+		if (cur.clen == key->clen)
+			continue;
+
+		score = history_score(&cur, now);
+
+		for (pos = n; pos > 0 && scores[pos - 1] < score; pos--)
+			;
+
+		if (pos >= max)
+			continue;
+
+		if (n < max)
+			n++;
+
+		memmove(&scores[pos + 1], &scores[pos],
+		    (n - pos - 1) * sizeof(scores[0]));
+		memmove(&out[pos + 1], &out[pos], (n - pos - 1) * sizeof(*out));
+
+		scores[pos] = score;
+		out[pos] = cur;
+	}
+
+	return (n);
+}
+
+/*
+ * The next command starting with key->cmd over all sources, with the
+ * counts of all of them added up. Advances the positions in at.
+ */
+static int
+history_next(const struct history_entry *key, size_t *at,
+    struct history_entry *cur)
+{
+	int			src, min, have[HISTORY_SOURCES];
+	struct history_entry	head[HISTORY_SOURCES];
+
+	min = -1;
+
+	for (src = 0; src < HISTORY_SOURCES; src++) {
+		have[src] = history_head(src, at[src], &head[src]) == 0 &&
+		    history_prefix(&head[src], key);
+		if (have[src] &&
+		    (min == -1 || history_cmp(&head[src], &head[min]) < 0))
+			min = src;
+	}
+
+	if (min == -1)
+		return (-1);
+
+	*cur = head[min];
+	cur->count = 0;
+	cur->last = 0;
+
+	for (src = 0; src < HISTORY_SOURCES; src++) {
+		if (!have[src] || history_cmp(&head[src], cur) != 0)
+			continue;
+		cur->count += head[src].count;
+		if (head[src].last > cur->last)
+			cur->last = head[src].last;
+		at[src]++;
+	}
+
+	return (0);
+}
+
+/* The record for exactly key, added up over all sources. */
+static int
+history_find(const struct history_entry *key, struct history_entry *out)
+{
+	size_t		at[HISTORY_SOURCES];
+
+	history_bounds(key, at);
+
+	if (history_next(key, at, out) == -1 || history_cmp(out, key) != 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * An empty prefix ranks every command run on the host, so keep that
+ * ranking around and only redo it for another host or once the ages
+ * it was scored on are stale.
+ */
+static size_t
+history_cached(const struct history_entry *key, struct history_entry *out,
+    size_t max)
+{
+	time_t		now;
+
+	now = time(NULL);
+
+	if (cache_time == 0 || now - cache_time > HISTORY_CACHE_TTL ||
+	    strcmp(cache_host, key->host)) {
+		cache_count = history_merge(key, cache, HISTORY_SUGGEST_MAX);
+		cache_time = now;
+		(void)strlcpy(cache_host, key->host, sizeof(cache_host));
+	}
+
+	if (max > cache_count)
+		max = cache_count;
+
+	memcpy(out, cache, max * sizeof(*out));
+
+	return (max);
+}
+
+/* Move a command that just ran to where it now ranks in the cache. */
+static void
+history_cache_add(const struct history_entry *entry)
+{
+	time_t			now;
+	u_int64_t		score;
+	struct history_entry	cur;
+	size_t			idx, pos;
+
+	if (history_find(entry, &cur) == -1)
+		return;
+
+	for (idx = 0; idx < cache_count; idx++) {
+		if (history_cmp(&cache[idx], &cur) == 0) {
+			memmove(&cache[idx], &cache[idx + 1],
+			    (cache_count - idx - 1) * sizeof(*cache));
+			cache_count--;
+			break;
+		}
+	}
+
+	now = time(NULL);
+	score = history_score(&cur, now);
+
+	for (pos = cache_count; pos > 0 &&
+	    history_score(&cache[pos - 1], now) < score; pos--)
+		;
+
+	if (pos >= HISTORY_SUGGEST_MAX)
+		return;
+
+	if (cache_count < HISTORY_SUGGEST_MAX)
+		cache_count++;
+
+	memmove(&cache[pos + 1], &cache[pos],
+	    (cache_count - pos - 1) * sizeof(*cache));
+	cache[pos] = cur;
+}
+
+static int
+history_load(void)
+{
+	struct stat		st;
+	struct history_entry	entry;
+	struct history_header	*hdr;
+	size_t			off, next;
+
+	if ((fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0600)) == -1) {
+		coma_log("open(%s): %s", path, errno_s);
+		return (-1);
+	}
+
+	coma_fd_cloexec(fd);
+
+	if (fstat(fd, &st) == -1) {
+		coma_log("fstat(%s): %s", path, errno_s);
+		return (-1);
+	}
+
+	if (st.st_size == 0)
+		return (history_create());
+
+	if ((size_t)st.st_size < sizeof(*hdr) || st.st_size > UINT32_MAX) {
+		coma_log("%s: bad size, starting over", path);
+		return (history_create());
+	}
+
+	maplen = st.st_size;
+	map = mmap(NULL, maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		coma_log("mmap(%s): %s", path, errno_s);
+		map = NULL;
+		return (-1);
+	}
+
+	hdr = (struct history_header *)map;
+
+	if (memcmp(hdr->magic, HISTORY_MAGIC, HISTORY_MAGIC_LEN) ||
+	    hdr->tail > maplen ||
+	    (size_t)hdr->count > (maplen - sizeof(*hdr)) / sizeof(u_int32_t) ||
+	    hdr->tail < sizeof(*hdr) + hdr->count * sizeof(u_int32_t)) {
+		coma_log("%s: bad header, starting over", path);
+		history_unmap();
+		if ((fd = open(path, O_RDWR | O_APPEND | O_TRUNC)) == -1)
+			return (-1);
+		coma_fd_cloexec(fd);
+		return (history_create());
+	}
+
+	count = hdr->count;
+	tail = hdr->tail;
+
+	/* Only the records appended since the last compaction are read. */
+	for (off = tail; off < maplen; off = next) {
+		if ((next = history_record(map, maplen, off, &entry)) == 0)
+			break;
+		history_tail_add(&entry);
+		appended++;
+	}
+
+	/* Drop whatever a crash left half written. */
+	if (off < maplen) {
+		coma_log("%s: truncated at %zu", path, off);
+		if (ftruncate(fd, off) == -1)
+			return (-1);
+	}
+
+	return (0);
+}
+
+static int
+history_create(void)
+{
+	struct history_header	hdr;
+
+	if (ftruncate(fd, 0) == -1) {
+		coma_log("ftruncate(%s): %s", path, errno_s);
+		return (-1);
+	}
+
+	memcpy(hdr.magic, HISTORY_MAGIC, HISTORY_MAGIC_LEN);
+	hdr.count = 0;
+	hdr.tail = sizeof(hdr);
+
+	if (write(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+		coma_log("write(%s): %s", path, errno_s);
+		return (-1);
+	}
+
+	count = 0;
+	tail = sizeof(hdr);
+
+	return (0);
+}
+
+static void
+history_unmap(void)
+{
+	if (map != NULL)
+		(void)munmap(map, maplen);
+
+	if (fd != -1)
+		(void)close(fd);
+
+	fd = -1;
+	map = NULL;
+	maplen = 0;
+	count = 0;
+	tail = 0;
+}
+
+/* Drop everything we have, the cache points into it. */
+static void
+history_reset(void)
+{
+	size_t		idx;
+
+	history_unmap();
+
+	for (idx = 0; idx < pending_count; idx++)
+		free(pending[idx].buf);
+
+	for (idx = 0; idx < frozen_count; idx++)
+		free(frozen[idx].buf);
+
+	free(pending);
+	pending = NULL;
+	pending_count = 0;
+	pending_size = 0;
+	appended = 0;
+
+	free(frozen);
+	frozen = NULL;
+	frozen_count = 0;
+
+	cache_time = 0;
+	cache_count = 0;
+}
+
+/*
+ * Hand the pending records to a thread that merges them with the
+ * compacted section into a new file. Records added meanwhile are
+ * appended to the current file and pending as usual.
+ */
+static void
+history_compact(void)
+{
+	if (compacting)
+		return;
+
+	if ((compact_off = lseek(fd, 0, SEEK_END)) == -1) {
+		coma_log("lseek(%s): %s", path, errno_s);
+		return;
+	}
+
+	frozen = pending;
+	frozen_count = pending_count;
+
+	pending = NULL;
+	pending_count = 0;
+	pending_size = 0;
+	appended = 0;
+
+	compacted = 0;
+
+	if (pthread_create(&compactor, NULL,
+	    history_compact_thread, NULL) != 0) {
+		coma_log("history compaction: pthread_create failed");
+		pending = frozen;
+		pending_count = frozen_count;
+		pending_size = frozen_count;
+		appended = frozen_count;
+		frozen = NULL;
+		frozen_count = 0;
+		return;
+	}
+
+	compacting = 1;
+}
+
+/*
+ * Once the thread is done (or right away if wait is set) carry over
+ * the records added since it started and switch to the new file.
+ */
+static void
+history_compact_finish(int wait)
+{
+	int		done;
+
+	if (!compacting)
+		return;
+
+	if (!wait) {
+		pthread_mutex_lock(&lock);
+		done = compacted;
+		pthread_mutex_unlock(&lock);
+		if (!done)
+			return;
+	}
+
+	(void)pthread_join(compactor, NULL);
+	compacting = 0;
+
+	if (compact_result == 0) {
+		if (history_compact_tail() == -1) {
+			coma_log("history compaction failed: %s", errno_s);
+			(void)unlink(tmppath);
+		}
+	}
+
+	history_reset();
+
+	if (history_load() == -1)
+		history_unmap();
+}
+
+/* Append whatever was added after compact_off and put the file live. */
+static int
+history_compact_tail(void)
+{
+	ssize_t		ret;
+	int		nfd;
+	off_t		off;
+	u_int8_t	buf[8192];
+
+	if ((nfd = open(tmppath, O_WRONLY | O_APPEND)) == -1)
+		return (-1);
+
+	for (off = compact_off;; off += ret) {
+		if ((ret = pread(fd, buf, sizeof(buf), off)) == -1) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			goto fail;
+		}
+
+		if (ret == 0)
+			break;
+
+		if (write(nfd, buf, ret) != ret)
+			goto fail;
+	}
+
+	if (close(nfd) == -1)
+		return (-1);
+
+	return (rename(tmppath, path));
+
+fail:
+	(void)close(nfd);
+	return (-1);
+}
+
+/*
+ * Write the compacted and frozen records merged into a new compacted
+ * section. It only goes live through a rename so a crash leaves the
+ * old file in place. Runs without touching anything the event loop
+ * changes while compacting is set.
+ */
+static void *
+history_compact_thread(void *arg)
+{
+	int			nfd, ret;
+	struct history_header	hdr;
+	struct history_entry	*all;
+	size_t			idx, n, total, size, off;
+	u_int32_t		*offsets;
+	sigset_t		sigs;
+
+	/* Signals are for the main loop. */
+	sigfillset(&sigs);
+	(void)pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	ret = -1;
+	offsets = NULL;
+
+	size = count + frozen_count;
+	all = coma_calloc(size == 0 ? 1 : size, sizeof(*all));
+
+	n = 0;
+	idx = 0;
+	total = 0;
+
+	while (idx < count || total < frozen_count) {
+		if (idx < count && history_get(idx, &all[n]) == -1) {
+			idx++;
+			continue;
+		}
+
+		if (idx < count && total < frozen_count) {
+			switch (history_cmp(&all[n], &frozen[total])) {
+			case -1:
+				idx++;
+				break;
+			case 1:
+				all[n] = frozen[total++];
+				break;
+			default:
+				all[n].count += frozen[total].count;
+				if (frozen[total].last > all[n].last)
+					all[n].last = frozen[total].last;
+				idx++;
+				total++;
+				break;
+			}
+		} else if (idx < count) {
+			idx++;
+		} else {
+			all[n] = frozen[total++];
+		}
+
+		n++;
+	}
+
+	if (n > HISTORY_MAX) {
+		score_now = time(NULL);
+		qsort(all, n, sizeof(*all), history_score_cmp);
+		n = HISTORY_MAX;
+		qsort(all, n, sizeof(*all), history_key_cmp);
+	}
+
+	nfd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (nfd == -1) {
+		coma_log("open(%s): %s", tmppath, errno_s);
+		goto done;
+	}
+
+	offsets = coma_calloc(n == 0 ? 1 : n, sizeof(*offsets));
+
+	off = sizeof(hdr) + n * sizeof(*offsets);
+	for (idx = 0; idx < n; idx++) {
+		offsets[idx] = off;
+		off += HISTORY_ALIGN(sizeof(struct history_record) +
+		    all[idx].hlen + all[idx].clen);
+	}
+
+	memcpy(hdr.magic, HISTORY_MAGIC, HISTORY_MAGIC_LEN);
+	hdr.count = n;
+	hdr.tail = off;
+
+	if (write(nfd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+	    write(nfd, offsets, n * sizeof(*offsets)) !=
+	    (ssize_t)(n * sizeof(*offsets)))
+		goto fail;
+
+	for (idx = 0; idx < n; idx++) {
+		if (history_write(nfd, &all[idx]) == -1)
+			goto fail;
+	}
+
+	if (fsync(nfd) == -1)
+		goto fail;
+
+	ret = 0;
+	coma_log("history compacted to %zu commands", n);
+
+fail:
+	if (ret == -1) {
+		coma_log("history compaction failed: %s", errno_s);
+		(void)unlink(tmppath);
+	}
+
+	(void)close(nfd);
+
+done:
+	free(offsets);
+	free(all);
+
+	pthread_mutex_lock(&lock);
+	compact_result = ret;
+	compacted = 1;
+	pthread_mutex_unlock(&lock);
+
+	return (NULL);
+}
+
+/* Write a single record, padded so the next one stays aligned. */
+static int
+history_write(int wfd, const struct history_entry *entry)
+{
+	size_t			len;
+	struct history_record	rec;
+	u_int8_t		buf[sizeof(rec) + UCHAR_MAX +
+				    HISTORY_CMD_MAX + 4];
+
+	rec.count = entry->count;
+	rec.last = entry->last;
+	rec.hlen = entry->hlen;
+	rec.clen = entry->clen;
+
+	len = sizeof(rec);
+	memcpy(buf, &rec, sizeof(rec));
+	memcpy(buf + len, entry->host, entry->hlen);
+	len += entry->hlen;
+	memcpy(buf + len, entry->cmd, entry->clen);
+	len += entry->clen;
+
+	while (len != HISTORY_ALIGN(len))
+		buf[len++] = '\0';
+
+	if (write(wfd, buf, len) != (ssize_t)len)
+		return (-1);
+
+	return (0);
+}
+
+/* Keep the pending records sorted and unique. */
+static void
+history_tail_add(const struct history_entry *entry)
+{
+	size_t			idx;
+	struct history_entry	*pe;
+	char			*buf;
+
+	idx = history_tail_bound(pending, pending_count, entry);
+
+	if (idx < pending_count && history_cmp(entry, &pending[idx]) == 0) {
+		pe = &pending[idx];
+		pe->count += entry->count;
+		if (entry->last > pe->last)
+			pe->last = entry->last;
+		return;
+	}
+
+	if (pending_count == pending_size) {
+		pending_size = pending_size == 0 ? 64 : pending_size * 2;
+		pending = realloc(pending, pending_size * sizeof(*pending));
+		if (pending == NULL)
+			fatal("realloc: %s", errno_s);
+	}
+
+	/* Both live in one allocation, as they do in a record. */
+	if ((buf = malloc(entry->hlen + entry->clen)) == NULL)
+		fatal("malloc: %s", errno_s);
+
+	memcpy(buf, entry->host, entry->hlen);
+	memcpy(buf + entry->hlen, entry->cmd, entry->clen);
+
+	memmove(&pending[idx + 1], &pending[idx],
+	    (pending_count - idx) * sizeof(*pending));
+
+	pe = &pending[idx];
+	*pe = *entry;
+	pe->buf = buf;
+	pe->host = buf;
+	pe->cmd = buf + entry->hlen;
+
+	pending_count++;
+}
+
+/* Parse the record at off, returns the offset of the next one or 0. */
+static size_t
+history_record(const u_int8_t *base, size_t len, size_t off,
+    struct history_entry *entry)
+{
+	struct history_record	rec;
+	size_t			end;
+
+	if (off > len || len - off < sizeof(rec))
+		return (0);
+
+	memcpy(&rec, base + off, sizeof(rec));
+
+	end = off + sizeof(rec) + rec.hlen + rec.clen;
+	if (rec.hlen == 0 || rec.hlen > UCHAR_MAX || rec.clen == 0 ||
+	    rec.clen > HISTORY_CMD_MAX || end > len)
+		return (0);
+
+	entry->buf = NULL;
+	entry->host = (const char *)base + off + sizeof(rec);
+	entry->hlen = rec.hlen;
+	entry->cmd = entry->host + rec.hlen;
+	entry->clen = rec.clen;
+	entry->count = rec.count;
+	entry->last = rec.last;
+
+	return (HISTORY_ALIGN(end));
+}
+
+static int
+history_get(size_t idx, struct history_entry *entry)
+{
+	u_int32_t	off;
+
+	memcpy(&off, map + sizeof(struct history_header) +
+	    idx * sizeof(off), sizeof(off));
+
+	if (history_record(map, tail, off, entry) == 0)
+		return (-1);
+
+	return (0);
+}
+
+static int
+history_cmp(const struct history_entry *a, const struct history_entry *b)
+{
+	int		cmp;
+
+	cmp = memcmp(a->host, b->host, MIN(a->hlen, b->hlen));
+	if (cmp == 0 && a->hlen != b->hlen)
+		cmp = a->hlen < b->hlen ? -1 : 1;
+
+	if (cmp == 0) {
+		cmp = memcmp(a->cmd, b->cmd, MIN(a->clen, b->clen));
+		if (cmp == 0 && a->clen != b->clen)
+			cmp = a->clen < b->clen ? -1 : 1;
+	}
+
+	if (cmp < 0)
+		return (-1);
+
+	return (cmp > 0);
+}
+
+/* Is entry on the same host as key and does it start with its command? */
+static int
+history_prefix(const struct history_entry *entry,
+    const struct history_entry *key)
+{
+	if (entry->hlen != key->hlen ||
+	    memcmp(entry->host, key->host, key->hlen))
+		return (0);
+
+	if (entry->clen < key->clen ||
+	    memcmp(entry->cmd, key->cmd, key->clen))
+		return (0);
+
+	return (1);
+}
+
+/* First compacted record that does not sort before key. */
+static size_t
+history_bound(const struct history_entry *key)
+{
+	struct history_entry	entry;
+	size_t			lo, hi, mid;
+
+	lo = 0;
+	hi = count;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (history_get(mid, &entry) == -1)
+			return (count);
+		if (history_cmp(&entry, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
+/* First of the sorted records in list that does not sort before key. */
+static size_t
+history_tail_bound(const struct history_entry *list, size_t n,
+    const struct history_entry *key)
+{
+	size_t		lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (history_cmp(&list[mid], key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
+/* Where key would go in each of the sources. */
+static void
+history_bounds(const struct history_entry *key, size_t *at)
+{
+	at[0] = history_bound(key);
+	at[1] = history_tail_bound(frozen, frozen_count, key);
+	at[2] = history_tail_bound(pending, pending_count, key);
+}
+
+/* The record at pos in source src, see HISTORY_SOURCES. */
+static int
+history_head(int src, size_t pos, struct history_entry *entry)
+{
+	switch (src) {
+	case 0:
+		if (pos >= count)
+			return (-1);
+		return (history_get(pos, entry));
+	case 1:
+		if (pos >= frozen_count)
+			return (-1);
+		*entry = frozen[pos];
+		return (0);
+	default:
+		if (pos >= pending_count)
+			return (-1);
+		*entry = pending[pos];
+		return (0);
+	}
+}
+
+/* Use count weighted by how long ago the command last ran. */
+static u_int64_t
+history_score(const struct history_entry *entry, time_t now)
+{
+	time_t		age;
+	u_int64_t	weight;
+
+	age = now - (time_t)entry->last;
+
+	if (age < 60 * 60)
+		weight = 100;
+	else if (age < 24 * 60 * 60)
+		weight = 70;
+	else if (age < 7 * 24 * 60 * 60)
+		weight = 50;
+	else if (age < 30 * 24 * 60 * 60)
+		weight = 30;
+	else
+		weight = 10;
+
+	return (entry->count * weight);
+}
+
+/* Best first, for dropping the tail end on compaction. */
+static int
+history_score_cmp(const void *a, const void *b)
+{
+	u_int64_t			sa, sb;
+	const struct history_entry	*ea, *eb;
+
+	sa = history_score(a, score_now);
+	sb = history_score(b, score_now);
+
+	/* On a tie the command that ran last stays. */
+	if (sa == sb) {
+		ea = a;
+		eb = b;
+		if (ea->last == eb->last)
+			return (0);
+		return (ea->last > eb->last ? -1 : 1);
+	}
+
+	return (sa > sb ? -1 : 1);
+}
+
+static int
+history_key_cmp(const void *a, const void *b)
+{
+	return (history_cmp(a, b));
+}
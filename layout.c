@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Frame layouts as described in the configuration:
+ *
+ *	layout <name> <column> [column ...] [gap=N] [popup=full|columns]
+ *
+ * A column is a fixed width in pixels, "frame" for frame-width pixels,
+ * "*" or "N*" for a share of the width that is left, or "fill" alone
+ * for as many frame-width columns as fit the screen.
+ *
+ * Layouts are compiled into column tables when they are defined and
+ * only evaluated against the screen size when frames are created.
+ * Nothing in here talks to the X server or needs the rest of coma,
+ * errors are returned to the caller.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "layout.h"
+
+#define LAYOUT_COLUMN_FIXED	1
+#define LAYOUT_COLUMN_FRAME	2
+#define LAYOUT_COLUMN_WEIGHT	3
+
+struct layout_column {
+	int			type;
+	u_int16_t		value;
+};
+
+struct coma_layout {
+	char			*name;
+	int			fill;
+	int			gap;
+	int			popup_full;
+	size_t			count;
+	struct layout_column	columns[COMA_LAYOUT_COLUMNS];
+	TAILQ_ENTRY(coma_layout)	list;
+};
+
+static int	layout_number(const char *, u_int16_t *);
+static struct coma_layout	*layout_compile(int, char **, char *, size_t);
+static int	layout_eval_fill(const struct coma_layout_env *,
+		    struct coma_layout_geom *);
+
+static TAILQ_HEAD(, coma_layout)	layouts =
+    TAILQ_HEAD_INITIALIZER(layouts);
+
+static struct {
+	const char	*name;
+	const char	*spec;
+} builtins[] = {
+	{ "default",		"fill" },
+	{ "small-large",	"frame * popup=full" },
+	{ "small-dual",		"frame * * popup=full" },
+	{ "full",		"* popup=full" },
+	{ NULL,			NULL }
+};
+
+/* Define the builtin layouts, on failure err says why. */
+int
+coma_layout_init(char *err, size_t errlen)
+{
+	int		i, argc, ret;
+	char		*copy, *p, *argv[COMA_LAYOUT_COLUMNS + 2];
+
+	for (i = 0; builtins[i].name != NULL; i++) {
+		if ((copy = strdup(builtins[i].spec)) == NULL) {
+			(void)snprintf(err, errlen, "out of memory");
+			return (-1);
+		}
+
+		argc = 0;
+		p = copy;
+		while (argc < COMA_LAYOUT_COLUMNS + 1 &&
+		    (argv[argc] = strsep(&p, " ")) != NULL)
+			argc++;
+
+		ret = coma_layout_define(builtins[i].name, argc, argv,
+		    err, errlen);
+		free(copy);
+
+		if (ret == -1)
+			return (-1);
+	}
+
+	return (0);
+}
+
+void
+coma_layout_cleanup(void)
+{
+	struct coma_layout	*layout;
+
+	while ((layout = TAILQ_FIRST(&layouts)) != NULL) {
+		TAILQ_REMOVE(&layouts, layout, list);
+		free(layout->name);
+		free(layout);
+	}
+}
+
+/*
+ * Compile a layout description, replacing an earlier one with the same
+ * name. On failure err says why and -1 is returned.
+ */
+int
+coma_layout_define(const char *name, int argc, char **argv,
+    char *err, size_t errlen)
+{
+	struct coma_layout	*layout, *old;
+
+	if ((layout = layout_compile(argc, argv, err, errlen)) == NULL)
+		return (-1);
+
+	if ((layout->name = strdup(name)) == NULL) {
+		(void)snprintf(err, errlen, "out of memory");
+		free(layout);
+		return (-1);
+	}
+
+	if ((old = coma_layout_lookup(name)) != NULL) {
+		TAILQ_INSERT_AFTER(&layouts, old, layout, list);
+		TAILQ_REMOVE(&layouts, old, list);
+		free(old->name);
+		free(old);
+	} else {
+		TAILQ_INSERT_TAIL(&layouts, layout, list);
+	}
+
+	return (0);
+}
+
+/* Returns 1 if name is one of the layouts that are always there. */
+int
+coma_layout_builtin(const char *name)
+{
+	int		i;
+
+	for (i = 0; builtins[i].name != NULL; i++) {
+		if (!strcmp(builtins[i].name, name))
+			return (1);
+	}
+
+	return (0);
+}
+
+/* Only check a layout description, nothing is defined. */
+int
+coma_layout_check(int argc, char **argv, char *err, size_t errlen)
+{
+	struct coma_layout	*layout;
+
+	if ((layout = layout_compile(argc, argv, err, errlen)) == NULL)
+		return (-1);
+
+	free(layout);
+
+	return (0);
+}
+
+static struct coma_layout *
+layout_compile(int argc, char **argv, char *err, size_t errlen)
+{
+	int			i;
+	u_int16_t		value;
+	size_t			len;
+	struct coma_layout	*layout;
+	struct layout_column	*col;
+
+	if ((layout = calloc(1, sizeof(*layout))) == NULL) {
+		(void)snprintf(err, errlen, "out of memory");
+		return (NULL);
+	}
+
+	layout->gap = -1;
+
+	for (i = 0; i < argc; i++) {
+		if (!strncmp(argv[i], "gap=", 4)) {
+			if (layout_number(argv[i] + 4, &value) == -1) {
+				(void)snprintf(err, errlen,
+				    "bad gap '%s'", argv[i]);
+				goto fail;
+			}
+			layout->gap = value;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "popup=full")) {
+			layout->popup_full = 1;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "popup=columns")) {
+			layout->popup_full = 0;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "fill")) {
+			layout->fill = 1;
+			continue;
+		}
+
+		if (layout->count == COMA_LAYOUT_COLUMNS) {
+			(void)snprintf(err, errlen, "too many columns");
+			goto fail;
+		}
+
+		col = &layout->columns[layout->count];
+		len = strlen(argv[i]);
+
+		if (!strcmp(argv[i], "frame")) {
+			col->type = LAYOUT_COLUMN_FRAME;
+		} else if (!strcmp(argv[i], "*")) {
+			col->type = LAYOUT_COLUMN_WEIGHT;
+			col->value = 1;
+		} else if (len > 1 && argv[i][len - 1] == '*') {
+			argv[i][len - 1] = '\0';
+			col->type = LAYOUT_COLUMN_WEIGHT;
+			if (layout_number(argv[i], &col->value) == -1 ||
+			    col->value == 0) {
+				(void)snprintf(err, errlen,
+				    "bad weight '%s*'", argv[i]);
+				goto fail;
+			}
+		} else {
+			col->type = LAYOUT_COLUMN_FIXED;
+			if (layout_number(argv[i], &col->value) == -1 ||
+			    col->value == 0) {
+				(void)snprintf(err, errlen,
+				    "bad column '%s'", argv[i]);
+				goto fail;
+			}
+		}
+
+		layout->count++;
+	}
+
+	if (layout->fill && layout->count > 0) {
+		(void)snprintf(err, errlen, "fill cannot have other columns");
+		goto fail;
+	}
+
+	if (!layout->fill && layout->count == 0) {
+		(void)snprintf(err, errlen, "no columns");
+		goto fail;
+	}
+
+	return (layout);
+
+fail:
+	free(layout);
+	return (NULL);
+}
+
+struct coma_layout *
+coma_layout_lookup(const char *name)
+{
+	struct coma_layout	*layout;
+
+	TAILQ_FOREACH(layout, &layouts, list) {
+		if (!strcmp(layout->name, name))
+			return (layout);
+	}
+
+	return (NULL);
+}
+
+/* Layouts in the order they were defined, for the layout swap keys. */
+struct coma_layout *
+coma_layout_nth(int idx)
+{
+	struct coma_layout	*layout;
+
+	TAILQ_FOREACH(layout, &layouts, list) {
+		if (idx-- == 0)
+			return (layout);
+	}
+
+	return (NULL);
+}
+
+const char *
+coma_layout_name(const struct coma_layout *layout)
+{
+	return (layout->name);
+}
+
+/*
+ * Work out where the frames of layout go on a screen described by env.
+ * Returns -1 if the columns do not fit.
+ */
+int
+coma_layout_eval(const struct coma_layout *layout,
+    const struct coma_layout_env *env, struct coma_layout_geom *geom)
+{
+	size_t		idx;
+	int		gap, outer, left, right, avail, fixed, weights;
+	int		pending, share, x, used;
+
+	memset(geom, 0, sizeof(*geom));
+
+	if (env->height == 0) {
+		geom->y_offset = env->gap;
+		geom->height = env->screen_height - (env->gap * 2) -
+		    env->bar - (env->border * 2);
+	} else {
+		geom->y_offset = (env->screen_height -
+		    (env->bar + env->height + (env->border * 2))) / 2;
+		geom->height = env->height;
+	}
+
+	if (layout->fill)
+		return (layout_eval_fill(env, geom));
+
+	gap = layout->gap != -1 ? layout->gap : env->gap;
+
+	left = env->offset != -1 ? env->offset : env->gap;
+	right = env->gap;
+	avail = env->screen_width - left - right;
+
+	fixed = 0;
+	weights = 0;
+
+	for (idx = 0; idx < layout->count; idx++) {
+		switch (layout->columns[idx].type) {
+		case LAYOUT_COLUMN_FIXED:
+			fixed += layout->columns[idx].value +
+			    (env->border * 2);
+			break;
+		case LAYOUT_COLUMN_FRAME:
+			fixed += env->width + (env->border * 2);
+			break;
+		case LAYOUT_COLUMN_WEIGHT:
+			weights += layout->columns[idx].value;
+			break;
+		}
+	}
+
+	/* What is left after the fixed columns and the gaps is shared. */
+	share = avail - fixed - (gap * (int)(layout->count - 1));
+	if (share < 0 || (weights > 0 && share < weights))
+		return (-1);
+
+	x = left;
+	used = 0;
+	pending = weights;
+
+	for (idx = 0; idx < layout->count; idx++) {
+		switch (layout->columns[idx].type) {
+		case LAYOUT_COLUMN_FIXED:
+			outer = layout->columns[idx].value + (env->border * 2);
+			break;
+		case LAYOUT_COLUMN_FRAME:
+			outer = env->width + (env->border * 2);
+			break;
+		default:
+			pending -= layout->columns[idx].value;
+			/* The last weighted column gets the rounding. */
+			if (pending == 0) {
+				outer = share - used;
+			} else {
+				outer = (share * layout->columns[idx].value) /
+				    weights;
+			}
+			used += outer;
+			break;
+		}
+
+		if (outer <= env->border * 2)
+			return (-1);
+
+		geom->frames[idx].x = x;
+		geom->frames[idx].y = geom->y_offset;
+		geom->frames[idx].w = outer - (env->border * 2);
+		geom->frames[idx].h = geom->height;
+
+		x += outer + gap;
+	}
+
+	geom->count = layout->count;
+	geom->offset = left;
+
+	if (layout->popup_full) {
+		geom->zoom_width = env->screen_width - (env->gap * 2);
+		geom->popup.x = env->gap;
+		geom->popup.w = env->screen_width - (env->border * 2) -
+		    (env->gap * 2);
+	} else {
+		geom->zoom_width = x - gap - left - (env->border * 2);
+		geom->popup.x = left;
+		geom->popup.w = geom->zoom_width;
+	}
+
+	geom->popup.y = geom->y_offset;
+	geom->popup.h = geom->height;
+
+	return (0);
+}
+
+/* As many frame-width columns as fit, centered unless an offset is set. */
+static int
+layout_eval_fill(const struct coma_layout_env *env,
+    struct coma_layout_geom *geom)
+{
+	int		width, offset, x;
+	size_t		idx, count;
+
+	if (env->offset != -1)
+		width = env->screen_width - env->offset;
+	else
+		width = env->screen_width;
+
+	count = 0;
+	while (width > env->width && count < COMA_LAYOUT_COLUMNS) {
+		if (env->count != -1 && count == (size_t)env->count)
+			break;
+		count++;
+		width -= env->width;
+	}
+
+	if (count == 0)
+		return (-1);
+
+	if (env->offset != -1)
+		offset = env->offset;
+	else
+		offset = width / 2;
+
+	if (offset > (int)(env->gap * count))
+		offset -= env->gap;
+
+	x = offset;
+
+	for (idx = 0; idx < count; idx++) {
+		geom->frames[idx].x = offset;
+		geom->frames[idx].y = geom->y_offset;
+		geom->frames[idx].w = env->width;
+		geom->frames[idx].h = geom->height;
+		offset += env->width + env->gap + (env->border * 2);
+	}
+
+	geom->count = count;
+	geom->offset = x;
+	geom->zoom_width = offset - x - env->gap - (env->border * 2);
+
+	geom->popup.x = x;
+	geom->popup.y = geom->y_offset;
+	geom->popup.w = geom->zoom_width;
+	geom->popup.h = geom->height;
+
+	return (0);
+}
+
+static int
+layout_number(const char *str, u_int16_t *out)
+{
+	long		val;
+	char		*ep;
+
+	errno = 0;
+	val = strtol(str, &ep, 10);
+	if (str[0] == '\0' || *ep != '\0' || errno != 0 ||
+	    val < 0 || val > USHRT_MAX)
+		return (-1);
+
+	*out = val;
+
+	return (0);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __H_LAYOUT_H
+#define __H_LAYOUT_H
+
+/*
+ * Frame layouts, kept free of X and the rest of coma so they can be
+ * built and tested on their own.
+ */
+
+#include <sys/types.h>
+
+#include <stddef.h>
+
+#define COMA_LAYOUT_COLUMNS		16
+
+struct coma_layout;
+
+struct coma_layout_rect {
+	u_int16_t		x;
+	u_int16_t		y;
+	u_int16_t		w;
+	u_int16_t		h;
+};
+
+/* What a layout is evaluated against. */
+struct coma_layout_env {
+	u_int16_t		screen_width;
+	u_int16_t		screen_height;
+	u_int16_t		gap;
+	u_int16_t		bar;
+	u_int16_t		border;
+	u_int16_t		width;
+	u_int16_t		height;
+	int			offset;
+	int			count;
+};
+
+struct coma_layout_geom {
+	size_t			count;
+	struct coma_layout_rect	frames[COMA_LAYOUT_COLUMNS];
+	struct coma_layout_rect	popup;
+	u_int16_t		offset;
+	u_int16_t		y_offset;
+	u_int16_t		height;
+	u_int16_t		zoom_width;
+};
+
+int		coma_layout_init(char *, size_t);
+void		coma_layout_cleanup(void);
+int		coma_layout_define(const char *, int, char **, char *, size_t);
+int		coma_layout_check(int, char **, char *, size_t);
+int		coma_layout_builtin(const char *);
+int		coma_layout_eval(const struct coma_layout *,
+		    const struct coma_layout_env *, struct coma_layout_geom *);
+const char	*coma_layout_name(const struct coma_layout *);
+
+struct coma_layout	*coma_layout_nth(int);
+struct coma_layout	*coma_layout_lookup(const char *);
+
+#endif
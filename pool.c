@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A pool of terminals that were started ahead of time.
+ *
+ * Each of them runs coma -P which blocks on a fifo until we hand it
+ * the directory to start its shell in. Their windows are never mapped
+ * until one is adopted by coma-terminal or frame-split, after which
+ * the pool is refilled in the background.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <bsd/string.h>
+#endif
+
+#include "coma.h"
+
+struct pool_term {
+	pid_t			pid;
+	Window			window;
+	char			*fifo;
+	TAILQ_ENTRY(pool_term)	list;
+};
+
+static void	pool_refill(void);
+static void	pool_free(struct pool_term *);
+static void	pool_started(pid_t, int, void *);
+static int	pool_handoff(struct pool_term *, const char *);
+
+static TAILQ_HEAD(, pool_term)	pool;
+static u_int32_t		pool_id = 0;
+static int			pool_count = 0;
+static int			pool_failed = 0;
+static char			pool_dir[PATH_MAX];
+static struct coma_stat		*pool_hit = NULL;
+static struct coma_stat		*pool_miss = NULL;
+
+int				terminal_pool = 0;
+
+void
+coma_pool_init(void)
+{
+	TAILQ_INIT(&pool);
+
+	if (terminal_pool == 0)
+		return;
+
+	/* Windows of server based terminals carry the server pid. */
+	if (coma_terminal_daemon()) {
+		coma_log("terminal-pool ignored for server based terminals");
+		terminal_pool = 0;
+		return;
+	}
+
+	(void)strlcpy(pool_dir, "/tmp/coma-pool.XXXXXXXXXX", sizeof(pool_dir));
+
+	if (mkdtemp(pool_dir) == NULL)
+		fatal("mkdtemp(%s): %s", pool_dir, errno_s);
+
+	pool_hit = coma_stats_create("pool:hit");
+	pool_miss = coma_stats_create("pool:miss");
+
+	pool_refill();
+}
+
+void
+coma_pool_cleanup(void)
+{
+	struct pool_term	*term;
+
+	while ((term = TAILQ_FIRST(&pool)) != NULL) {
+		if (term->pid != -1)
+			(void)kill(term->pid, SIGTERM);
+		pool_free(term);
+	}
+
+	if (terminal_pool != 0)
+		(void)rmdir(pool_dir);
+}
+
+/*
+ * Called for every MapRequest, returns 1 if the window belongs to one
+ * of our pooled terminals in which case it is kept unmapped.
+ */
+int
+coma_pool_claim(Window window)
+{
+	u_int32_t		pid;
+	struct pool_term	*term;
+
+	if (pool_count == 0)
+		return (0);
+
+	if (coma_wm_property_read(window, atom_net_wm_pid, &pid) == -1)
+		return (0);
+
+	TAILQ_FOREACH(term, &pool, list) {
+		if (term->pid == (pid_t)pid && term->window == None) {
+			coma_log("pooled terminal %d ready as 0x%08lx",
+			    term->pid, window);
+			term->window = window;
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Adopt a ready terminal from the pool into the active frame.
+ * Returns -1 if none was available and the caller should spawn.
+ */
+int
+coma_pool_adopt(void)
+{
+	struct coma_sample	sample;
+	struct pool_term	*term;
+	const char		*pwd;
+	char			cwd[PATH_MAX];
+
+	if (terminal_pool == 0)
+		return (-1);
+
+	coma_stats_begin(&sample);
+
+	if ((pwd = coma_execute_cwd(cwd, sizeof(cwd))) == NULL)
+		pwd = homedir;
+
+	/* Give terminals that failed to start another go. */
+	pool_failed = 0;
+
+	TAILQ_FOREACH(term, &pool, list) {
+		if (term->window != None)
+			break;
+	}
+
+	if (term == NULL || pool_handoff(term, pwd) == -1) {
+		coma_stats_end(pool_miss, &sample);
+		pool_refill();
+		return (-1);
+	}
+
+	TAILQ_REMOVE(&pool, term, list);
+	pool_count--;
+
+	coma_client_create(term->window, NULL);
+	coma_stats_end(pool_hit, &sample);
+
+	free(term->fifo);
+	free(term);
+
+	pool_refill();
+
+	return (0);
+}
+
+void
+coma_pool_exited(pid_t pid)
+{
+	struct pool_term	*term;
+
+	TAILQ_FOREACH(term, &pool, list) {
+		if (term->pid == pid) {
+			coma_log("pooled terminal %d went away", pid);
+			pool_free(term);
+			break;
+		}
+	}
+}
+
+/*
+ * Start terminals until the pool is full. A failed start, which may be
+ * reported from within coma_spawn_request(), stops this until the next
+ * adopt rather than trying again right away.
+ */
+static void
+pool_refill(void)
+{
+	int			len, argc;
+	struct pool_term	*term;
+	char			*argv[16], path[PATH_MAX], buf[64];
+
+	while (pool_count < terminal_pool && !pool_failed) {
+		term = coma_calloc(1, sizeof(*term));
+
+		term->pid = -1;
+		term->window = None;
+
+		len = snprintf(path, sizeof(path), "%s/%u",
+		    pool_dir, pool_id++);
+		if (len == -1 || (size_t)len >= sizeof(path))
+			fatal("failed to create pool fifo path");
+
+		if ((term->fifo = strdup(path)) == NULL)
+			fatal("strdup");
+
+		if (mkfifo(term->fifo, 0600) == -1) {
+			coma_log("mkfifo(%s): %s", term->fifo, errno_s);
+			free(term->fifo);
+			free(term);
+			return;
+		}
+
+		TAILQ_INSERT_TAIL(&pool, term, list);
+		pool_count++;
+
+		argc = coma_terminal_argv(argv, 16 - 3, buf, sizeof(buf),
+		    -1, NULL, NULL, 1);
+		if (argc == -1) {
+			pool_free(term);
+			return;
+		}
+
+		argv[argc++] = coma_program_path();
+		argv[argc++] = "-P";
+		argv[argc++] = term->fifo;
+		argv[argc] = NULL;
+
+		(void)coma_spawn_request(argv, homedir, NULL,
+		    pool_started, term);
+	}
+}
+
+static void
+pool_started(pid_t pid, int err, void *arg)
+{
+	struct pool_term	*term = arg;
+
+	if (pid == -1) {
+		coma_log("failed to start pooled terminal: %s", strerror(err));
+		pool_failed = 1;
+		pool_free(term);
+		return;
+	}
+
+	term->pid = pid;
+	coma_spawn_forget(pid);
+}
+
+static int
+pool_handoff(struct pool_term *term, const char *pwd)
+{
+	int		fd, len;
+	char		buf[PATH_MAX + 1];
+
+	len = snprintf(buf, sizeof(buf), "%s\n", pwd);
+	if (len == -1 || (size_t)len >= sizeof(buf))
+		return (-1);
+
+	/* ENXIO means its shell did not reach the fifo yet. */
+	if ((fd = open(term->fifo, O_WRONLY | O_NONBLOCK)) == -1) {
+		coma_log("pooled terminal %d not ready: %s", term->pid,
+		    errno_s);
+		return (-1);
+	}
+
+	if (write(fd, buf, len) != len) {
+		coma_log("write(%s): %s", term->fifo, errno_s);
+		(void)close(fd);
+		return (-1);
+	}
+
+	(void)close(fd);
+	(void)unlink(term->fifo);
+
+	return (0);
+}
+
+static void
+pool_free(struct pool_term *term)
+{
+	TAILQ_REMOVE(&pool, term, list);
+	pool_count--;
+
+	(void)unlink(term->fifo);
+
+	free(term->fifo);
+	free(term);
+}
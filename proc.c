@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Directory and command of clients whose shell does not tell us.
+ *
+ * A thread follows _NET_WM_PID of each client to the shell on its
+ * terminal and samples the foreground process group of that terminal
+ * from /proc. It samples often right after the client was active and
+ * backs off while nothing changes. Only changed values are queued for
+ * the event loop. The loop itself still reads /proc/<pid>/stat when a
+ * window maps, to follow its parents for rules and spawn placement.
+ *
+ * Both ways messages go on a locked queue with a pipe to wake up the
+ * other side, so none are lost when a pipe fills up.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "coma.h"
+
+#define PROC_INTERVAL_MIN	100
+#define PROC_INTERVAL_MAX	5000
+
+#define PROC_MSG_ADD		1
+#define PROC_MSG_REMOVE		2
+#define PROC_MSG_ACTIVE		3
+#define PROC_MSG_RESEND		4
+#define PROC_MSG_QUIT		5
+
+struct proc_msg {
+	u_int32_t		op;
+	u_int32_t		id;
+	pid_t			pid;
+	TAILQ_ENTRY(proc_msg)	list;
+};
+
+/* A client as the thread knows it, only ever touched by the thread. */
+struct proc_entry {
+	u_int32_t		id;
+	pid_t			pid;
+	pid_t			shell;
+	int			interval;
+	int			resend;
+	u_int64_t		due;
+	char			pwd[PATH_MAX];
+	char			cmd[64];
+	TAILQ_ENTRY(proc_entry)	list;
+};
+
+/* What changed, NULL for the values that did not. */
+struct proc_result {
+	u_int32_t		id;
+	char			*pwd;
+	char			*cmd;
+	TAILQ_ENTRY(proc_result) list;
+};
+
+TAILQ_HEAD(proc_results, proc_result);
+
+static void		*proc_thread(void *);
+static void		proc_message(struct proc_msg *);
+static void		proc_sample(struct proc_entry *, u_int64_t);
+static pid_t		proc_shell(pid_t);
+static int		proc_stat(pid_t, pid_t *, int *, pid_t *);
+static void		proc_post(struct proc_entry *, const char *,
+			    const char *);
+static void		proc_send(u_int32_t, u_int32_t, pid_t);
+static void		proc_results(struct coma_io *, int);
+
+static TAILQ_HEAD(, proc_entry)	entries = TAILQ_HEAD_INITIALIZER(entries);
+static struct proc_results	results = TAILQ_HEAD_INITIALIZER(results);
+static TAILQ_HEAD(, proc_msg)	msgs = TAILQ_HEAD_INITIALIZER(msgs);
+
+static pthread_t		thread;
+static pthread_mutex_t		lock = PTHREAD_MUTEX_INITIALIZER;
+static int			cmds[2] = { -1, -1 };
+static int			wakeup[2] = { -1, -1 };
+static struct coma_io		proc_io;
+static struct coma_stat		*updates = NULL;
+
+void
+coma_proc_init(void)
+{
+	int		idx, flags;
+
+#if !defined(__linux__)
+	return;
+#endif
+
+	if (pipe(cmds) == -1 || pipe(wakeup) == -1)
+		fatal("pipe: %s", errno_s);
+
+	for (idx = 0; idx < 2; idx++) {
+		coma_fd_cloexec(cmds[idx]);
+		coma_fd_cloexec(wakeup[idx]);
+	}
+
+	/* A full pipe only means the thread has a wakeup pending. */
+	if ((flags = fcntl(cmds[1], F_GETFL)) == -1 ||
+	    fcntl(cmds[1], F_SETFL, flags | O_NONBLOCK) == -1)
+		fatal("fcntl: %s", errno_s);
+
+	if ((flags = fcntl(wakeup[0], F_GETFL)) == -1 ||
+	    fcntl(wakeup[0], F_SETFL, flags | O_NONBLOCK) == -1)
+		fatal("fcntl: %s", errno_s);
+
+	if ((flags = fcntl(wakeup[1], F_GETFL)) == -1 ||
+	    fcntl(wakeup[1], F_SETFL, flags | O_NONBLOCK) == -1)
+		fatal("fcntl: %s", errno_s);
+
+	updates = coma_stats_create("proc:update");
+
+	proc_io.fd = wakeup[0];
+	proc_io.events = POLLIN;
+	proc_io.arg = NULL;
+	proc_io.cb = proc_results;
+	coma_wm_io_register(&proc_io);
+
+	if (pthread_create(&thread, NULL, proc_thread, NULL) != 0)
+		fatal("pthread_create failed");
+}
+
+void
+coma_proc_cleanup(void)
+{
+	struct proc_msg		*msg;
+	struct proc_result	*res;
+
+	if (cmds[1] == -1)
+		return;
+
+	proc_send(PROC_MSG_QUIT, 0, 0);
+	(void)pthread_join(thread, NULL);
+
+	while ((msg = TAILQ_FIRST(&msgs)) != NULL) {
+		TAILQ_REMOVE(&msgs, msg, list);
+		free(msg);
+	}
+
+	coma_wm_io_unregister(&proc_io);
+
+	(void)close(cmds[0]);
+	(void)close(cmds[1]);
+	(void)close(wakeup[0]);
+	(void)close(wakeup[1]);
+	cmds[0] = cmds[1] = wakeup[0] = wakeup[1] = -1;
+
+	while ((res = TAILQ_FIRST(&results)) != NULL) {
+		TAILQ_REMOVE(&results, res, list);
+		free(res->pwd);
+		free(res->cmd);
+		free(res);
+	}
+}
+
+/* Start sampling a client that has a _NET_WM_PID. */
+void
+coma_proc_add(struct client *client)
+{
+	u_int32_t	pid;
+
+	if (cmds[1] == -1)
+		return;
+
+	if (coma_wm_property_read(client->window, atom_net_wm_pid, &pid) == -1)
+		return;
+
+	proc_send(PROC_MSG_ADD, client->id, pid);
+}
+
+void
+coma_proc_remove(struct client *client)
+{
+	proc_send(PROC_MSG_REMOVE, client->id, 0);
+}
+
+/*
+ * The client saw activity, sample it soon. With resend set the current
+ * values are posted even if they did not change.
+ */
+void
+coma_proc_activity(struct client *client, int resend)
+{
+	proc_send(resend ? PROC_MSG_RESEND : PROC_MSG_ACTIVE, client->id, 0);
+}
+
+static void
+proc_send(u_int32_t op, u_int32_t id, pid_t pid)
+{
+	struct proc_msg		*msg;
+
+	if (cmds[1] == -1)
+		return;
+
+	msg = coma_calloc(1, sizeof(*msg));
+	msg->op = op;
+	msg->id = id;
+	msg->pid = pid;
+
+	pthread_mutex_lock(&lock);
+	TAILQ_INSERT_TAIL(&msgs, msg, list);
+	pthread_mutex_unlock(&lock);
+
+	if (write(cmds[1], "m", 1) == -1 && errno != EAGAIN &&
+	    op == PROC_MSG_QUIT)
+		fatal("proc: cannot stop sampler: %s", errno_s);
+}
+
+static void
+proc_results(struct coma_io *io, int revents)
+{
+	struct proc_results	todo;
+	struct proc_result	*res;
+	struct client		*client;
+	struct coma_sample	sample;
+	char			buf[64];
+
+	while (read(wakeup[0], buf, sizeof(buf)) > 0)
+		;
+
+	TAILQ_INIT(&todo);
+
+	pthread_mutex_lock(&lock);
+	TAILQ_CONCAT(&todo, &results, list);
+	pthread_mutex_unlock(&lock);
+
+	while ((res = TAILQ_FIRST(&todo)) != NULL) {
+		TAILQ_REMOVE(&todo, res, list);
+
+		coma_stats_begin(&sample);
+
+		if ((client = coma_client_lookup(res->id)) != NULL &&
+		    coma_client_sampled(client, res->pwd, res->cmd))
+			coma_frame_bar_update(client->frame);
+
+		coma_stats_end(updates, &sample);
+
+		free(res->pwd);
+		free(res->cmd);
+		free(res);
+	}
+}
+
+static void *
+proc_thread(void *arg)
+{
+	struct pollfd		pfd;
+	struct proc_msg		*msg;
+	struct proc_entry	*entry;
+	u_int64_t		now, next;
+	int			timeout, quit;
+	ssize_t			ret;
+	char			buf[64];
+	sigset_t		sigs;
+	TAILQ_HEAD(, proc_msg)	todo;
+
+	/* Signals are for the main loop. */
+	sigfillset(&sigs);
+	(void)pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	quit = 0;
+
+	while (!quit) {
+		now = coma_stats_now();
+		next = 0;
+
+		TAILQ_FOREACH(entry, &entries, list) {
+			if (entry->due <= now)
+				proc_sample(entry, now);
+			if (next == 0 || entry->due < next)
+				next = entry->due;
+		}
+
+		if (next == 0)
+			timeout = -1;
+		else
+			timeout = (next - now + 999999) / 1000000;
+
+		pfd.fd = cmds[0];
+		pfd.events = POLLIN;
+
+		if (poll(&pfd, 1, timeout) == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (!(pfd.revents & POLLIN))
+			continue;
+
+		if ((ret = read(cmds[0], buf, sizeof(buf))) <= 0) {
+			if (ret == -1 && errno == EINTR)
+				continue;
+			break;
+		}
+
+		TAILQ_INIT(&todo);
+
+		pthread_mutex_lock(&lock);
+		TAILQ_CONCAT(&todo, &msgs, list);
+		pthread_mutex_unlock(&lock);
+
+		while ((msg = TAILQ_FIRST(&todo)) != NULL) {
+			TAILQ_REMOVE(&todo, msg, list);
+			if (msg->op == PROC_MSG_QUIT)
+				quit = 1;
+			else if (!quit)
+				proc_message(msg);
+			free(msg);
+		}
+	}
+
+	while ((entry = TAILQ_FIRST(&entries)) != NULL) {
+		TAILQ_REMOVE(&entries, entry, list);
+		free(entry);
+	}
+
+	return (NULL);
+}
+
+static void
+proc_message(struct proc_msg *msg)
+{
+	struct proc_entry	*entry;
+
+	TAILQ_FOREACH(entry, &entries, list) {
+		if (entry->id == msg->id)
+			break;
+	}
+
+	switch (msg->op) {
+	case PROC_MSG_ADD:
+		if (entry != NULL)
+			break;
+		entry = coma_calloc(1, sizeof(*entry));
+		entry->id = msg->id;
+		entry->pid = msg->pid;
+		entry->interval = PROC_INTERVAL_MIN;
+		TAILQ_INSERT_TAIL(&entries, entry, list);
+		break;
+	case PROC_MSG_REMOVE:
+		if (entry == NULL)
+			break;
+		TAILQ_REMOVE(&entries, entry, list);
+		free(entry);
+		break;
+	case PROC_MSG_RESEND:
+		if (entry != NULL)
+			entry->resend = 1;
+		/* FALLTHROUGH */
+	case PROC_MSG_ACTIVE:
+		if (entry == NULL)
+			break;
+		entry->interval = PROC_INTERVAL_MIN;
+		entry->due = 0;
+		break;
+	}
+}
+
+static void
+proc_sample(struct proc_entry *entry, u_int64_t now)
+{
+	ssize_t		len;
+	pid_t		ppid, tpgid;
+	int		fd, tty;
+	char		path[64], pwd[PATH_MAX], cmd[64];
+
+	if (entry->shell == 0 || proc_stat(entry->shell, &ppid,
+	    &tty, &tpgid) == -1 || ppid != entry->pid || tty == 0) {
+		entry->shell = proc_shell(entry->pid);
+		if (entry->shell == -1 || proc_stat(entry->shell, &ppid,
+		    &tty, &tpgid) == -1) {
+			entry->shell = 0;
+			entry->interval = PROC_INTERVAL_MAX;
+			entry->due = now + entry->interval * 1000000ULL;
+			return;
+		}
+	}
+
+	/* Whatever runs in the foreground of the terminal, else the shell. */
+	if (tpgid <= 0)
+		tpgid = entry->shell;
+
+	(void)snprintf(path, sizeof(path), "/proc/%d/cwd", tpgid);
+	if ((len = readlink(path, pwd, sizeof(pwd) - 1)) == -1)
+		len = 0;
+	pwd[len] = '\0';
+
+	(void)snprintf(path, sizeof(path), "/proc/%d/comm", tpgid);
+	len = 0;
+	if ((fd = open(path, O_RDONLY)) != -1) {
+		if ((len = read(fd, cmd, sizeof(cmd) - 1)) == -1)
+			len = 0;
+		(void)close(fd);
+	}
+	cmd[len] = '\0';
+	cmd[strcspn(cmd, "\n")] = '\0';
+
+	if (pwd[0] == '\0' && cmd[0] == '\0') {
+		entry->interval = PROC_INTERVAL_MAX;
+		entry->due = now + entry->interval * 1000000ULL;
+		return;
+	}
+
+	if (entry->resend || strcmp(pwd, entry->pwd) ||
+	    strcmp(cmd, entry->cmd)) {
+		proc_post(entry, pwd, cmd);
+		entry->interval = PROC_INTERVAL_MIN;
+	} else if (entry->interval < PROC_INTERVAL_MAX) {
+		entry->interval *= 2;
+		if (entry->interval > PROC_INTERVAL_MAX)
+			entry->interval = PROC_INTERVAL_MAX;
+	}
+
+	entry->due = now + entry->interval * 1000000ULL;
+}
+
+static void
+proc_post(struct proc_entry *entry, const char *pwd, const char *cmd)
+{
+	struct proc_result	*res;
+
+	res = coma_calloc(1, sizeof(*res));
+	res->id = entry->id;
+
+	if (entry->resend || strcmp(pwd, entry->pwd)) {
+		if ((res->pwd = strdup(pwd)) == NULL)
+			fatal("strdup");
+		(void)snprintf(entry->pwd, sizeof(entry->pwd), "%s", pwd);
+	}
+
+	if (entry->resend || strcmp(cmd, entry->cmd)) {
+		if ((res->cmd = strdup(cmd)) == NULL)
+			fatal("strdup");
+		(void)snprintf(entry->cmd, sizeof(entry->cmd), "%s", cmd);
+	}
+
+	entry->resend = 0;
+
+	pthread_mutex_lock(&lock);
+	TAILQ_INSERT_TAIL(&results, res, list);
+	pthread_mutex_unlock(&lock);
+
+	/* A full pipe means the loop is woken up already. */
+	if (write(wakeup[1], "r", 1) == -1 && errno != EAGAIN)
+		coma_log("proc: wakeup: %s", errno_s);
+}
+
+/*
+ * The shell on the terminal of pid, the one child that has a tty.
+ * Terminal servers with several windows have more, those are left
+ * alone as there is no telling which belongs to what window.
+ */
+static pid_t
+proc_shell(pid_t pid)
+{
+	DIR		*d;
+	struct dirent	*dp;
+	int		tty;
+	long		child;
+	char		*ep;
+	pid_t		ppid, tpgid, shell;
+
+	if ((d = opendir("/proc")) == NULL)
+		return (-1);
+
+	shell = -1;
+
+	while ((dp = readdir(d)) != NULL) {
+		errno = 0;
+		child = strtol(dp->d_name, &ep, 10);
+		if (errno != 0 || *ep != '\0' || child <= 0)
+			continue;
+
+		if (proc_stat(child, &ppid, &tty, &tpgid) == -1)
+			continue;
+
+		if (ppid != pid || tty == 0)
+			continue;
+
+		if (shell != -1) {
+			shell = -1;
+			break;
+		}
+
+		shell = child;
+	}
+
+	(void)closedir(d);
+
+	return (shell);
+}
+
+/* pid (comm) state ppid pgrp session tty_nr tpgid, comm can be odd. */
+static int
+proc_stat(pid_t pid, pid_t *ppid, int *tty, pid_t *tpgid)
+{
+	int		fd;
+	ssize_t		len;
+	char		*p, path[64], buf[512];
+
+	(void)snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return (-1);
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	(void)close(fd);
+
+	if (len <= 0)
+		return (-1);
+
+	buf[len] = '\0';
+
+	if ((p = strrchr(buf, ')')) == NULL)
+		return (-1);
+
+	if (sscanf(p + 1, " %*c %d %*d %*d %d %d", ppid, tty, tpgid) != 3)
+		return (-1);
+
+	return (0);
+}
@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * One ssh control master per remote host coma -R runs commands on so
+ * it does not pay for a full key exchange on every prefix-e.
+ *
+ * Masters are only started once a command runs on a host, titles are
+ * set by any program and merely keep a master that exists in use. A
+ * running master is asked if it is still there with ssh -O check now
+ * and then, one that fails or does not answer is stopped and started
+ * again by the next command. Masters are stopped once a host has not
+ * been used or seen for ssh-idle seconds.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <bsd/string.h>
+#endif
+
+#include "coma.h"
+
+/* A master that dies sooner than this is not restarted for a while. */
+#define REMOTE_MASTER_MIN_LIFE		5
+#define REMOTE_MASTER_BACKOFF		60
+
+/* How often a master is checked and how long it has to answer. */
+#define REMOTE_CHECK_INTERVAL		60
+#define REMOTE_CHECK_TIMEOUT		10
+
+struct remote_host {
+	char			*name;
+	char			path[PATH_MAX];
+	pid_t			pid;
+	pid_t			check;
+	time_t			checked;
+	time_t			started;
+	time_t			last;
+	time_t			retry;
+	LIST_ENTRY(remote_host)	list;
+};
+
+static void	remote_stop(struct remote_host *);
+static void	remote_start(struct remote_host *);
+static void	remote_started(pid_t, int, void *);
+static void	remote_check(struct remote_host *);
+static void	remote_checked(pid_t, int, void *);
+
+static struct remote_host	*remote_get(const char *);
+static struct remote_host	*remote_find(const char *);
+
+static LIST_HEAD(, remote_host)	hosts = LIST_HEAD_INITIALIZER(hosts);
+static char			remote_dir[PATH_MAX];
+static time_t			remote_tick = 0;
+
+char				*ssh_path = NULL;
+int				ssh_idle = 600;
+
+void
+coma_remote_init(void)
+{
+	if (ssh_path == NULL && (ssh_path = strdup("ssh")) == NULL)
+		fatal("strdup");
+
+	coma_spawn_setenv("COMA_SSH", ssh_path);
+}
+
+void
+coma_remote_cleanup(void)
+{
+	struct remote_host	*host;
+
+	while ((host = LIST_FIRST(&hosts)) != NULL) {
+		LIST_REMOVE(host, list);
+		remote_stop(host);
+		free(host->name);
+		free(host);
+	}
+
+	if (remote_dir[0] != '\0')
+		(void)rmdir(remote_dir);
+}
+
+/*
+ * A client title mentioned this host. Titles can be set by anything so
+ * this never starts a master, it only keeps one that exists in use.
+ */
+void
+coma_remote_seen(const char *name)
+{
+	struct remote_host	*host;
+
+	if ((host = remote_find(name)) != NULL)
+		host->last = time(NULL);
+}
+
+/*
+ * Returns the control socket to use for a command on the given host,
+ * or NULL if there is none. The master is started if needed, until it
+ * is up ssh simply falls back to a connection of its own.
+ */
+char *
+coma_remote_control(const char *name)
+{
+	struct remote_host	*host;
+
+	if (ssh_idle == 0 || (host = remote_get(name)) == NULL)
+		return (NULL);
+
+	host->last = time(NULL);
+
+	if (host->pid == -1) {
+		remote_start(host);
+		return (NULL);
+	}
+
+	return (host->path);
+}
+
+void
+coma_remote_exited(pid_t pid, int status)
+{
+	time_t			now;
+	struct remote_host	*host;
+
+	now = time(NULL);
+
+	LIST_FOREACH(host, &hosts, list) {
+		if (host->check > 0 && host->check == pid) {
+			host->check = -1;
+			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+				coma_log("ssh master for %s failed its check",
+				    host->name);
+				remote_stop(host);
+			}
+			break;
+		}
+
+		if (host->pid != pid)
+			continue;
+
+		coma_log("ssh master for %s went away", host->name);
+
+		host->pid = -1;
+		(void)unlink(host->path);
+
+		if (now - host->started < REMOTE_MASTER_MIN_LIFE)
+			host->retry = now + REMOTE_MASTER_BACKOFF;
+		break;
+	}
+}
+
+/* Called from the main loop, stops masters that went idle. */
+void
+coma_remote_expire(void)
+{
+	time_t			now;
+	struct remote_host	*host;
+
+	now = time(NULL);
+	if (now == remote_tick)
+		return;
+
+	remote_tick = now;
+
+	LIST_FOREACH(host, &hosts, list) {
+		if (host->pid <= 0)
+			continue;
+
+		if (now - host->last >= ssh_idle) {
+			coma_log("ssh master for %s idle", host->name);
+			remote_stop(host);
+			continue;
+		}
+
+		if (host->check > 0 &&
+		    now - host->checked >= REMOTE_CHECK_TIMEOUT) {
+			coma_log("ssh master for %s does not answer",
+			    host->name);
+			remote_stop(host);
+			continue;
+		}
+
+		if (host->check == -1 &&
+		    now - host->checked >= REMOTE_CHECK_INTERVAL)
+			remote_check(host);
+	}
+}
+
+static struct remote_host *
+remote_find(const char *name)
+{
+	struct remote_host	*host;
+
+	LIST_FOREACH(host, &hosts, list) {
+		if (!strcmp(host->name, name))
+			return (host);
+	}
+
+	return (NULL);
+}
+
+static struct remote_host *
+remote_get(const char *name)
+{
+	int			len;
+	struct remote_host	*host;
+
+	if ((host = remote_find(name)) != NULL)
+		return (host);
+
+	if (name[0] == '\0' || name[0] == '-' || strchr(name, '/') != NULL)
+		return (NULL);
+
+	if (remote_dir[0] == '\0') {
+		(void)strlcpy(remote_dir, "/tmp/coma-ssh.XXXXXXXXXX",
+		    sizeof(remote_dir));
+		if (mkdtemp(remote_dir) == NULL) {
+			coma_log("mkdtemp(%s): %s", remote_dir, errno_s);
+			remote_dir[0] = '\0';
+			return (NULL);
+		}
+	}
+
+	host = coma_calloc(1, sizeof(*host));
+	host->pid = -1;
+	host->check = -1;
+
+	len = snprintf(host->path, sizeof(host->path), "%s/%s",
+	    remote_dir, name);
+	if (len == -1 || (size_t)len >= sizeof(host->path)) {
+		free(host);
+		return (NULL);
+	}
+
+	if ((host->name = strdup(name)) == NULL)
+		fatal("strdup");
+
+	LIST_INSERT_HEAD(&hosts, host, list);
+
+	return (host);
+}
+
+static void
+remote_start(struct remote_host *host)
+{
+	time_t		now;
+	char		*argv[16], opt[PATH_MAX + 16];
+
+	now = time(NULL);
+	if (now < host->retry)
+		return;
+
+	(void)snprintf(opt, sizeof(opt), "ControlPath=%s", host->path);
+
+	argv[0] = ssh_path;
+	argv[1] = "-M";
+	argv[2] = "-N";
+	argv[3] = "-o";
+	argv[4] = "BatchMode=yes";
+	argv[5] = "-o";
+	argv[6] = "ControlPersist=no";
+	argv[7] = "-o";
+	argv[8] = "ServerAliveInterval=30";
+	argv[9] = "-o";
+	argv[10] = opt;
+	argv[11] = host->name;
+	argv[12] = NULL;
+
+	coma_log("starting ssh master for %s", host->name);
+
+	/* Claimed by remote_started() once the helper knows its pid. */
+	host->pid = 0;
+	host->started = now;
+	host->checked = now;
+	host->last = now;
+
+	(void)coma_spawn_request(argv, homedir, NULL, remote_started, host);
+}
+
+static void
+remote_started(pid_t pid, int err, void *arg)
+{
+	struct remote_host	*host = arg;
+
+	if (pid == -1) {
+		coma_log("failed to start %s: %s", ssh_path, strerror(err));
+		host->pid = -1;
+		host->retry = time(NULL) + REMOTE_MASTER_BACKOFF;
+		return;
+	}
+
+	host->pid = pid;
+	coma_spawn_forget(pid);
+}
+
+static void
+remote_check(struct remote_host *host)
+{
+	char		*argv[8], opt[PATH_MAX + 16];
+
+	(void)snprintf(opt, sizeof(opt), "ControlPath=%s", host->path);
+
+	argv[0] = ssh_path;
+	argv[1] = "-O";
+	argv[2] = "check";
+	argv[3] = "-o";
+	argv[4] = opt;
+	argv[5] = host->name;
+	argv[6] = NULL;
+
+	/* Claimed by remote_checked() once the helper knows its pid. */
+	host->check = 0;
+	host->checked = time(NULL);
+
+	(void)coma_spawn_request(argv, homedir, NULL, remote_checked, host);
+}
+
+static void
+remote_checked(pid_t pid, int err, void *arg)
+{
+	struct remote_host	*host = arg;
+
+	if (pid == -1) {
+		coma_log("failed to check ssh master for %s: %s",
+		    host->name, strerror(err));
+		host->check = -1;
+		return;
+	}
+
+	host->check = pid;
+	coma_spawn_forget(pid);
+}
+
+static void
+remote_stop(struct remote_host *host)
+{
+	if (host->check > 0)
+		(void)kill(host->check, SIGTERM);
+
+	host->check = -1;
+
+	if (host->pid > 0)
+		(void)kill(host->pid, SIGTERM);
+
+	host->pid = -1;
+	(void)unlink(host->path);
+}
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Placement rules for new windows as described in the configuration:
+ *
+ *	rule <match> [match ...] [frame=N | popup] [tag=name]
+ *
+ * A match is class=, instance=, title=, host= or parent= followed by
+ * an extended regular expression, parent= is tried against the name of
+ * the process owning the window and all of its parents. All matches of
+ * a rule must hold, the first rule that does decides where the window
+ * goes before it is ever mapped.
+ *
+ * The expressions are compiled when the rule is defined and only the
+ * window properties some rule looks at are fetched.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <X11/Xutil.h>
+
+#include <limits.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "coma.h"
+
+#define RULE_MATCH_MAX		8
+#define RULE_PARENTS_MAX	16
+
+#define RULE_FIELD_CLASS	1
+#define RULE_FIELD_INSTANCE	2
+#define RULE_FIELD_TITLE	3
+#define RULE_FIELD_HOST		4
+#define RULE_FIELD_PARENT	5
+
+#define RULE_NEED_CLASS		0x0001
+#define RULE_NEED_TITLE		0x0002
+#define RULE_NEED_PARENT	0x0004
+
+struct rule_match {
+	int			field;
+	regex_t			re;
+};
+
+struct rule {
+	int			needs;
+	int			frame;
+	int			popup;
+	char			*tag;
+	size_t			count;
+	struct rule_match	match[RULE_MATCH_MAX];
+	TAILQ_ENTRY(rule)	list;
+};
+
+/* What is known about the window being placed. */
+struct rule_window {
+	char			*class;
+	char			*instance;
+	char			*title;
+	char			*host;
+	size_t			parents;
+	char			parent[RULE_PARENTS_MAX][64];
+};
+
+static struct rule	*rule_compile(int, char **, char *, size_t);
+static void		rule_free(struct rule *);
+static void		rule_window(Window, struct rule_window *);
+static int		rule_matches(struct rule *, struct rule_window *);
+static int		rule_test(struct rule_match *, struct rule_window *);
+
+static struct {
+	const char	*name;
+	int		field;
+	int		need;
+} fields[] = {
+	{ "class",	RULE_FIELD_CLASS,	RULE_NEED_CLASS },
+	{ "instance",	RULE_FIELD_INSTANCE,	RULE_NEED_CLASS },
+	{ "title",	RULE_FIELD_TITLE,	RULE_NEED_TITLE },
+	{ "host",	RULE_FIELD_HOST,	RULE_NEED_TITLE },
+	{ "parent",	RULE_FIELD_PARENT,	RULE_NEED_PARENT },
+	{ NULL,		0,			0 }
+};
+
+static TAILQ_HEAD(, rule)	rules = TAILQ_HEAD_INITIALIZER(rules);
+static int			rule_needs = 0;
+static struct coma_stat		*rule_stat = NULL;
+
+void
+coma_rule_clear(void)
+{
+	struct rule	*rule;
+
+	while ((rule = TAILQ_FIRST(&rules)) != NULL) {
+		TAILQ_REMOVE(&rules, rule, list);
+		rule_free(rule);
+	}
+
+	rule_needs = 0;
+}
+
+/*
+ * Compile a rule and add it after the ones there already. On failure
+ * err says why and -1 is returned.
+ */
+int
+coma_rule_add(int argc, char **argv, char *err, size_t errlen)
+{
+	struct rule	*rule;
+
+	if ((rule = rule_compile(argc, argv, err, errlen)) == NULL)
+		return (-1);
+
+	rule_needs |= rule->needs;
+
+	if (rule_stat == NULL)
+		rule_stat = coma_stats_create("rule:place");
+
+	TAILQ_INSERT_TAIL(&rules, rule, list);
+
+	return (0);
+}
+
+/* Only check a rule, nothing is added. */
+int
+coma_rule_check(int argc, char **argv, char *err, size_t errlen)
+{
+	struct rule	*rule;
+
+	if ((rule = rule_compile(argc, argv, err, errlen)) == NULL)
+		return (-1);
+
+	rule_free(rule);
+
+	return (0);
+}
+
+/*
+ * Decide where a new window goes. Returns 0 and fills in place if a
+ * rule matched, -1 otherwise. The tag stays valid until the rules are
+ * cleared.
+ */
+int
+coma_rule_place(Window window, struct coma_placement *place)
+{
+	struct rule		*rule;
+	struct coma_sample	sample;
+	struct rule_window	info;
+	struct frame		*frame;
+	int			ret;
+
+	if (TAILQ_EMPTY(&rules))
+		return (-1);
+
+	coma_stats_begin(&sample);
+
+	ret = -1;
+	rule_window(window, &info);
+
+	TAILQ_FOREACH(rule, &rules, list) {
+		if (!rule_matches(rule, &info))
+			continue;
+
+		frame = NULL;
+		if (rule->popup)
+			frame = frame_popup;
+		else if (rule->frame > 0)
+			frame = coma_frame_nth(rule->frame);
+
+		if (rule->frame > 0 && frame == NULL) {
+			coma_log("window 0x%08lx: no frame %d", window,
+			    rule->frame);
+		}
+
+		place->frame = frame;
+		place->tag = rule->tag;
+
+		coma_log("window 0x%08lx placed by rule, frame %u tag %s",
+		    window, frame != NULL ? frame->id : 0,
+		    rule->tag != NULL ? rule->tag : "-");
+
+		ret = 0;
+		break;
+	}
+
+	if (info.class != NULL)
+		XFree(info.class);
+	if (info.instance != NULL)
+		XFree(info.instance);
+	if (info.title != NULL)
+		XFree(info.title);
+	free(info.host);
+
+	coma_stats_end(rule_stat, &sample);
+
+	return (ret);
+}
+
+static struct rule *
+rule_compile(int argc, char **argv, char *err, size_t errlen)
+{
+	int			i, f, rc;
+	long			frame;
+	size_t			len;
+	struct rule		*rule;
+	char			*value, *ep;
+
+	rule = coma_calloc(1, sizeof(*rule));
+
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "popup")) {
+			rule->popup = 1;
+			continue;
+		}
+
+		if ((value = strchr(argv[i], '=')) == NULL ||
+		    value[1] == '\0') {
+			(void)snprintf(err, errlen, "bad rule '%s'", argv[i]);
+			goto fail;
+		}
+
+		len = value - argv[i];
+		value++;
+
+		if (len == 5 && !strncmp(argv[i], "frame", len)) {
+			errno = 0;
+			frame = strtol(value, &ep, 10);
+			if (errno != 0 || *ep != '\0' || frame < 1 ||
+			    frame > USHRT_MAX) {
+				(void)snprintf(err, errlen,
+				    "bad frame '%s'", value);
+				goto fail;
+			}
+			rule->frame = frame;
+			continue;
+		}
+
+		if (len == 3 && !strncmp(argv[i], "tag", len)) {
+			free(rule->tag);
+			if ((rule->tag = strdup(value)) == NULL)
+				fatal("strdup");
+			continue;
+		}
+
+		for (f = 0; fields[f].name != NULL; f++) {
+			if (strlen(fields[f].name) == len &&
+			    !strncmp(argv[i], fields[f].name, len))
+				break;
+		}
+
+		if (fields[f].name == NULL) {
+			(void)snprintf(err, errlen, "bad rule '%s'", argv[i]);
+			goto fail;
+		}
+
+		if (rule->count == RULE_MATCH_MAX) {
+			(void)snprintf(err, errlen, "too many matches");
+			goto fail;
+		}
+
+		rc = regcomp(&rule->match[rule->count].re, value,
+		    REG_EXTENDED | REG_NOSUB);
+		if (rc != 0) {
+			len = strlen("bad regex: ");
+			(void)snprintf(err, errlen, "bad regex: ");
+			if (len < errlen) {
+				(void)regerror(rc,
+				    &rule->match[rule->count].re,
+				    err + len, errlen - len);
+			}
+			goto fail;
+		}
+
+		rule->needs |= fields[f].need;
+		rule->match[rule->count++].field = fields[f].field;
+	}
+
+	if (rule->count == 0) {
+		(void)snprintf(err, errlen, "rule matches nothing");
+		goto fail;
+	}
+
+	if (rule->popup && rule->frame > 0) {
+		(void)snprintf(err, errlen, "both a frame and the popup");
+		goto fail;
+	}
+
+	if (rule->popup == 0 && rule->frame == 0 && rule->tag == NULL) {
+		(void)snprintf(err, errlen, "rule does nothing");
+		goto fail;
+	}
+
+	return (rule);
+
+fail:
+	rule_free(rule);
+	return (NULL);
+}
+
+static void
+rule_free(struct rule *rule)
+{
+	size_t		idx;
+
+	for (idx = 0; idx < rule->count; idx++)
+		regfree(&rule->match[idx].re);
+
+	free(rule->tag);
+	free(rule);
+}
+
+/* Fetch only what the rules look at. */
+static void
+rule_window(Window window, struct rule_window *info)
+{
+	XClassHint	hint;
+	u_int32_t	wpid;
+	pid_t		pid;
+	char		*p;
+
+	memset(info, 0, sizeof(*info));
+
+	if (rule_needs & RULE_NEED_CLASS) {
+		coma_stats_roundtrip();
+		if (XGetClassHint(dpy, window, &hint)) {
+			info->class = hint.res_class;
+			info->instance = hint.res_name;
+		}
+	}
+
+	if (rule_needs & RULE_NEED_TITLE) {
+		coma_stats_roundtrip();
+		if (!XFetchName(dpy, window, &info->title))
+			info->title = NULL;
+	}
+
+	/* Titles look like host;directory;command when set by a shell. */
+	if (info->title != NULL && (p = strchr(info->title, ';')) != NULL) {
+		if ((info->host = strdup(info->title)) == NULL)
+			fatal("strdup");
+		info->host[p - info->title] = '\0';
+	}
+
+	if ((rule_needs & RULE_NEED_PARENT) &&
+	    coma_wm_property_read(window, atom_net_wm_pid, &wpid) == 0) {
+		pid = wpid;
+		while (pid > 1 && info->parents < RULE_PARENTS_MAX) {
+			pid = coma_spawn_parent(pid,
+			    info->parent[info->parents],
+			    sizeof(info->parent[0]));
+			if (pid == -1)
+				break;
+			info->parents++;
+		}
+	}
+}
+
+static int
+rule_matches(struct rule *rule, struct rule_window *info)
+{
+	size_t		idx;
+
+	for (idx = 0; idx < rule->count; idx++) {
+		if (!rule_test(&rule->match[idx], info))
+			return (0);
+	}
+
+	return (1);
+}
+
+static int
+rule_test(struct rule_match *match, struct rule_window *info)
+{
+	size_t		idx;
+	const char	*value;
+
+	switch (match->field) {
+	case RULE_FIELD_CLASS:
+		value = info->class;
+		break;
+	case RULE_FIELD_INSTANCE:
+		value = info->instance;
+		break;
+	case RULE_FIELD_TITLE:
+		value = info->title;
+		break;
+	case RULE_FIELD_HOST:
+		value = info->host;
+		break;
+	case RULE_FIELD_PARENT:
+		for (idx = 0; idx < info->parents; idx++) {
+			if (regexec(&match->re, info->parent[idx],
+			    0, NULL, 0) == 0)
+				return (1);
+		}
+		return (0);
+	default:
+		return (0);
+	}
+
+	if (value == NULL)
+		return (0);
+
+	return (regexec(&match->re, value, 0, NULL, 0) == 0);
+}
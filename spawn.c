@@ -0,0 +1,927 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * All programs are started by a small helper process that is forked
+ * from main() before the X connection is opened.
+ *
+ * The window manager hands it launch requests over a socketpair with
+ * a single non-blocking write and learns about the resulting pid and
+ * about exited children asynchronously from its main loop.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "coma.h"
+
+#define SPAWN_MSG_REQUEST	1
+#define SPAWN_MSG_SETENV	2
+#define SPAWN_MSG_RESULT	3
+#define SPAWN_MSG_EXIT		4
+
+#define SPAWN_MSG_MAX		(64 * 1024)
+#define SPAWN_ARGV_MAX		256
+
+/* How long we wait for a launched program to map a window. */
+#define SPAWN_LAUNCH_TTL	(60ULL * 1000000000ULL)
+
+struct spawn_hdr {
+	u_int32_t	type;
+	u_int32_t	len;
+};
+
+struct spawn_result {
+	u_int32_t	id;
+	int32_t		pid;
+	int32_t		err;
+};
+
+struct spawn_exit {
+	int32_t		pid;
+	int32_t		status;
+};
+
+struct spawn_pending {
+	u_int32_t			id;
+	void				*arg;
+	void				(*cb)(pid_t, int, void *);
+	TAILQ_ENTRY(spawn_pending)	list;
+};
+
+struct spawn_launch {
+	u_int32_t			id;
+	pid_t				pid;
+	u_int32_t			frame;
+	u_int64_t			start;
+	struct coma_stat		*stat;
+	TAILQ_ENTRY(spawn_launch)	list;
+};
+
+static void	spawn_helper(void);
+static int	spawn_helper_start(void);
+static void	spawn_helper_lost(void);
+static void	spawn_helper_reap(void);
+static void	spawn_helper_signal(int);
+static void	spawn_helper_setenv(char *);
+static void	spawn_helper_request(u_int8_t *, size_t);
+static void	spawn_helper_send(u_int32_t, const void *, size_t);
+static int	spawn_read_full(int, void *, size_t);
+static pid_t	spawn_exec(char **, const char *, int *);
+
+static void	spawn_io(struct coma_io *, int);
+static int	spawn_write(void);
+static void	spawn_buffer(u_int32_t, const void *, size_t);
+static int	spawn_queue(u_int32_t, const void *, size_t);
+static void	spawn_message(u_int32_t, u_int8_t *, size_t);
+
+static void	spawn_launch_expire(void);
+static void	spawn_launch_record(u_int32_t, const char *);
+static void	spawn_launch_started(u_int32_t, pid_t);
+static void	spawn_launch_remove(struct spawn_launch *);
+static struct spawn_launch	*spawn_launch_find(pid_t);
+
+static struct coma_io		spawn_ctl;
+static u_int32_t		spawn_id = 1;
+static size_t			ilen = 0;
+static u_int8_t			*ibuf = NULL;
+static size_t			olen = 0;
+static size_t			osize = 0;
+static u_int8_t			*obuf = NULL;
+static volatile sig_atomic_t	helper_sigchld = 0;
+
+static TAILQ_HEAD(, spawn_pending)	pending;
+static TAILQ_HEAD(, spawn_launch)	launches;
+
+void
+coma_spawn_init(void)
+{
+	TAILQ_INIT(&pending);
+	TAILQ_INIT(&launches);
+	ibuf = coma_malloc(SPAWN_MSG_MAX);
+
+	spawn_ctl.fd = -1;
+
+	if (spawn_helper_start() == -1)
+		fatal("cannot start spawn helper");
+}
+
+/*
+ * Ask the helper to start argv in cwd with the extra "KEY=value"
+ * entries from env. If cb is given it is called with the pid (or -1
+ * and an errno) once the helper replied.
+ */
+u_int32_t
+coma_spawn_request(char **argv, const char *cwd, char **env,
+    void (*cb)(pid_t, int, void *), void *arg)
+{
+	u_int32_t		id;
+	size_t			off, len;
+	struct spawn_pending	*sp;
+	u_int32_t		argc, envc;
+	u_int8_t		msg[SPAWN_MSG_MAX];
+
+	argc = 0;
+	while (argv[argc] != NULL)
+		argc++;
+
+	envc = 0;
+	while (env != NULL && env[envc] != NULL)
+		envc++;
+
+	id = spawn_id++;
+	if (spawn_id == 0)
+		spawn_id = 1;
+
+	memcpy(&msg[0], &id, sizeof(id));
+	memcpy(&msg[4], &argc, sizeof(argc));
+	memcpy(&msg[8], &envc, sizeof(envc));
+	off = 12;
+
+	len = strlen(cwd != NULL ? cwd : "") + 1;
+	if (off + len > sizeof(msg))
+		goto toolarge;
+	memcpy(&msg[off], cwd != NULL ? cwd : "", len);
+	off += len;
+
+	for (argc = 0; argv[argc] != NULL; argc++) {
+		len = strlen(argv[argc]) + 1;
+		if (off + len > sizeof(msg))
+			goto toolarge;
+		memcpy(&msg[off], argv[argc], len);
+		off += len;
+	}
+
+	for (envc = 0; env != NULL && env[envc] != NULL; envc++) {
+		len = strlen(env[envc]) + 1;
+		if (off + len > sizeof(msg))
+			goto toolarge;
+		memcpy(&msg[off], env[envc], len);
+		off += len;
+	}
+
+	if (spawn_queue(SPAWN_MSG_REQUEST, msg, off) == -1) {
+		coma_log("cannot start '%s', no spawn helper", argv[0]);
+		if (cb != NULL)
+			cb(-1, EPIPE, arg);
+		return (0);
+	}
+
+	spawn_launch_record(id, argv[0]);
+
+	if (cb != NULL) {
+		sp = coma_calloc(1, sizeof(*sp));
+		sp->id = id;
+		sp->cb = cb;
+		sp->arg = arg;
+		TAILQ_INSERT_TAIL(&pending, sp, list);
+	}
+
+	return (id);
+
+toolarge:
+	coma_log("spawn request for '%s' too large", argv[0]);
+	if (cb != NULL)
+		cb(-1, E2BIG, arg);
+
+	return (0);
+}
+
+void
+coma_spawn_setenv(const char *key, const char *value)
+{
+	int		len;
+	char		buf[1024];
+
+	len = snprintf(buf, sizeof(buf), "%s=%s", key, value);
+	if (len == -1 || (size_t)len >= sizeof(buf))
+		fatal("spawn environment '%s' too large", key);
+
+	/* Without a helper nothing is started that would need it. */
+	(void)spawn_queue(SPAWN_MSG_SETENV, buf, len + 1);
+}
+
+/*
+ * Find the frame a window should be placed in by matching its
+ * _NET_WM_PID, or one of its parents, against what we launched.
+ * Returns NULL if the window was not started by us.
+ */
+struct frame *
+coma_spawn_frame(Window window)
+{
+	u_int32_t		wpid;
+	pid_t			pid;
+	struct spawn_launch	*sl;
+	struct frame		*frame;
+
+	spawn_launch_expire();
+
+	if (TAILQ_EMPTY(&launches))
+		return (NULL);
+
+	if (coma_wm_property_read(window, atom_net_wm_pid, &wpid) == -1)
+		return (NULL);
+
+	sl = NULL;
+	for (pid = wpid; pid > 1; pid = coma_spawn_parent(pid, NULL, 0)) {
+		if ((sl = spawn_launch_find(pid)) != NULL)
+			break;
+	}
+
+	if (sl == NULL)
+		return (NULL);
+
+	coma_stats_record(sl->stat, coma_stats_now() - sl->start);
+	frame = coma_frame_lookup(sl->frame);
+
+	coma_log("window 0x%08lx (pid %u) belongs to spawn %u for frame %u",
+	    window, wpid, sl->id, sl->frame);
+
+	spawn_launch_remove(sl);
+
+	return (frame);
+}
+
+/* Stop tracking pid, its windows are placed by someone else. */
+void
+coma_spawn_forget(pid_t pid)
+{
+	struct spawn_launch	*sl;
+
+	if ((sl = spawn_launch_find(pid)) != NULL)
+		spawn_launch_remove(sl);
+}
+
+static void
+spawn_io(struct coma_io *io, int revents)
+{
+	ssize_t			ret;
+	struct spawn_hdr	hdr;
+	size_t			off;
+
+	if (revents & POLLOUT) {
+		if (spawn_write() == -1) {
+			spawn_helper_lost();
+			return;
+		}
+	}
+
+	if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+		return;
+
+	for (;;) {
+		ret = read(io->fd, ibuf + ilen, SPAWN_MSG_MAX - ilen);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			coma_log("spawn helper read: %s", errno_s);
+			spawn_helper_lost();
+			return;
+		}
+
+		if (ret == 0) {
+			spawn_helper_lost();
+			return;
+		}
+
+		ilen += ret;
+		off = 0;
+
+		while (ilen - off >= sizeof(hdr)) {
+			memcpy(&hdr, ibuf + off, sizeof(hdr));
+			if (hdr.len > SPAWN_MSG_MAX - sizeof(hdr))
+				fatal("spawn helper sent bad message");
+			if (ilen - off < sizeof(hdr) + hdr.len)
+				break;
+			spawn_message(hdr.type, ibuf + off + sizeof(hdr),
+			    hdr.len);
+			off += sizeof(hdr) + hdr.len;
+		}
+
+		ilen -= off;
+		memmove(ibuf, ibuf + off, ilen);
+	}
+}
+
+static void
+spawn_message(u_int32_t type, u_int8_t *data, size_t len)
+{
+	struct spawn_result	res;
+	struct spawn_exit	ex;
+	struct spawn_pending	*sp;
+
+	switch (type) {
+	case SPAWN_MSG_RESULT:
+		if (len != sizeof(res))
+			fatal("spawn helper sent bad result");
+		memcpy(&res, data, sizeof(res));
+
+		if (res.pid == -1) {
+			coma_log("spawn %u failed: %s", res.id,
+			    strerror(res.err));
+		} else {
+			coma_log("spawn %u started as pid %d", res.id,
+			    res.pid);
+		}
+
+		spawn_launch_started(res.id, res.pid);
+
+		TAILQ_FOREACH(sp, &pending, list) {
+			if (sp->id == res.id)
+				break;
+		}
+
+		if (sp != NULL) {
+			TAILQ_REMOVE(&pending, sp, list);
+			sp->cb(res.pid, res.err, sp->arg);
+			free(sp);
+		}
+		break;
+	case SPAWN_MSG_EXIT:
+		if (len != sizeof(ex))
+			fatal("spawn helper sent bad exit");
+		memcpy(&ex, data, sizeof(ex));
+		coma_log("pid %d exited with status %d", ex.pid, ex.status);
+		coma_pool_exited(ex.pid);
+		coma_terminal_exited(ex.pid);
+		coma_remote_exited(ex.pid, ex.status);
+		coma_spawn_forget(ex.pid);
+		break;
+	default:
+		fatal("spawn helper sent unknown message %u", type);
+	}
+}
+
+static void
+spawn_launch_record(u_int32_t id, const char *cmd)
+{
+	const char		*p;
+	struct spawn_launch	*sl;
+	char			name[64];
+
+	if ((p = strrchr(cmd, '/')) != NULL)
+		cmd = p + 1;
+
+	(void)snprintf(name, sizeof(name), "spawn:%s", cmd);
+
+	sl = coma_calloc(1, sizeof(*sl));
+	sl->id = id;
+	sl->pid = -1;
+	sl->frame = frame_active->id;
+	sl->start = coma_stats_now();
+	sl->stat = coma_stats_create(name);
+
+	TAILQ_INSERT_TAIL(&launches, sl, list);
+}
+
+static void
+spawn_launch_started(u_int32_t id, pid_t pid)
+{
+	struct spawn_launch	*sl;
+
+	TAILQ_FOREACH(sl, &launches, list) {
+		if (sl->id != id)
+			continue;
+
+		if (pid == -1)
+			spawn_launch_remove(sl);
+		else
+			sl->pid = pid;
+		break;
+	}
+}
+
+static struct spawn_launch *
+spawn_launch_find(pid_t pid)
+{
+	struct spawn_launch	*sl;
+
+	TAILQ_FOREACH(sl, &launches, list) {
+		if (sl->pid == pid)
+			return (sl);
+	}
+
+	return (NULL);
+}
+
+static void
+spawn_launch_expire(void)
+{
+	u_int64_t		now;
+	struct spawn_launch	*sl;
+
+	now = coma_stats_now();
+
+	while ((sl = TAILQ_FIRST(&launches)) != NULL) {
+		if (now - sl->start < SPAWN_LAUNCH_TTL)
+			break;
+		spawn_launch_remove(sl);
+	}
+}
+
+static void
+spawn_launch_remove(struct spawn_launch *sl)
+{
+	TAILQ_REMOVE(&launches, sl, list);
+	free(sl);
+}
+
+/*
+ * Programs often fork before mapping their window (shells, wrappers),
+ * walk up the process tree where the platform lets us do so cheaply.
+ * If comm is given it gets the name of pid.
+ */
+pid_t
+coma_spawn_parent(pid_t pid, char *comm, size_t len)
+{
+#if defined(__linux__)
+	FILE		*fp;
+	int		ppid;
+	char		path[64], name[64];
+
+	(void)snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return (-1);
+
+	/* pid (comm) state ppid, comm may contain spaces. */
+	if (fscanf(fp, "%*d (%63[^)]) %*c %d", name, &ppid) != 2)
+		ppid = -1;
+	else if (comm != NULL)
+		(void)snprintf(comm, len, "%s", name);
+
+	(void)fclose(fp);
+
+	return (ppid);
+#else
+	return (-1);
+#endif
+}
+
+static void
+spawn_buffer(u_int32_t type, const void *data, size_t len)
+{
+	struct spawn_hdr	hdr;
+
+	hdr.type = type;
+	hdr.len = len;
+
+	if (osize - olen < sizeof(hdr) + len) {
+		osize = olen + sizeof(hdr) + len;
+		if ((obuf = realloc(obuf, osize)) == NULL)
+			fatal("realloc: %s", errno_s);
+	}
+
+	memcpy(obuf + olen, &hdr, sizeof(hdr));
+	memcpy(obuf + olen + sizeof(hdr), data, len);
+	olen += sizeof(hdr) + len;
+}
+
+/* Returns -1 if there is no helper to send it to. */
+static int
+spawn_queue(u_int32_t type, const void *data, size_t len)
+{
+	if (spawn_ctl.fd == -1)
+		return (-1);
+
+	spawn_buffer(type, data, len);
+
+	if (spawn_write() == -1) {
+		spawn_helper_lost();
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+spawn_write(void)
+{
+	ssize_t		ret;
+
+	while (olen > 0) {
+		ret = write(spawn_ctl.fd, obuf, olen);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return (-1);
+		}
+
+		olen -= ret;
+		memmove(obuf, obuf + ret, olen);
+	}
+
+	if (olen > 0)
+		spawn_ctl.events |= POLLOUT;
+	else
+		spawn_ctl.events &= ~POLLOUT;
+
+	return (0);
+}
+
+/*
+ * Fork the helper, only done from coma_spawn_init() while there is
+ * no X connection or thread yet. Returns -1 if that did not work out.
+ */
+static int
+spawn_helper_start(void)
+{
+	int		flags, fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+		coma_log("socketpair: %s", errno_s);
+		return (-1);
+	}
+
+	switch (fork()) {
+	case -1:
+		coma_log("fork: %s", errno_s);
+		(void)close(fds[0]);
+		(void)close(fds[1]);
+		return (-1);
+	case 0:
+		(void)close(fds[0]);
+		spawn_ctl.fd = fds[1];
+		spawn_helper();
+		/* NOTREACHED */
+	default:
+		break;
+	}
+
+	(void)close(fds[1]);
+
+	if ((flags = fcntl(fds[0], F_GETFL, 0)) == -1)
+		fatal("fcntl: %s", errno_s);
+	if (fcntl(fds[0], F_SETFL, flags | O_NONBLOCK) == -1)
+		fatal("fcntl: %s", errno_s);
+
+	coma_fd_cloexec(fds[0]);
+
+	ilen = 0;
+	olen = 0;
+
+	spawn_ctl.fd = fds[0];
+	spawn_ctl.arg = NULL;
+	spawn_ctl.events = POLLIN;
+	spawn_ctl.cb = spawn_io;
+
+	coma_wm_io_register(&spawn_ctl);
+
+	return (0);
+}
+
+/*
+ * The helper is gone, whatever was asked of it fails and so does
+ * everything after. Forking a new one from here would copy the X
+ * connection and the locks of our threads, a restart gets a new one.
+ */
+static void
+spawn_helper_lost(void)
+{
+	struct spawn_pending	*sp;
+
+	coma_log("spawn helper went away, restart coma to start programs");
+
+	coma_wm_io_unregister(&spawn_ctl);
+	(void)close(spawn_ctl.fd);
+	spawn_ctl.fd = -1;
+
+	ilen = 0;
+	olen = 0;
+
+	while ((sp = TAILQ_FIRST(&pending)) != NULL) {
+		TAILQ_REMOVE(&pending, sp, list);
+		sp->cb(-1, EPIPE, sp->arg);
+		free(sp);
+	}
+}
+
+static void
+spawn_helper(void)
+{
+	struct pollfd		pfd;
+	struct sigaction	sa;
+	struct spawn_hdr	hdr;
+	u_int8_t		*msg;
+	int			ret;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+
+	/* The WM deals with these, we stay until it goes away. */
+	(void)sigaction(SIGINT, &sa, NULL);
+	(void)sigaction(SIGHUP, &sa, NULL);
+	(void)sigaction(SIGQUIT, &sa, NULL);
+	(void)sigaction(SIGPIPE, &sa, NULL);
+	(void)sigaction(SIGTERM, &sa, NULL);
+	(void)sigaction(SIGUSR1, &sa, NULL);
+
+	sa.sa_handler = spawn_helper_signal;
+	if (sigfillset(&sa.sa_mask) == -1)
+		fatal("sigfillset: %s", errno_s);
+	if (sigaction(SIGCHLD, &sa, NULL) == -1)
+		fatal("sigaction: %s", errno_s);
+
+	msg = coma_malloc(SPAWN_MSG_MAX);
+
+	pfd.fd = spawn_ctl.fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		if (helper_sigchld) {
+			helper_sigchld = 0;
+			spawn_helper_reap();
+		}
+
+		/* Timeout covers a SIGCHLD landing right before poll. */
+		if ((ret = poll(&pfd, 1, 1000)) == -1) {
+			if (errno == EINTR)
+				continue;
+			fatal("spawn helper poll: %s", errno_s);
+		}
+
+		if (ret == 0)
+			continue;
+
+		if (spawn_read_full(pfd.fd, &hdr, sizeof(hdr)) == -1)
+			break;
+
+		if (hdr.len > SPAWN_MSG_MAX)
+			fatal("spawn helper got bad message");
+
+		if (spawn_read_full(pfd.fd, msg, hdr.len) == -1)
+			break;
+
+		switch (hdr.type) {
+		case SPAWN_MSG_REQUEST:
+			spawn_helper_request(msg, hdr.len);
+			break;
+		case SPAWN_MSG_SETENV:
+			if (hdr.len == 0 || msg[hdr.len - 1] != '\0')
+				fatal("spawn helper got bad setenv");
+			spawn_helper_setenv((char *)msg);
+			break;
+		default:
+			fatal("spawn helper got unknown message %u", hdr.type);
+		}
+	}
+
+	exit(0);
+}
+
+static void
+spawn_helper_request(u_int8_t *msg, size_t len)
+{
+	struct spawn_result	res;
+	const char		*cwd;
+	char			*p, *end, *eq;
+	u_int32_t		idx, argc, envc;
+	char			*argv[SPAWN_ARGV_MAX];
+	char			*saved[SPAWN_ARGV_MAX];
+	char			*env[SPAWN_ARGV_MAX];
+
+	if (len < 12 || msg[len - 1] != '\0')
+		fatal("spawn helper got bad request");
+
+	memcpy(&res.id, &msg[0], sizeof(res.id));
+	memcpy(&argc, &msg[4], sizeof(argc));
+	memcpy(&envc, &msg[8], sizeof(envc));
+
+	if (argc == 0 || argc >= SPAWN_ARGV_MAX || envc >= SPAWN_ARGV_MAX)
+		fatal("spawn helper got bad request");
+
+	p = (char *)&msg[12];
+	end = (char *)&msg[len];
+
+	cwd = p;
+	p += strlen(p) + 1;
+
+	for (idx = 0; idx < argc + envc; idx++) {
+		if (p >= end)
+			fatal("spawn helper got truncated request");
+		if (idx < argc)
+			argv[idx] = p;
+		else
+			env[idx - argc] = p;
+		p += strlen(p) + 1;
+	}
+
+	argv[argc] = NULL;
+
+	/* The extra environment only lives for the duration of the spawn. */
+	for (idx = 0; idx < envc; idx++) {
+		if ((eq = strchr(env[idx], '=')) == NULL) {
+			saved[idx] = NULL;
+			continue;
+		}
+		*eq = '\0';
+		if ((saved[idx] = getenv(env[idx])) != NULL &&
+		    (saved[idx] = strdup(saved[idx])) == NULL)
+			fatal("strdup");
+		(void)setenv(env[idx], eq + 1, 1);
+	}
+
+	res.pid = spawn_exec(argv, *cwd != '\0' ? cwd : NULL, &res.err);
+
+	for (idx = 0; idx < envc; idx++) {
+		if (saved[idx] != NULL) {
+			(void)setenv(env[idx], saved[idx], 1);
+			free(saved[idx]);
+		} else {
+			(void)unsetenv(env[idx]);
+		}
+	}
+
+	spawn_helper_send(SPAWN_MSG_RESULT, &res, sizeof(res));
+}
+
+static void
+spawn_helper_setenv(char *entry)
+{
+	char		*eq;
+
+	if ((eq = strchr(entry, '=')) == NULL)
+		return;
+
+	*eq = '\0';
+	(void)setenv(entry, eq + 1, 1);
+}
+
+static void
+spawn_helper_reap(void)
+{
+	pid_t			pid;
+	int			status;
+	struct spawn_exit	ex;
+
+	for (;;) {
+		if ((pid = waitpid(WAIT_ANY, &status, WNOHANG)) == -1) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		if (pid == 0)
+			return;
+
+		ex.pid = pid;
+		ex.status = status;
+
+		spawn_helper_send(SPAWN_MSG_EXIT, &ex, sizeof(ex));
+	}
+}
+
+static void
+spawn_helper_send(u_int32_t type, const void *data, size_t len)
+{
+	ssize_t			ret;
+	size_t			off;
+	struct spawn_hdr	hdr;
+	u_int8_t		buf[sizeof(hdr) + 64];
+
+	if (len > sizeof(buf) - sizeof(hdr))
+		fatal("spawn helper message too large");
+
+	hdr.type = type;
+	hdr.len = len;
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), data, len);
+
+	len += sizeof(hdr);
+
+	for (off = 0; off < len; off += ret) {
+		if ((ret = write(spawn_ctl.fd, buf + off, len - off)) == -1) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			exit(0);
+		}
+	}
+}
+
+static void
+spawn_helper_signal(int sig)
+{
+	helper_sigchld = 1;
+}
+
+static int
+spawn_read_full(int fd, void *data, size_t len)
+{
+	ssize_t		ret;
+	size_t		off;
+
+	for (off = 0; off < len; off += ret) {
+		ret = read(fd, (u_int8_t *)data + off, len - off);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			return (-1);
+		}
+
+		if (ret == 0)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Start argv[0] in the given working directory without copying our
+ * address space: vfork() borrows it until the child calls execvp().
+ *
+ * The child only touches its own stack and the pipe, if the chdir()
+ * or exec fails it hands errno back through the pipe which is
+ * readable by the time vfork() returns to us, so we never block on it.
+ */
+static pid_t
+spawn_exec(char **argv, const char *cwd, int *error)
+{
+	pid_t			pid;
+	struct sigaction	sa;
+	int			fds[2], err;
+
+	*error = 0;
+
+	if (pipe(fds) == -1) {
+		*error = errno;
+		return (-1);
+	}
+
+	coma_fd_cloexec(fds[0]);
+	coma_fd_cloexec(fds[1]);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+
+	pid = vfork();
+
+	switch (pid) {
+	case -1:
+		*error = errno;
+		(void)close(fds[0]);
+		(void)close(fds[1]);
+		return (-1);
+	case 0:
+		if (cwd != NULL && chdir(cwd) == -1)
+			goto fail;
+
+		(void)setsid();
+		(void)sigaction(SIGINT, &sa, NULL);
+		(void)sigaction(SIGHUP, &sa, NULL);
+		(void)sigaction(SIGQUIT, &sa, NULL);
+		(void)sigaction(SIGPIPE, &sa, NULL);
+		(void)sigaction(SIGTERM, &sa, NULL);
+		(void)sigaction(SIGUSR1, &sa, NULL);
+
+		execvp(argv[0], argv);
+fail:
+		err = errno;
+		while (write(fds[1], &err, sizeof(err)) == -1 && errno == EINTR)
+			;
+		_exit(127);
+	default:
+		break;
+	}
+
+	(void)close(fds[1]);
+
+	if (read(fds[0], &err, sizeof(err)) == sizeof(err)) {
+		*error = err;
+		pid = -1;
+	}
+
+	(void)close(fds[0]);
+
+	return (pid);
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "coma.h"
+
+/*
+ * Latency histograms are kept log-linear, much like HdrHistogram:
+ * every power of two is split into STATS_SUB_BUCKETS linear buckets
+ * giving us ~6% precision from 1ns up to 2^STATS_MAX_BITS ns.
+ */
+#define STATS_SUB_BITS		4
+#define STATS_SUB_BUCKETS	(1 << STATS_SUB_BITS)
+#define STATS_MAX_BITS		40
+#define STATS_BUCKETS		\
+    ((STATS_MAX_BITS - STATS_SUB_BITS + 2) * STATS_SUB_BUCKETS)
+
+struct coma_stat {
+	char			*name;
+
+	u_int64_t		count;
+	u_int64_t		min;
+	u_int64_t		max;
+	u_int64_t		total;
+	u_int64_t		requests;
+	u_int64_t		roundtrips;
+
+	u_int32_t		buckets[STATS_BUCKETS];
+
+	TAILQ_ENTRY(coma_stat)	list;
+};
+
+static size_t		stats_bucket(u_int64_t);
+static u_int64_t	stats_bucket_value(size_t);
+static u_int64_t	stats_percentile(struct coma_stat *, double);
+static void		stats_print(FILE *, const char *, ...);
+
+static TAILQ_HEAD(, coma_stat)	stats;
+static u_int64_t		roundtrips = 0;
+static u_int64_t		waited = 0;
+static u_int64_t		wait_start = 0;
+
+void
+coma_stats_init(void)
+{
+	TAILQ_INIT(&stats);
+}
+
+struct coma_stat *
+coma_stats_create(const char *name)
+{
+	struct coma_stat	*stat;
+
+	TAILQ_FOREACH(stat, &stats, list) {
+		if (!strcmp(stat->name, name))
+			return (stat);
+	}
+
+	stat = coma_calloc(1, sizeof(*stat));
+	stat->min = UINT64_MAX;
+
+	if ((stat->name = strdup(name)) == NULL)
+		fatal("strdup");
+
+	TAILQ_INSERT_TAIL(&stats, stat, list);
+
+	return (stat);
+}
+
+void
+coma_stats_roundtrip(void)
+{
+	roundtrips++;
+}
+
+/*
+ * Time between coma_stats_wait() and coma_stats_resume() is spent on
+ * the user (a prompt, a second key) and left out of open samples.
+ */
+void
+coma_stats_wait(void)
+{
+	wait_start = coma_stats_now();
+}
+
+void
+coma_stats_resume(void)
+{
+	waited += coma_stats_now() - wait_start;
+}
+
+void
+coma_stats_begin(struct coma_sample *sample)
+{
+	sample->start = coma_stats_now();
+	sample->waited = waited;
+	sample->roundtrips = roundtrips;
+	sample->request = NextRequest(dpy);
+}
+
+void
+coma_stats_end(struct coma_stat *stat, struct coma_sample *sample)
+{
+	stat->requests += NextRequest(dpy) - sample->request;
+	stat->roundtrips += roundtrips - sample->roundtrips;
+
+	coma_stats_record(stat,
+	    coma_stats_now() - sample->start - (waited - sample->waited));
+}
+
+void
+coma_stats_record(struct coma_stat *stat, u_int64_t ns)
+{
+	stat->count++;
+	stat->total += ns;
+
+	if (ns < stat->min)
+		stat->min = ns;
+	if (ns > stat->max)
+		stat->max = ns;
+
+	stat->buckets[stats_bucket(ns)]++;
+}
+
+void
+coma_stats_dump(FILE *fp)
+{
+	struct coma_stat	*stat;
+
+	stats_print(fp, "%-28s %8s %9s %9s %9s %9s %9s %7s %7s",
+	    "name", "count", "mean", "p50", "p90", "p99", "max",
+	    "reqs", "rtts");
+
+	TAILQ_FOREACH(stat, &stats, list) {
+		if (stat->count == 0)
+			continue;
+
+		stats_print(fp,
+		    "%-28s %8llu %7lluus %7lluus %7lluus %7lluus %7lluus "
+		    "%7.1f %7.1f", stat->name,
+		    (unsigned long long)stat->count,
+		    (unsigned long long)(stat->total / stat->count) / 1000,
+		    (unsigned long long)stats_percentile(stat, 0.50) / 1000,
+		    (unsigned long long)stats_percentile(stat, 0.90) / 1000,
+		    (unsigned long long)stats_percentile(stat, 0.99) / 1000,
+		    (unsigned long long)stat->max / 1000,
+		    (double)stat->requests / stat->count,
+		    (double)stat->roundtrips / stat->count);
+	}
+
+	stats_print(fp, "total round trips: %llu",
+	    (unsigned long long)roundtrips);
+}
+
+void
+coma_stats_cleanup(void)
+{
+	struct coma_stat	*stat;
+
+	while ((stat = TAILQ_FIRST(&stats)) != NULL) {
+		TAILQ_REMOVE(&stats, stat, list);
+		free(stat->name);
+		free(stat);
+	}
+}
+
+u_int64_t
+coma_stats_now(void)
+{
+	struct timespec		ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (((u_int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec);
+}
+
+static size_t
+stats_bucket(u_int64_t value)
+{
+	size_t		idx;
+	int		msb;
+
+	if (value < STATS_SUB_BUCKETS)
+		return (value);
+
+	for (msb = STATS_SUB_BITS; msb < 63; msb++) {
+		if ((value >> (msb + 1)) == 0)
+			break;
+	}
+
+	idx = (msb - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS;
+	idx += (value >> (msb - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1);
+
+	if (idx >= STATS_BUCKETS)
+		idx = STATS_BUCKETS - 1;
+
+	return (idx);
+}
+
+static u_int64_t
+stats_bucket_value(size_t idx)
+{
+	int		msb;
+	u_int64_t	sub;
+
+	if (idx < STATS_SUB_BUCKETS)
+		return (idx);
+
+	msb = (idx / STATS_SUB_BUCKETS) + STATS_SUB_BITS - 1;
+	sub = idx % STATS_SUB_BUCKETS;
+
+	return ((STATS_SUB_BUCKETS + sub) << (msb - STATS_SUB_BITS));
+}
+
+static u_int64_t
+stats_percentile(struct coma_stat *stat, double pct)
+{
+	size_t		idx;
+	u_int64_t	seen, target;
+
+	seen = 0;
+	target = (u_int64_t)(stat->count * pct);
+
+	for (idx = 0; idx < STATS_BUCKETS; idx++) {
+		seen += stat->buckets[idx];
+		if (seen > target)
+			return (stats_bucket_value(idx));
+	}
+
+	return (stat->max);
+}
+
+static void
+stats_print(FILE *fp, const char *fmt, ...)
+{
+	va_list		args;
+	char		buf[256];
+
+	va_start(args, fmt);
+
+	if (fp != NULL) {
+		vfprintf(fp, fmt, args);
+		fprintf(fp, "\n");
+	} else {
+		(void)vsnprintf(buf, sizeof(buf), fmt, args);
+		coma_log("%s", buf);
+	}
+
+	va_end(args);
+}
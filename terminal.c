@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Terminal profiles describe how to talk to a terminal emulator:
+ * which flags it uses for hold, title, exec and working directory and
+ * optionally which server it needs running so that new windows only
+ * cost a small client process (urxvtc, footclient).
+ *
+ * A flag ending in '=' is joined with its value into a single argument.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "coma.h"
+
+/* Do not restart a terminal server that keeps dying more than this. */
+#define TERMINAL_DAEMON_BACKOFF		5
+
+struct terminal_profile {
+	char				*name;
+	char				*client;
+	char				*daemon;
+	char				*hold;
+	char				*nohold;
+	char				*title;
+	char				*exec;
+	char				*cwd;
+	LIST_ENTRY(terminal_profile)	list;
+};
+
+static void	terminal_daemon_start(void);
+static void	terminal_daemon_started(pid_t, int, void *);
+static int	terminal_flag(char **, size_t, int *, char **, size_t *,
+		    char *, const char *);
+
+static struct terminal_profile	*terminal_profile_get(const char *);
+static char			**terminal_profile_field(
+				    struct terminal_profile *, const char *);
+
+static struct {
+	const char	*name;
+	const char	*key;
+	const char	*value;
+} builtins[] = {
+	{ "xterm",	"client",	"xterm" },
+	{ "xterm",	"hold",		"-hold" },
+	{ "xterm",	"nohold",	"+hold" },
+	{ "xterm",	"title",	"-T" },
+	{ "xterm",	"exec",		"-e" },
+
+	{ "urxvt",	"client",	"urxvtc" },
+	{ "urxvt",	"daemon",	"urxvtd -q" },
+	{ "urxvt",	"hold",		"-hold" },
+	{ "urxvt",	"nohold",	"+hold" },
+	{ "urxvt",	"title",	"-title" },
+	{ "urxvt",	"exec",		"-e" },
+	{ "urxvt",	"cwd",		"-cd" },
+
+	{ "foot",	"client",	"footclient" },
+	{ "foot",	"daemon",	"foot --server" },
+	{ "foot",	"hold",		"--hold" },
+	{ "foot",	"title",	"--title=" },
+	{ "foot",	"cwd",		"--working-directory=" },
+
+	{ NULL, NULL, NULL }
+};
+
+static LIST_HEAD(, terminal_profile)	profiles;
+static pid_t				daemon_pid = -1;
+static char				*daemon_cmd = NULL;
+static time_t				daemon_last = 0;
+
+void
+coma_terminal_init(void)
+{
+	int		i;
+
+	LIST_INIT(&profiles);
+
+	for (i = 0; builtins[i].name != NULL; i++) {
+		if (coma_terminal_profile(builtins[i].name,
+		    builtins[i].key, builtins[i].value) == -1)
+			fatal("bad builtin terminal profile");
+	}
+}
+
+/*
+ * Start the terminal server for the configured profile, if it has one.
+ * Also called when the terminal or its profile changed, a server that
+ * is no longer the one the profile asks for is stopped first.
+ */
+void
+coma_terminal_setup(void)
+{
+	struct terminal_profile		*prof;
+	const char			*cmd;
+
+	cmd = NULL;
+	if ((prof = terminal_profile_get(terminal)) != NULL)
+		cmd = prof->daemon;
+
+	if (daemon_pid != -1 && cmd != NULL && daemon_cmd != NULL &&
+	    !strcmp(cmd, daemon_cmd))
+		return;
+
+	if (daemon_pid != -1) {
+		coma_log("stopping terminal server %d", daemon_pid);
+		(void)kill(daemon_pid, SIGTERM);
+		daemon_pid = -1;
+	}
+
+	if (cmd != NULL)
+		terminal_daemon_start();
+}
+
+void
+coma_terminal_cleanup(void)
+{
+	struct terminal_profile		*prof;
+
+	while ((prof = LIST_FIRST(&profiles)) != NULL) {
+		LIST_REMOVE(prof, list);
+		free(prof->name);
+		free(prof->client);
+		free(prof->daemon);
+		free(prof->hold);
+		free(prof->nohold);
+		free(prof->title);
+		free(prof->exec);
+		free(prof->cwd);
+		free(prof);
+	}
+}
+
+/*
+ * Set key to value in the named profile, a value of "none" clears it.
+ * Returns -1 if the key is unknown.
+ */
+int
+coma_terminal_profile(const char *name, const char *key, const char *value)
+{
+	char				**field;
+	struct terminal_profile		*prof;
+
+	if (!coma_terminal_profile_key(key))
+		return (-1);
+
+	if ((prof = terminal_profile_get(name)) == NULL) {
+		prof = coma_calloc(1, sizeof(*prof));
+		if ((prof->name = strdup(name)) == NULL)
+			fatal("strdup");
+		LIST_INSERT_HEAD(&profiles, prof, list);
+	}
+
+	field = terminal_profile_field(prof, key);
+
+	free(*field);
+	*field = NULL;
+
+	if (strcmp(value, "none")) {
+		if ((*field = strdup(value)) == NULL)
+			fatal("strdup");
+	}
+
+	return (0);
+}
+
+/* Returns 1 if key is something a profile can set. */
+int
+coma_terminal_profile_key(const char *key)
+{
+	struct terminal_profile		prof;
+
+	return (terminal_profile_field(&prof, key) != NULL);
+}
+
+/* Returns 1 if the configured terminal runs as a client of a server. */
+int
+coma_terminal_daemon(void)
+{
+	struct terminal_profile		*prof;
+
+	if ((prof = terminal_profile_get(terminal)) == NULL)
+		return (0);
+
+	return (prof->daemon != NULL);
+}
+
+/*
+ * Build the argument vector that opens a new terminal window.
+ *
+ * hold is 1 or 0 to select the hold or nohold flag, -1 to use neither.
+ * If exec is set the command for the terminal is expected to follow.
+ * Joined arguments are stored in buf. Returns the number of arguments
+ * or -1 if they do not fit.
+ */
+int
+coma_terminal_argv(char **argv, size_t elm, char *buf, size_t len,
+    int hold, const char *title, const char *cwd, int exec)
+{
+	int				argc;
+	struct terminal_profile		*prof;
+
+	argc = 0;
+
+	/* Not a profile, treat it as an xterm compatible binary. */
+	if ((prof = terminal_profile_get(terminal)) == NULL) {
+		if ((prof = terminal_profile_get("xterm")) == NULL)
+			fatal("no xterm terminal profile");
+		if (terminal_flag(argv, elm, &argc, &buf, &len,
+		    terminal, NULL) == -1)
+			return (-1);
+	} else {
+		if (prof->client == NULL) {
+			coma_log("terminal profile '%s' has no client",
+			    prof->name);
+			return (-1);
+		}
+
+		if (terminal_flag(argv, elm, &argc, &buf, &len,
+		    prof->client, NULL) == -1)
+			return (-1);
+	}
+
+	if (hold == 1 && prof->hold != NULL) {
+		if (terminal_flag(argv, elm, &argc, &buf, &len,
+		    prof->hold, NULL) == -1)
+			return (-1);
+	}
+
+	if (hold == 0 && prof->nohold != NULL) {
+		if (terminal_flag(argv, elm, &argc, &buf, &len,
+		    prof->nohold, NULL) == -1)
+			return (-1);
+	}
+
+	if (title != NULL && prof->title != NULL) {
+		if (terminal_flag(argv, elm, &argc, &buf, &len,
+		    prof->title, title) == -1)
+			return (-1);
+	}
+
+	if (cwd != NULL && prof->cwd != NULL) {
+		if (terminal_flag(argv, elm, &argc, &buf, &len,
+		    prof->cwd, cwd) == -1)
+			return (-1);
+	}
+
+	if (exec && prof->exec != NULL) {
+		if (terminal_flag(argv, elm, &argc, &buf, &len,
+		    prof->exec, NULL) == -1)
+			return (-1);
+	}
+
+	if ((size_t)argc >= elm)
+		return (-1);
+
+	argv[argc] = NULL;
+
+	return (argc);
+}
+
+void
+coma_terminal_exited(pid_t pid)
+{
+	if (pid != daemon_pid)
+		return;
+
+	daemon_pid = -1;
+
+	if (time(NULL) - daemon_last < TERMINAL_DAEMON_BACKOFF) {
+		coma_log("terminal server keeps exiting, not restarting it");
+		return;
+	}
+
+	coma_log("terminal server went away, restarting it");
+	terminal_daemon_start();
+}
+
+static void
+terminal_daemon_start(void)
+{
+	struct terminal_profile		*prof;
+	char				*copy, *argv[COMA_SHELL_ARGV];
+
+	if ((prof = terminal_profile_get(terminal)) == NULL ||
+	    prof->daemon == NULL)
+		return;
+
+	if ((copy = strdup(prof->daemon)) == NULL)
+		fatal("strdup");
+
+	free(daemon_cmd);
+	if ((daemon_cmd = strdup(prof->daemon)) == NULL)
+		fatal("strdup");
+
+	if (coma_split_string(copy, " ", argv, COMA_SHELL_ARGV) > 0) {
+		daemon_last = time(NULL);
+		(void)coma_spawn_request(argv, homedir, NULL,
+		    terminal_daemon_started, NULL);
+	}
+
+	free(copy);
+}
+
+static void
+terminal_daemon_started(pid_t pid, int err, void *arg)
+{
+	if (pid == -1) {
+		coma_log("failed to start terminal server: %s", strerror(err));
+		return;
+	}
+
+	daemon_pid = pid;
+	coma_spawn_forget(pid);
+}
+
+static int
+terminal_flag(char **argv, size_t elm, int *argc, char **buf, size_t *len,
+    char *flag, const char *value)
+{
+	int		ret;
+	size_t		flen;
+
+	/* Room for this flag, its value and the terminating NULL. */
+	if ((size_t)*argc + 3 > elm)
+		return (-1);
+
+	argv[(*argc)++] = flag;
+
+	if (value == NULL)
+		return (0);
+
+	flen = strlen(flag);
+
+	if (flen > 0 && flag[flen - 1] == '=') {
+		ret = snprintf(*buf, *len, "%s%s", flag, value);
+		(*argc)--;
+	} else {
+		ret = snprintf(*buf, *len, "%s", value);
+	}
+
+	if (ret == -1 || (size_t)ret >= *len)
+		return (-1);
+
+	argv[(*argc)++] = *buf;
+
+	*buf += ret + 1;
+	*len -= ret + 1;
+
+	return (0);
+}
+
+static struct terminal_profile *
+terminal_profile_get(const char *name)
+{
+	struct terminal_profile		*prof;
+
+	LIST_FOREACH(prof, &profiles, list) {
+		if (!strcmp(prof->name, name))
+			return (prof);
+	}
+
+	return (NULL);
+}
+
+static char **
+terminal_profile_field(struct terminal_profile *prof, const char *key)
+{
+	if (!strcmp(key, "client"))
+		return (&prof->client);
+	if (!strcmp(key, "daemon"))
+		return (&prof->daemon);
+	if (!strcmp(key, "hold"))
+		return (&prof->hold);
+	if (!strcmp(key, "nohold"))
+		return (&prof->nohold);
+	if (!strcmp(key, "title"))
+		return (&prof->title);
+	if (!strcmp(key, "exec"))
+		return (&prof->exec);
+	if (!strcmp(key, "cwd"))
+		return (&prof->cwd);
+
+	return (NULL);
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Checks for the layout compiler and coma_layout_eval(), no X needed.
+ */
+
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../layout.h"
+
+#define CHECK(x)							\
+	do {								\
+		if (!(x)) {						\
+			printf("%s:%d: %s\n", __FILE__, __LINE__, #x);	\
+			failed++;					\
+		}							\
+	} while (0)
+
+static int	define(const char *, const char *);
+static int	eval(const char *, const struct coma_layout_env *,
+		    struct coma_layout_geom *);
+static int	rect(const struct coma_layout_rect *,
+		    u_int16_t, u_int16_t, u_int16_t, u_int16_t);
+
+static int	failed = 0;
+
+int
+main(void)
+{
+	struct coma_layout_env	env;
+	struct coma_layout_geom	geom;
+	char			err[128];
+
+	CHECK(coma_layout_init(err, sizeof(err)) == 0);
+	CHECK(coma_layout_builtin("default"));
+	CHECK(!coma_layout_builtin("editor"));
+
+	env.screen_width = 1000;
+	env.screen_height = 500;
+	env.gap = 10;
+	env.bar = 20;
+	env.border = 2;
+	env.width = 300;
+	env.height = 0;
+	env.offset = -1;
+	env.count = -1;
+
+	/* One column over the whole width. */
+	CHECK(eval("full", &env, &geom) == 0);
+	CHECK(geom.count == 1);
+	CHECK(geom.y_offset == 10 && geom.height == 456);
+	CHECK(rect(&geom.frames[0], 10, 10, 976, 456));
+	CHECK(rect(&geom.popup, 10, 10, 976, 456));
+
+	/* Fixed, weighted and the rounding going to the last one. */
+	CHECK(define("editor", "100 2* * gap=4") == 0);
+	CHECK(eval("editor", &env, &geom) == 0);
+	CHECK(geom.count == 3);
+	CHECK(rect(&geom.frames[0], 10, 10, 100, 456));
+	CHECK(rect(&geom.frames[1], 118, 10, 574, 456));
+	CHECK(rect(&geom.frames[2], 700, 10, 286, 456));
+	CHECK(geom.zoom_width == 976);
+
+	/* As many frame-width columns as fit, centered. */
+	CHECK(eval("default", &env, &geom) == 0);
+	CHECK(geom.count == 3);
+	CHECK(rect(&geom.frames[0], 40, 10, 300, 456));
+	CHECK(rect(&geom.frames[1], 354, 10, 300, 456));
+	CHECK(rect(&geom.frames[2], 668, 10, 300, 456));
+	CHECK(geom.zoom_width == 928);
+
+	env.count = 2;
+	CHECK(eval("default", &env, &geom) == 0);
+	CHECK(geom.count == 2);
+	CHECK(geom.frames[0].x == 190);
+	env.count = -1;
+
+	/* A fixed height is centered above the bar. */
+	env.height = 300;
+	CHECK(eval("full", &env, &geom) == 0);
+	CHECK(geom.y_offset == 88 && geom.height == 300);
+	env.height = 0;
+
+	/* Too wide for the screen. */
+	CHECK(define("wide", "frame frame frame frame") == 0);
+	CHECK(eval("wide", &env, &geom) == -1);
+
+	/* Redefining keeps the place of the old one. */
+	CHECK(define("editor", "*") == 0);
+	CHECK(coma_layout_lookup("editor") != NULL);
+	CHECK(coma_layout_nth(4) == coma_layout_lookup("editor"));
+
+	CHECK(define("bad", "fill 100") == -1);
+	CHECK(define("bad", "0") == -1);
+	CHECK(define("bad", "x*") == -1);
+	CHECK(define("bad", "gap=x *") == -1);
+	CHECK(define("bad", "popup=full") == -1);
+	CHECK(coma_layout_lookup("bad") == NULL);
+
+	coma_layout_cleanup();
+
+	if (failed) {
+		printf("layout: %d failed\n", failed);
+		return (1);
+	}
+
+	printf("layout: ok\n");
+
+	return (0);
+}
+
+static int
+define(const char *name, const char *spec)
+{
+	int		argc, ret;
+	char		*copy, *p, *argv[COMA_LAYOUT_COLUMNS + 2], err[128];
+
+	if ((copy = strdup(spec)) == NULL)
+		exit(1);
+
+	argc = 0;
+	p = copy;
+	while (argc < COMA_LAYOUT_COLUMNS + 1 &&
+	    (argv[argc] = strsep(&p, " ")) != NULL)
+		argc++;
+
+	ret = coma_layout_define(name, argc, argv, err, sizeof(err));
+	free(copy);
+
+	return (ret);
+}
+
+static int
+eval(const char *name, const struct coma_layout_env *env,
+    struct coma_layout_geom *geom)
+{
+	struct coma_layout	*layout;
+
+	if ((layout = coma_layout_lookup(name)) == NULL)
+		return (-2);
+
+	return (coma_layout_eval(layout, env, geom));
+}
+
+static int
+rect(const struct coma_layout_rect *r, u_int16_t x, u_int16_t y,
+    u_int16_t w, u_int16_t h)
+{
+	return (r->x == x && r->y == y && r->w == w && r->h == h);
+}
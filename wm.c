@@ -14,6 +14,7 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/param.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
@@ -21,7 +22,10 @@
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/XKBlib.h>
+#include <X11/extensions/Xrandr.h>
 
+#include <ctype.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,18 +37,49 @@
 
 #include "coma.h"
 
+/* What wm_input() asks of its completion callback. */
+#define WM_INPUT_UPDATE		0
+#define WM_INPUT_TAB		1
+#define WM_INPUT_PREV		2
+#define WM_INPUT_NEXT		3
+
+/* History suggestions kept for recall, and how many are shown. */
+#define WM_RECALL_MAX		16
+#define WM_RECALL_SHOW		4
+
+/* Rows of clients that fit in the client finder. */
+#define WM_CLIENT_ROWS		24
+
+struct wm_match {
+	struct client		*client;
+	int			score;
+	u_int32_t		order;
+};
+
 static void	wm_run(void);
 static void	wm_command(void);
 static void	wm_restart(void);
 static void	wm_teardown(void);
 static void	wm_screen_init(void);
+static void	wm_screen_outputs(void);
+static void	wm_screen_windows(void);
 static void	wm_client_list(void);
+static void	wm_client_draw(struct wm_match *, size_t, const char *,
+		    size_t, size_t);
+static size_t	wm_client_filter(struct wm_match *, size_t, const char *,
+		    int);
+static int	wm_client_cmp(const void *, const void *);
+static int	wm_pick(void);
 static void	wm_layout_swap(void);
+static void	wm_workspace_select(void);
 static void	wm_query_atoms(void);
+static size_t	wm_io_prepare(void);
 static Atom	wm_atom(const char *);
 static void	wm_run_command(char *, int);
 static void	wm_run_shell_command(char *);
-static int	wm_input(char *, size_t, void (*autocomplete)(char *, size_t));
+static int	wm_input(char *, size_t, void (*)(char *, size_t, int));
+static void	wm_run_complete(char *, size_t, int);
+static const char	*wm_run_host(void);
 
 static void	wm_client_check(Window);
 static void	wm_handle_prefix(XKeyEvent *);
@@ -54,6 +89,9 @@ static void	wm_mouse_motion(XMotionEvent *);
 static void	wm_window_map(XMapRequestEvent *);
 static void	wm_window_destroy(XDestroyWindowEvent *);
 static void	wm_window_configure(XConfigureRequestEvent *);
+static void	wm_configure_flush(void);
+static void	wm_window_property(XPropertyEvent *);
+static void	wm_key_wait(XEvent *);
 
 static int	wm_error(Display *, XErrorEvent *);
 static int	wm_error_active(Display *, XErrorEvent *);
@@ -69,6 +107,8 @@ Atom		atom_client_pos = None;
 Atom		atom_client_act = None;
 Atom		atom_net_wm_pid = None;
 Atom		atom_client_visible = None;
+Atom		atom_client_workspace = None;
+Atom		atom_client_status = None;
 
 char		*font_name = NULL;
 unsigned int	prefix_mod = COMA_MOD_KEY;
@@ -80,6 +120,38 @@ static Window	clients_win = None;
 
 static XftDraw	*cmd_xft = NULL;
 static XftDraw	*clients_xft = NULL;
+static char	cmd_hint[512];
+
+static char	*recall[WM_RECALL_MAX];
+static size_t	recall_count = 0;
+static int	recall_idx = -1;
+static char	recall_buf[8192];
+static char	recall_typed[2048];
+
+static struct coma_stat	*event_stats[LASTEvent];
+
+static LIST_HEAD(, coma_io)	ios = LIST_HEAD_INITIALIZER(ios);
+static size_t			io_size = 0;
+static size_t			io_count = 0;
+static struct pollfd		*io_pfd = NULL;
+static struct coma_io		**io_list = NULL;
+static int			batching = 0;
+
+/* ConfigureRequests for clients, answered once the queue is drained. */
+struct wm_configure {
+	Window		window;
+	int		border;
+	u_int32_t	requests;
+};
+
+static struct wm_configure	*configures = NULL;
+static size_t			configure_count = 0;
+static size_t			configure_size = 0;
+static struct coma_stat		*configure_reply = NULL;
+static struct coma_stat		*configure_merged = NULL;
+
+static int			randr_event = -1;
+static u_int16_t		screen_height_max = 0;
 
 struct {
 	const char	*name;
@@ -97,6 +169,7 @@ struct {
 	{ "command-input",		"#ffffff",	0,	{ 0 }},
 	{ "command-bar",		"#080808",	0,	{ 0 }},
 	{ "command-border",		"#000000",	0,	{ 0 }},
+	{ "command-hint",		"#808080",	0,	{ 0 }},
 	{ NULL,				NULL,		0,	{ 0 }},
 };
 
@@ -105,22 +178,30 @@ struct uaction {
 	char			*action;
 	int			hold;
 	int			shell;
+	struct coma_stat	*stat;
 	LIST_ENTRY(uaction)	list;
 };
 
 static LIST_HEAD(, uaction)	uactions;
 
 struct {
-	const char	*name;
-	KeySym		sym;
-	void		(*cb)(void);
+	const char		*name;
+	KeySym			sym;
+	void			(*cb)(void);
+	struct coma_stat	*stat;
+	KeySym			def;
 } actions[] = {
 	{ "frame-prev",		XK_h,		coma_frame_prev },
 	{ "frame-next",		XK_l,		coma_frame_next },
+	{ "frame-up",		XK_K,		coma_frame_up },
+	{ "frame-down",		XK_J,		coma_frame_down },
 	{ "frame-popup",	XK_space,	coma_frame_popup_toggle },
 
 	{ "frame-zoom",		XK_z,	coma_frame_zoom },
 	{ "frame-split",	XK_s,	coma_frame_split },
+	{ "frame-vsplit",	XK_v,	coma_frame_vsplit },
+	{ "frame-grow",		XK_equal,	coma_frame_grow },
+	{ "frame-shrink",	XK_minus,	coma_frame_shrink },
 	{ "frame-merge",	XK_m,	coma_frame_merge },
 	{ "frame-split-next",	XK_f,	coma_frame_split_next },
 	{ "frame-layout-swap",	XK_w,	wm_layout_swap },
@@ -134,6 +215,12 @@ struct {
 	{ "client-kill",		XK_k,	coma_client_kill_active },
 	{ "client-prev",		XK_p,	coma_frame_client_prev },
 	{ "client-next",		XK_n,	coma_frame_client_next },
+	{ "client-last",		XK_t,	coma_client_last },
+	{ "client-mru",			XK_Tab,	coma_client_mru_next },
+
+	{ "workspace-next",		XK_period,	coma_workspace_next },
+	{ "workspace-prev",		XK_comma,	coma_workspace_prev },
+	{ "workspace-select",		XK_g,		wm_workspace_select },
 
 	{ "coma-run",			XK_e,		wm_run },
 	{ "coma-command",		XK_colon,	wm_command },
@@ -145,13 +232,34 @@ struct {
 void
 coma_wm_init(void)
 {
+	int		i;
+
 	if ((dpy = XOpenDisplay(NULL)) == NULL)
 		fatal("failed to open display");
 
+	coma_fd_cloexec(ConnectionNumber(dpy));
+
 	if ((font_name = strdup(COMA_WM_FONT)) == NULL)
 		fatal("strdup");
 
 	LIST_INIT(&uactions);
+
+	for (i = 0; actions[i].name != NULL; i++) {
+		actions[i].def = actions[i].sym;
+		actions[i].stat = coma_stats_create(actions[i].name);
+	}
+
+	event_stats[ButtonRelease] = coma_stats_create("event:ButtonRelease");
+	event_stats[MotionNotify] = coma_stats_create("event:MotionNotify");
+	event_stats[DestroyNotify] = coma_stats_create("event:DestroyNotify");
+	event_stats[ConfigureRequest] =
+	    coma_stats_create("event:ConfigureRequest");
+	event_stats[MapRequest] = coma_stats_create("event:MapRequest");
+	event_stats[KeyPress] = coma_stats_create("event:KeyPress");
+	event_stats[PropertyNotify] = coma_stats_create("event:PropertyNotify");
+
+	configure_reply = coma_stats_create("configure:reply");
+	configure_merged = coma_stats_create("configure:merged");
 }
 
 void
@@ -171,8 +279,10 @@ void
 coma_wm_run(void)
 {
 	XEvent			evt;
-	struct pollfd		pfd[1];
-	int			running, ret;
+	struct coma_sample	sample;
+	struct coma_io		*io;
+	size_t			idx, count;
+	int			running, ret, timeout;
 
 	running = 1;
 	restart = 0;
@@ -191,29 +301,46 @@ coma_wm_run(void)
 			case SIGCHLD:
 				coma_reap();
 				break;
+			case SIGUSR1:
+				coma_stats_dump(NULL);
+				break;
 			default:
 				break;
 			}
 			sig_recv = -1;
 		}
 
-		pfd[0].fd = ConnectionNumber(dpy);
-		pfd[0].events = POLLIN;
+		count = wm_io_prepare();
+
+		timeout = coma_client_titles_timeout();
+		if (timeout == -1 || timeout > 500)
+			timeout = 500;
 
-		ret = poll(pfd, 1, 500);
+		ret = poll(io_pfd, count, timeout);
 		if (ret == -1) {
 			if (errno == EINTR)
 				continue;
 			fatal("poll: %s", errno_s);
 		}
 
-		coma_frame_update_titles();
+		for (idx = 1; ret > 0 && idx < count; idx++) {
+			if ((io = io_list[idx]) == NULL)
+				continue;
+			if (io_pfd[idx].revents != 0)
+				io->cb(io, io_pfd[idx].revents);
+		}
 
-		if (ret == 0 || !(pfd[0].revents & POLLIN))
-			continue;
+		coma_client_titles_flush();
+		coma_remote_expire();
 
+		/*
+		 * Always drain the Xlib queue, round trips made by the
+		 * titles update or io handlers may have queued events
+		 * without the connection being readable anymore.
+		 */
 		while (XPending(dpy)) {
 			XNextEvent(dpy, &evt);
+			coma_stats_begin(&sample);
 
 			switch (evt.type) {
 			case ButtonRelease:
@@ -234,16 +361,100 @@ coma_wm_run(void)
 			case KeyPress:
 				wm_handle_prefix(&evt.xkey);
 				break;
+			case PropertyNotify:
+				wm_window_property(&evt.xproperty);
+				break;
+			default:
+				if (randr_event != -1 && evt.type ==
+				    randr_event + RRScreenChangeNotify) {
+					(void)XRRUpdateConfiguration(&evt);
+					wm_screen_outputs();
+					wm_screen_windows();
+				}
+				break;
 			}
 
-			XSync(dpy, False);
+			coma_wm_sync(False);
+
+			if (evt.type < LASTEvent &&
+			    event_stats[evt.type] != NULL)
+				coma_stats_end(event_stats[evt.type], &sample);
 		}
 
+		wm_configure_flush();
+
+		coma_ewmh_flush();
 	}
 
 	wm_teardown();
 }
 
+void
+coma_wm_io_register(struct coma_io *io)
+{
+	LIST_INSERT_HEAD(&ios, io, list);
+	io_count++;
+}
+
+void
+coma_wm_io_unregister(struct coma_io *io)
+{
+	size_t		idx;
+
+	LIST_REMOVE(io, list);
+	io_count--;
+
+	/* We could be called from within an io callback. */
+	for (idx = 0; idx < io_size; idx++) {
+		if (io_list[idx] == io)
+			io_list[idx] = NULL;
+	}
+}
+
+void
+coma_wm_batch_begin(void)
+{
+	batching++;
+}
+
+void
+coma_wm_batch_end(void)
+{
+	if (batching == 0)
+		fatal("coma_wm_batch_end: not batching");
+
+	if (--batching == 0)
+		coma_wm_sync(False);
+}
+
+void
+coma_wm_sync(int discard)
+{
+	if (batching)
+		return;
+
+	XSync(dpy, discard);
+	coma_stats_roundtrip();
+}
+
+int
+coma_wm_action(const char *name)
+{
+	int			i;
+	struct coma_sample	sample;
+
+	for (i = 0; actions[i].name != NULL; i++) {
+		if (!strcmp(actions[i].name, name)) {
+			coma_stats_begin(&sample);
+			actions[i].cb();
+			coma_stats_end(actions[i].stat, &sample);
+			return (0);
+		}
+	}
+
+	return (-1);
+}
+
 XftColor *
 coma_wm_color(const char *name)
 {
@@ -268,6 +479,114 @@ coma_wm_register_prefix(Window win)
 	XGrabKey(dpy, c, prefix_mod, win, True, GrabModeAsync, GrabModeAsync);
 }
 
+/* Reopen the font after font_name changed. */
+void
+coma_wm_font_reload(void)
+{
+	XftFont		*next;
+
+	if ((next = XftFontOpenName(dpy,
+	    DefaultScreen(dpy), font_name)) == NULL) {
+		coma_log("failed to open %s, keeping the old font", font_name);
+		return;
+	}
+
+	XftFontClose(dpy, font);
+	font = next;
+
+	coma_frame_bars_update();
+}
+
+/* Grab the new prefix key on the root and all client windows. */
+void
+coma_wm_prefix_reload(void)
+{
+	struct client	*client;
+
+	coma_wm_register_prefix(DefaultRootWindow(dpy));
+
+	TAILQ_FOREACH(client, &clients, glist)
+		coma_wm_register_prefix(client->window);
+}
+
+/* Redraw everything that uses the colors once they changed. */
+void
+coma_wm_colors_reload(void)
+{
+	XftColor	*color, *bg, *border;
+	struct client	*client;
+
+	TAILQ_FOREACH(client, &clients, glist) {
+		if (client == client_active)
+			color = coma_wm_color("client-active");
+		else
+			color = coma_wm_color("client-inactive");
+		XSetWindowBorder(dpy, client->window, color->pixel);
+	}
+
+	bg = coma_wm_color("command-bar");
+	border = coma_wm_color("command-border");
+
+	XSetWindowBorder(dpy, cmd_input, border->pixel);
+	XSetWindowBackground(dpy, cmd_input, bg->pixel);
+	XSetWindowBorder(dpy, clients_win, border->pixel);
+	XSetWindowBackground(dpy, clients_win, bg->pixel);
+
+	coma_frame_bars_update();
+}
+
+/* Forget all bindings, actions get their default keys back. */
+void
+coma_wm_actions_reset(void)
+{
+	int		i;
+	struct uaction	*ua;
+
+	while ((ua = LIST_FIRST(&uactions)) != NULL) {
+		LIST_REMOVE(ua, list);
+		free(ua->action);
+		free(ua);
+	}
+
+	for (i = 0; actions[i].name != NULL; i++)
+		actions[i].sym = actions[i].def;
+}
+
+/* Returns 1 if action can be bound to a key. */
+int
+coma_wm_action_valid(const char *action)
+{
+	int		i;
+
+	if (!strncmp(COMA_ACTION_PREFIX, action, COMA_ACTION_PREFIX_LEN) ||
+	    !strncmp(COMA_ACTION_NOHOLD_PREFIX,
+	    action, COMA_ACTION_NOHOLD_PREFIX_LEN) ||
+	    !strncmp(COMA_ACTION_SHELL_PREFIX,
+	    action, COMA_ACTION_SHELL_PREFIX_LEN))
+		return (1);
+
+	for (i = 0; actions[i].name != NULL; i++) {
+		if (!strcmp(actions[i].name, action))
+			return (1);
+	}
+
+	return (0);
+}
+
+/* Returns 1 if name is a color that can be configured. */
+int
+coma_wm_color_valid(const char *name)
+{
+	int		i;
+
+	for (i = 0; xft_colors[i].name != NULL; i++) {
+		if (!strcmp(name, xft_colors[i].name))
+			return (1);
+	}
+
+	return (0);
+}
+
 int
 coma_wm_register_action(const char *action, KeySym sym)
 {
@@ -278,6 +597,7 @@ coma_wm_register_action(const char *action, KeySym sym)
 		ua = coma_calloc(1, sizeof(*ua));
 		ua->sym = sym;
 		ua->hold = 1;
+		ua->stat = coma_stats_create(action);
 		ua->action = strdup(action + COMA_ACTION_PREFIX_LEN);
 		if (ua->action == NULL)
 			fatal("strdup");
@@ -289,6 +609,7 @@ coma_wm_register_action(const char *action, KeySym sym)
 	    action, COMA_ACTION_NOHOLD_PREFIX_LEN)) {
 		ua = coma_calloc(1, sizeof(*ua));
 		ua->sym = sym;
+		ua->stat = coma_stats_create(action);
 		ua->action = strdup(action + COMA_ACTION_NOHOLD_PREFIX_LEN);
 		if (ua->action == NULL)
 			fatal("strdup");
@@ -301,6 +622,7 @@ coma_wm_register_action(const char *action, KeySym sym)
 		ua = coma_calloc(1, sizeof(*ua));
 		ua->sym = sym;
 		ua->shell = 1;
+		ua->stat = coma_stats_create(action);
 		ua->action = strdup(action + COMA_ACTION_SHELL_PREFIX_LEN);
 		if (ua->action == NULL)
 			fatal("strdup");
@@ -333,6 +655,10 @@ coma_wm_register_color(const char *name, const char *rgb)
 	if (xft_colors[i].name == NULL)
 		return (-1);
 
+	/* No rgb means back to the default. */
+	if (rgb == NULL)
+		rgb = xft_colors[i].rgb;
+
 	screen = DefaultScreen(dpy);
 	visual = DefaultVisual(dpy, screen);
 	colormap = DefaultColormap(dpy, screen);
@@ -366,6 +692,7 @@ coma_wm_property_read(Window win, Atom prop, u_int32_t *val)
 
 	ret = XGetWindowProperty(dpy, win, prop, 0, 32, False, AnyPropertyType,
 	    &type, &format, &nitems, &bytes, &data);
+	coma_stats_roundtrip();
 
 	if (ret != Success) {
 		coma_log("! prop=0x%08x win=0x%08x bad prop", prop, win);
@@ -390,6 +717,37 @@ coma_wm_property_read(Window win, Atom prop, u_int32_t *val)
 	return (0);
 }
 
+static size_t
+wm_io_prepare(void)
+{
+	size_t			idx;
+	struct coma_io		*io;
+
+	if (io_size < io_count + 1) {
+		io_size = io_count + 1;
+		free(io_pfd);
+		free(io_list);
+		io_pfd = coma_calloc(io_size, sizeof(*io_pfd));
+		io_list = coma_calloc(io_size, sizeof(*io_list));
+	}
+
+	io_list[0] = NULL;
+	io_pfd[0].fd = ConnectionNumber(dpy);
+	io_pfd[0].events = POLLIN;
+	io_pfd[0].revents = 0;
+
+	idx = 1;
+	LIST_FOREACH(io, &ios, list) {
+		io_list[idx] = io;
+		io_pfd[idx].fd = io->fd;
+		io_pfd[idx].events = io->events;
+		io_pfd[idx].revents = 0;
+		idx++;
+	}
+
+	return (idx);
+}
+
 static void
 wm_restart(void)
 {
@@ -400,15 +758,26 @@ wm_restart(void)
 static void
 wm_teardown(void)
 {
-	struct uaction	*ua;
-
-	while ((ua = LIST_FIRST(&uactions)) != NULL) {
-		LIST_REMOVE(ua, list);
-		free(ua->action);
-		free(ua);
-	}
-
+	coma_wm_actions_reset();
+	coma_config_cleanup();
+
+	free(configures);
+	configures = NULL;
+	configure_count = configure_size = 0;
+
+	coma_pool_cleanup();
+	coma_proc_cleanup();
+	coma_complete_cleanup();
+	coma_history_cleanup();
+	coma_remote_cleanup();
+	coma_terminal_cleanup();
 	coma_frame_cleanup();
+	coma_workspace_cleanup();
+	coma_layout_cleanup();
+	coma_rule_clear();
+	coma_stats_cleanup();
+	coma_control_cleanup();
+	coma_ewmh_cleanup();
 
 	XftFontClose(dpy, font);
 	XftDrawDestroy(cmd_xft);
@@ -428,7 +797,7 @@ static void
 wm_screen_init(void)
 {
 	u_int32_t	id;
-	int		screen;
+	int		screen, randr_error;
 	struct client	*client;
 	Visual		*visual;
 	Colormap	colormap;
@@ -441,10 +810,17 @@ wm_screen_init(void)
 
 	visual = DefaultVisual(dpy, screen);
 	colormap = DefaultColormap(dpy, screen);
-	screen_width = DisplayWidth(dpy, screen);
+	/* A configured screen-height caps every output. */
+	screen_height_max = screen_height;
+
+	if (XRRQueryExtension(dpy, &randr_event, &randr_error)) {
+		XRRSelectInput(dpy, root, RRScreenChangeNotifyMask);
+	} else {
+		coma_log("no RandR, using the whole screen");
+		randr_event = -1;
+	}
 
-	if (screen_height == 0)
-		screen_height = DisplayHeight(dpy, screen);
+	wm_screen_outputs();
 
 	if ((font = XftFontOpenName(dpy, screen, font_name)) == NULL) {
 		coma_log("failed to open %s, falling back to default",
@@ -465,12 +841,15 @@ wm_screen_init(void)
 	    EnterWindowMask | LeaveWindowMask | KeyPressMask |
 	    PointerMotionMask);
 
+	coma_workspace_setup();
 	coma_frame_setup();
 	coma_wm_register_prefix(root);
 	coma_frame_bars_create();
+	coma_ewmh_init();
 
 	client_discovery = 1;
 
+	coma_stats_roundtrip();
 	if (XQueryTree(dpy, root, &wr, &wp, &childwin, &windows)) {
 		for (idx = 0; idx < windows; idx++)
 			wm_client_check(childwin[idx]);
@@ -487,31 +866,26 @@ wm_screen_init(void)
 	bg = coma_wm_color("command-bar");
 	border = coma_wm_color("command-border");
 
-	cmd_input = XCreateSimpleWindow(dpy, root,
-	    (screen_width / 2) - 200, (screen_height / 2) - 50, 400,
+	cmd_input = XCreateSimpleWindow(dpy, root, 0, 0, 400,
 	    COMA_FRAME_BAR, 2, border->pixel, bg->pixel);
 
 	if ((cmd_xft = XftDrawCreate(dpy, cmd_input, visual, colormap)) == NULL)
 		fatal("XftDrawCreate failed");
 
-	if (frame_offset == -1) {
-		clients_win = XCreateSimpleWindow(dpy, root,
-		    (screen_width / 2) - 220, (screen_height / 2) - 205,
-		    400, 400, 2, border->pixel, bg->pixel);
-	} else {
-		clients_win = XCreateSimpleWindow(dpy, root,
-		    frame_offset + ((screen_width - frame_offset) / 2) - 220,
-		    (screen_height / 2) - 205,
-		    400, 400, 2, border->pixel, bg->pixel);
-	}
+	clients_win = XCreateSimpleWindow(dpy, root, 0, 0,
+	    400, 400, 2, border->pixel, bg->pixel);
 
 	if ((clients_xft = XftDrawCreate(dpy,
 	    clients_win, visual, colormap)) == NULL)
 		fatal("XftDrawCreate failed");
 
+	wm_screen_windows();
+
 	if (coma_wm_property_read(root, atom_client_act, &id) == 0) {
 		coma_log("client 0x%08x was active", id);
 		if ((client = coma_client_find(id)) != NULL) {
+			if (client->frame->workspace != workspace_active)
+				coma_workspace_switch(client->frame->workspace);
 			coma_client_focus(client);
 			coma_frame_focus(client->frame, 1);
 			if (client->frame == frame_popup)
@@ -521,7 +895,95 @@ wm_screen_init(void)
 	}
 
 	client_discovery = 0;
-	XSync(dpy, True);
+	coma_wm_sync(True);
+}
+
+/*
+ * Tell the frames what outputs there are, one per active crtc so that
+ * mirrored outputs share their frames. Crtcs showing the same area, as
+ * xrandr --same-as sets up, are merged by coma_frame_output(). The crtc
+ * of the primary output goes first as it holds the popup frame.
+ */
+static void
+wm_screen_outputs(void)
+{
+	int			i, pass, count;
+	RROutput		primary;
+	Window			root;
+	XRRCrtcInfo		*crtc;
+	XRROutputInfo		*info;
+	XRRScreenResources	*res;
+	u_int16_t		height;
+
+	root = DefaultRootWindow(dpy);
+	screen_width = DisplayWidth(dpy, DefaultScreen(dpy));
+	screen_height = DisplayHeight(dpy, DefaultScreen(dpy));
+
+	if (screen_height_max != 0)
+		screen_height = MIN(screen_height, screen_height_max);
+
+	count = 0;
+	coma_frame_outputs_begin();
+
+	if (randr_event != -1 &&
+	    (res = XRRGetScreenResourcesCurrent(dpy, root)) != NULL) {
+		primary = XRRGetOutputPrimary(dpy, root);
+
+		for (pass = 0; pass < 2; pass++) {
+			for (i = 0; i < res->ncrtc; i++) {
+				crtc = XRRGetCrtcInfo(dpy, res, res->crtcs[i]);
+				if (crtc == NULL)
+					continue;
+
+				if (crtc->mode == None || crtc->noutput == 0 ||
+				    (pass == 0) !=
+				    (crtc->outputs[0] == primary)) {
+					XRRFreeCrtcInfo(crtc);
+					continue;
+				}
+
+				info = XRRGetOutputInfo(dpy, res,
+				    crtc->outputs[0]);
+				if (info != NULL) {
+					height = crtc->height;
+					if (screen_height_max != 0)
+						height = MIN(height,
+						    screen_height_max);
+					coma_frame_output(info->name,
+					    crtc->x, crtc->y,
+					    crtc->width, height);
+					XRRFreeOutputInfo(info);
+					count++;
+				}
+
+				XRRFreeCrtcInfo(crtc);
+			}
+		}
+
+		XRRFreeScreenResources(res);
+	}
+
+	if (count == 0)
+		coma_frame_output("screen", 0, 0, screen_width, screen_height);
+
+	coma_frame_outputs_end();
+}
+
+/* Center the command input and client list on the current screen. */
+static void
+wm_screen_windows(void)
+{
+	XMoveWindow(dpy, cmd_input,
+	    (screen_width / 2) - 200, (screen_height / 2) - 50);
+
+	if (frame_offset == -1) {
+		XMoveWindow(dpy, clients_win,
+		    (screen_width / 2) - 220, (screen_height / 2) - 205);
+	} else {
+		XMoveWindow(dpy, clients_win,
+		    frame_offset + ((screen_width - frame_offset) / 2) - 220,
+		    (screen_height / 2) - 205);
+	}
 }
 
 static void
@@ -532,12 +994,17 @@ wm_query_atoms(void)
 	atom_client_pos = wm_atom("_COMA_WM_CLIENT_POS");
 	atom_client_act = wm_atom("_COMA_WM_CLIENT_ACT");
 	atom_client_visible = wm_atom("_COMA_WM_CLIENT_VISIBLE");
+	atom_client_workspace = wm_atom("_COMA_WM_CLIENT_WORKSPACE");
+	atom_client_status = wm_atom("_COMA_WM_STATUS");
 
 	coma_log("_NET_WM_PID Atom = 0x%08x", atom_net_wm_pid);
 	coma_log("_COMA_WM_FRAME_ID Atom = 0x%08x", atom_frame_id);
 	coma_log("_COMA_WM_CLIENT_POS Atom = 0x%08x", atom_client_pos);
 	coma_log("_COMA_WM_CLIENT_ACT Atom = 0x%08x", atom_client_act);
 	coma_log("_COMA_WM_CLIENT_VISIBLE Atom = 0x%08x", atom_client_visible);
+	coma_log("_COMA_WM_CLIENT_WORKSPACE Atom = 0x%08x",
+	    atom_client_workspace);
+	coma_log("_COMA_WM_STATUS Atom = 0x%08x", atom_client_status);
 }
 
 static Atom
@@ -556,12 +1023,91 @@ wm_run(void)
 {
 	char	cmd[2048];
 
-	if (wm_input(cmd, sizeof(cmd), NULL) == -1)
+	if (wm_input(cmd, sizeof(cmd), wm_run_complete) == -1)
 		return;
 
+	coma_history_add(wm_run_host(), cmd);
 	wm_run_command(cmd, 1);
 }
 
+/*
+ * Suggest earlier commands for the host we would run on, best first,
+ * up and down walk through them. After that the program name is
+ * completed from the $PATH index, tab replaces it by the longest
+ * common match, otherwise only the candidates are shown.
+ */
+static void
+wm_run_complete(char *cmd, size_t len, int action)
+{
+	size_t		count, idx;
+	char		common[256], list[512];
+
+	switch (action) {
+	case WM_INPUT_PREV:
+		if (recall_idx + 1 >= (int)recall_count)
+			return;
+		if (recall_idx == -1)
+			(void)strlcpy(recall_typed, cmd, sizeof(recall_typed));
+		(void)strlcpy(cmd, recall[++recall_idx], len);
+		return;
+	case WM_INPUT_NEXT:
+		if (recall_idx == -1)
+			return;
+		recall_idx--;
+		(void)strlcpy(cmd, recall_idx == -1 ?
+		    recall_typed : recall[recall_idx], len);
+		return;
+	}
+
+	/* Keep the list while walking through it, redo it on any edit. */
+	if (recall_idx == -1 || strcmp(cmd, recall[recall_idx])) {
+		recall_idx = -1;
+		recall_count = coma_history_suggest(wm_run_host(), cmd,
+		    recall_buf, sizeof(recall_buf), recall, WM_RECALL_MAX);
+	}
+
+	cmd_hint[0] = '\0';
+
+	for (idx = 0; idx < recall_count && idx < WM_RECALL_SHOW; idx++) {
+		if (idx > 0)
+			(void)strlcat(cmd_hint, "  ", sizeof(cmd_hint));
+		(void)strlcat(cmd_hint, recall[idx], sizeof(cmd_hint));
+	}
+
+	if (cmd[0] == '\0' || strchr(cmd, ' ') != NULL)
+		return;
+
+	count = coma_complete(cmd, common, sizeof(common),
+	    list, sizeof(list));
+
+	if (list[0] != '\0') {
+		if (cmd_hint[0] != '\0')
+			(void)strlcat(cmd_hint, " | ", sizeof(cmd_hint));
+		(void)strlcat(cmd_hint, list, sizeof(cmd_hint));
+	}
+
+	if (action != WM_INPUT_TAB || count == 0)
+		return;
+
+	if (strlen(common) > strlen(cmd))
+		(void)strlcpy(cmd, common, len);
+
+	if (count == 1) {
+		(void)strlcat(cmd, " ", len);
+		cmd_hint[0] = '\0';
+	}
+}
+
+/* The host a command from the run prompt ends up on. */
+static const char *
+wm_run_host(void)
+{
+	if (client_active != NULL && client_active->host != NULL)
+		return (client_active->host);
+
+	return (myhost);
+}
+
 static void
 wm_command(void)
 {
@@ -572,17 +1118,13 @@ wm_command(void)
 
 	if (coma_split_arguments(cmd, argv, 32)) {
 		if (!strcmp(argv[0], "tag") && argv[1] != NULL) {
-			if (client_active == NULL)
-				return;
-
-			free(client_active->tag);
-			if ((client_active->tag = strdup(argv[1])) == NULL)
-				fatal("strdup");
-
-			coma_frame_bar_update(frame_active);
+			if (client_active != NULL)
+				coma_client_tag(client_active, argv[1]);
 		} else if (!strcmp(argv[0], "untag")) {
-			free(client_active->tag);
-			client_active->tag = NULL;
+			if (client_active != NULL)
+				coma_client_tag(client_active, NULL);
+		} else if (!strcmp(argv[0], "stats")) {
+			coma_stats_dump(NULL);
 		}
 	}
 }
@@ -590,52 +1132,60 @@ wm_command(void)
 static void
 wm_run_command(char *cmd, int hold)
 {
-	int	off, title, local;
-	char	*argv[COMA_SHELL_ARGV];
+	int		off, idx, remote;
+	char		*ctl;
+	const char	*pwd, *title;
+	char		*args[COMA_SHELL_ARGV], *argv[COMA_SHELL_ARGV];
+	char		cwd[PATH_MAX], buf[PATH_MAX + 256];
 
-	off = 0;
-	local = 1;
-	title = -1;
+	if (coma_split_arguments(cmd, args, COMA_SHELL_ARGV) == 0)
+		return;
 
-	argv[off++] = terminal;
+	if (!strcmp(args[0], "vi") || !strcmp(args[0], "vim"))
+		hold = 0;
 
-	if (hold)
-		argv[off++] = "-hold";
-	else
-		argv[off++] = "+hold";
+	remote = client_active != NULL && client_active->host != NULL &&
+	    strcmp(myhost, client_active->host);
 
-	if (client_active != NULL && client_active->host != NULL) {
-		if (strcmp(myhost, client_active->host)) {
-			argv[off++] = "-T";
-			title = off;
-			argv[off++] = client_active->host;
-		}
+	if (remote) {
+		pwd = NULL;
+		title = args[0];
+	} else {
+		title = NULL;
+		pwd = coma_execute_cwd(cwd, sizeof(cwd));
 	}
 
-	argv[off++] = "-e";
+	off = coma_terminal_argv(argv, COMA_SHELL_ARGV - 7, buf, sizeof(buf),
+	    hold, title, pwd, 1);
+	if (off == -1)
+		return;
 
-	if (client_active != NULL && client_active->host != NULL) {
-		if (strcmp(myhost, client_active->host)) {
-			argv[off++] = "coma-remote";
-			argv[off++] = client_active->host;
-			if (client_active->pwd)
-				argv[off++] = client_active->pwd;
-			local = 0;
+	if (remote) {
+		argv[off++] = coma_program_path();
+		argv[off++] = "-R";
+		if ((ctl = coma_remote_control(client_active->host)) != NULL) {
+			argv[off++] = "-S";
+			argv[off++] = ctl;
 		}
+		argv[off++] = client_active->host;
+		if (client_active->pwd)
+			argv[off++] = client_active->pwd;
+		else
+			argv[off++] = "~";
+	} else {
+		argv[off++] = coma_program_path();
+		argv[off++] = "-C";
 	}
 
-	if (local)
-		argv[off++] = "coma-cmd";
-
-	if (coma_split_arguments(cmd, argv + off, COMA_SHELL_ARGV - off)) {
-		if (!strcmp(argv[off], "vi") || !strcmp(argv[off], "vim"))
-			argv[1] = "+hold";
+	for (idx = 0; args[idx] != NULL; idx++) {
+		if (off >= COMA_SHELL_ARGV - 1)
+			return;
+		argv[off++] = args[idx];
+	}
 
-		if (title != -1)
-			argv[title] = argv[off];
+	argv[off] = NULL;
 
-		coma_execute(argv);
-	}
+	coma_execute(argv);
 }
 
 static void
@@ -648,14 +1198,14 @@ wm_run_shell_command(char *cmd)
 }
 
 static int
-wm_input(char *cmd, size_t len, void (*autocomplete)(char *, size_t))
+wm_input(char *cmd, size_t len, void (*complete)(char *, size_t, int))
 {
 	XEvent			evt;
 	KeySym			sym;
 	char			c[2];
 	size_t			clen;
 	Window			focus;
-	XftColor		*color;
+	XftColor		*color, *hint;
 	int			revert;
 	struct client		*client;
 
@@ -667,11 +1217,18 @@ wm_input(char *cmd, size_t len, void (*autocomplete)(char *, size_t))
 
 	client = client_active;
 	XGetInputFocus(dpy, &focus, &revert);
+	coma_stats_roundtrip();
 	XSetInputFocus(dpy, cmd_input, RevertToNone, CurrentTime);
 
 	color = coma_wm_color("command-input");
+	hint = coma_wm_color("command-hint");
+
+	cmd_hint[0] = '\0';
 
 	for (;;) {
+		if (complete != NULL)
+			complete(cmd, len, WM_INPUT_UPDATE);
+
 		clen = strlen(cmd);
 
 		XClearWindow(dpy, cmd_input);
@@ -681,7 +1238,12 @@ wm_input(char *cmd, size_t len, void (*autocomplete)(char *, size_t))
 			    5, 15, (const FcChar8 *)cmd, clen);
 		}
 
-		XMaskEvent(dpy, KeyPressMask, &evt);
+		if (cmd_hint[0] != '\0') {
+			XftDrawStringUtf8(cmd_xft, hint, font, 5, 30,
+			    (const FcChar8 *)cmd_hint, strlen(cmd_hint));
+		}
+
+		wm_key_wait(&evt);
 		sym = XkbKeycodeToKeysym(dpy, evt.xkey.keycode, 0,
 		    (evt.xkey.state & ShiftMask));
 
@@ -694,9 +1256,15 @@ wm_input(char *cmd, size_t len, void (*autocomplete)(char *, size_t))
 			continue;
 		}
 
-		if (sym == XK_Tab) {
-			if (autocomplete != NULL)
-				autocomplete(cmd, len);
+		if (sym == XK_Tab || sym == XK_Up || sym == XK_Down) {
+			if (complete == NULL)
+				continue;
+			if (sym == XK_Tab)
+				complete(cmd, len, WM_INPUT_TAB);
+			else if (sym == XK_Up)
+				complete(cmd, len, WM_INPUT_PREV);
+			else
+				complete(cmd, len, WM_INPUT_NEXT);
 			continue;
 		}
 
@@ -727,13 +1295,11 @@ wm_client_list(void)
 	XEvent			evt;
 	KeySym			sym;
 	Window			focus;
-	struct frame		*prev;
-	XftColor		*color;
-	char			c, buf[128];
-	struct client		*client, *cl, *list[16];
-	int			revert, y, idx, len, limit;
-
-	color = coma_wm_color("command-input");
+	struct client		*client, *cl;
+	struct wm_match		*matches;
+	char			c[2], query[64];
+	int			revert, narrow;
+	size_t			total, count, sel, top;
 
 	XSelectInput(dpy, clients_win, KeyPressMask);
 	XMapWindow(dpy, clients_win);
@@ -741,139 +1307,234 @@ wm_client_list(void)
 
 	client = client_active;
 	XGetInputFocus(dpy, &focus, &revert);
+	coma_stats_roundtrip();
 	XSetInputFocus(dpy, clients_win, RevertToNone, CurrentTime);
 
-	XClearWindow(dpy, clients_win);
+	total = 0;
+	TAILQ_FOREACH(cl, &clients, glist)
+		total++;
 
-	y = 20;
-	idx = 0;
+	matches = coma_calloc(total == 0 ? 1 : total, sizeof(*matches));
 
-	TAILQ_FOREACH(cl, &clients, glist) {
-		if (idx > 15)
-			break;
+	sel = 0;
+	top = 0;
+	narrow = 0;
+	count = 0;
+	memset(query, 0, sizeof(query));
 
-		if (idx < 10)
-			c = '0' + idx;
-		else
-			c = 'a' + (idx - 10);
+	for (;;) {
+		count = wm_client_filter(matches, count, query, narrow);
 
-		if (cl->tag) {
-			len = snprintf(buf, sizeof(buf),
-			    "#%c [%s] [%s]", c, cl->tag, cl->host);
-		} else if (cl->cmd) {
-			len = snprintf(buf, sizeof(buf),
-			    "#%c [%s] [%s]", c, cl->cmd, cl->host);
-		} else {
-			len = snprintf(buf, sizeof(buf),
-			    "#%c [%s]", c, cl->host);
-		}
+		if (sel >= count)
+			sel = count > 0 ? count - 1 : 0;
+		if (sel < top)
+			top = sel;
+		if (sel >= top + WM_CLIENT_ROWS)
+			top = sel - WM_CLIENT_ROWS + 1;
 
-		if (len == -1 || (size_t)len >= sizeof(buf))
-			len = snprintf(buf, sizeof(buf), "#%c [unknown]", c);
+		wm_client_draw(matches, count, query, sel, top);
 
-		if (len == -1 || (size_t)len >= sizeof(buf))
-			fatal("failed to construct client list buffer");
+		wm_key_wait(&evt);
+		sym = XkbKeycodeToKeysym(dpy, evt.xkey.keycode, 0,
+		    (evt.xkey.state & ShiftMask));
 
-		XftDrawStringUtf8(clients_xft, color, font,
-		    5, y, (const FcChar8 *)buf, len);
+		narrow = -1;
 
-		y += 15;
+		if (sym == XK_Escape) {
+			count = 0;
+			break;
+		}
+
+		if (sym == XK_Return)
+			break;
 
-		list[idx++] = cl;
+		if (sym == XK_Up) {
+			if (sel > 0)
+				sel--;
+		} else if (sym == XK_Down) {
+			sel++;
+		} else if (sym == XK_BackSpace) {
+			if (query[0] != '\0') {
+				query[strlen(query) - 1] = '\0';
+				narrow = 0;
+			}
+		} else if (sym >= XK_space && sym <= XK_asciitilde) {
+			c[0] = tolower((int)sym);
+			c[1] = '\0';
+			if (strlcat(query, c, sizeof(query)) < sizeof(query)) {
+				narrow = 1;
+				sel = 0;
+			} else {
+				query[strlen(query) - 1] = '\0';
+			}
+		}
 	}
 
-	limit = idx;
-	idx = -1;
+	XUnmapWindow(dpy, clients_win);
 
-	for (;;) {
-		XMaskEvent(dpy, KeyPressMask, &evt);
+	if (count > 0)
+		coma_client_select(matches[sel].client);
 
-		if (evt.type != KeyPress)
-			continue;
+	free(matches);
 
-		sym = XkbKeycodeToKeysym(dpy, evt.xkey.keycode, 0,
-		    (evt.xkey.state & ShiftMask));
+	if (client == client_active)
+		XSetInputFocus(dpy, focus, RevertToPointerRoot, CurrentTime);
+}
 
-		if (sym == XK_Escape)
-			break;
+/*
+ * Score the clients against query. If narrow is set the query only
+ * grew and just the previous matches are looked at again, if it is -1
+ * nothing changed. Returns the number of matches, best first.
+ */
+static size_t
+wm_client_filter(struct wm_match *matches, size_t count, const char *query,
+    int narrow)
+{
+	int			score;
+	u_int64_t		mask;
+	struct client		*cl;
+	size_t			idx, n, qlen;
 
-		if (sym >= XK_0 && sym <= XK_9) {
-			idx = sym - XK_0;
-			if (idx < limit)
-				break;
-		}
+	if (narrow == -1)
+		return (count);
 
-		if (sym >= XK_a && sym <= XK_f) {
-			idx = (sym - XK_a) + 10;
-			if (idx < limit)
-				break;
+	qlen = strlen(query);
+	mask = coma_client_search_mask(query);
+
+	n = 0;
+
+	if (narrow) {
+		for (idx = 0; idx < count; idx++) {
+			score = coma_client_search(matches[idx].client,
+			    query, qlen, mask);
+			if (score == -1)
+				continue;
+			matches[n] = matches[idx];
+			matches[n++].score = score;
+		}
+	} else {
+		idx = 0;
+		TAILQ_FOREACH(cl, &clients, glist) {
+			score = coma_client_search(cl, query, qlen, mask);
+			if (score != -1) {
+				matches[n].client = cl;
+				matches[n].score = score;
+				matches[n++].order = idx;
+			}
+			idx++;
 		}
 	}
 
-	XUnmapWindow(dpy, clients_win);
+	qsort(matches, n, sizeof(*matches), wm_client_cmp);
+
+	return (n);
+}
 
-	if (idx != -1 && idx < limit) {
-		prev = frame_active;
-		frame_active = list[idx]->frame;
+/* Only the rows that fit in the window are built and drawn. */
+static void
+wm_client_draw(struct wm_match *matches, size_t count, const char *query,
+    size_t sel, size_t top)
+{
+	int			y, len;
+	XftColor		*color, *hint;
+	struct client		*cl;
+	size_t			idx;
+	char			buf[256];
+
+	color = coma_wm_color("command-input");
+	hint = coma_wm_color("command-hint");
+
+	XClearWindow(dpy, clients_win);
 
-		if (frame_active == frame_popup && prev != frame_popup)
-			coma_frame_popup_show();
+	len = snprintf(buf, sizeof(buf), "> %s", query);
+	if (len > 0 && (size_t)len < sizeof(buf)) {
+		XftDrawStringUtf8(clients_xft, color, font,
+		    5, 15, (const FcChar8 *)buf, len);
+	}
+
+	y = 35;
 
-		if (frame_active != frame_popup && prev == frame_popup) {
-			coma_frame_popup_hide();
-			frame_active = list[idx]->frame;
+	for (idx = top; idx < count && idx < top + WM_CLIENT_ROWS; idx++) {
+		cl = matches[idx].client;
+
+		if (cl->tag) {
+			len = snprintf(buf, sizeof(buf), "[%s] [%s] %s",
+			    cl->tag, cl->host ? cl->host : "-",
+			    cl->pwd ? cl->pwd : "");
+		} else {
+			len = snprintf(buf, sizeof(buf), "[%s] [%s] %s",
+			    cl->cmd ? cl->cmd : "unknown",
+			    cl->host ? cl->host : "-",
+			    cl->pwd ? cl->pwd : "");
 		}
 
-		coma_client_focus(list[idx]);
-		coma_client_warp_pointer(list[idx]);
+		if (len == -1)
+			continue;
+		if ((size_t)len >= sizeof(buf))
+			len = sizeof(buf) - 1;
+
+		XftDrawStringUtf8(clients_xft, idx == sel ? color : hint,
+		    font, 5, y, (const FcChar8 *)buf, len);
+
+		y += 15;
 	}
+}
 
-	if (client == client_active)
-		XSetInputFocus(dpy, focus, RevertToPointerRoot, CurrentTime);
+static int
+wm_client_cmp(const void *a, const void *b)
+{
+	const struct wm_match	*ma = a;
+	const struct wm_match	*mb = b;
+
+	if (ma->score != mb->score)
+		return (mb->score - ma->score);
+
+	return (ma->order < mb->order ? -1 : ma->order > mb->order);
 }
 
-static void
-wm_layout_swap(void)
+/* Wait for a key from 1 to 9, returns 0 to 8 or -1 for anything else. */
+static int
+wm_pick(void)
 {
 	XEvent		evt;
 	KeySym		sym;
-	char		*argv[4], *layout;
 
-	for (;;) {
-		XMaskEvent(dpy, KeyPressMask, &evt);
+	do {
+		wm_key_wait(&evt);
+	} while (evt.type != KeyPress);
 
-		if (evt.type != KeyPress)
-			continue;
+	sym = XkbKeycodeToKeysym(dpy, evt.xkey.keycode, 0,
+	    (evt.xkey.state & ShiftMask));
 
-		sym = XkbKeycodeToKeysym(dpy, evt.xkey.keycode, 0,
-		    (evt.xkey.state & ShiftMask));
+	if (sym < XK_1 || sym > XK_9)
+		return (-1);
 
-		if (sym == XK_Escape)
-			break;
+	return (sym - XK_1);
+}
 
-		switch (sym) {
-		case XK_1:
-			layout = "default";
-			break;
-		case XK_2:
-			layout = "small-large";
-			break;
-		case XK_3:
-			layout = "small-dual";
-			break;
-		default:
-			return;
-		}
+static void
+wm_layout_swap(void)
+{
+	int			idx;
+	struct coma_layout	*layout;
 
-		coma_log("swapping to layout *%s'", layout);
-		argv[0] = coma_program_path();
-		argv[1] = "-l";
-		argv[2] = layout;
-		argv[3] = NULL;
+	/* 1 is the first layout, builtins first. */
+	if ((idx = wm_pick()) == -1 || (layout = coma_layout_nth(idx)) == NULL)
+		return;
 
-		execvp(argv[0], argv);
-		fatal("failed to execute %s: %s", argv[0], errno_s);
-	}
+	(void)coma_frame_layout_switch(coma_layout_name(layout));
+}
+
+static void
+wm_workspace_select(void)
+{
+	int			idx;
+	struct coma_workspace	*ws;
+
+	if ((idx = wm_pick()) == -1 || (ws = coma_workspace_nth(idx)) == NULL)
+		return;
+
+	coma_workspace_switch(ws);
 }
 
 static void
@@ -887,7 +1548,7 @@ wm_client_check(Window window)
 	}
 
 	coma_log("discovered window 0x%08x with pid %u", window, pid);
-	coma_client_create(window);
+	coma_client_create(window, NULL);
 }
 
 static void
@@ -913,10 +1574,12 @@ wm_handle_prefix(XKeyEvent *prefix)
 	Window			focus;
 	struct frame		*frame;
 	struct client		*client;
+	struct coma_sample	sample;
 	int			revert, i;
 
 	client = client_active;
 	XGetInputFocus(dpy, &focus, &revert);
+	coma_stats_roundtrip();
 
 	sym = XkbKeycodeToKeysym(dpy, prefix->keycode, 0, 0);
 
@@ -926,7 +1589,7 @@ wm_handle_prefix(XKeyEvent *prefix)
 	XSetInputFocus(dpy, key_input, RevertToNone, CurrentTime);
 
 	for (;;) {
-		XMaskEvent(dpy, KeyPressMask, &evt);
+		wm_key_wait(&evt);
 
 		if (evt.type != KeyPress)
 			goto out;
@@ -951,7 +1614,7 @@ wm_handle_prefix(XKeyEvent *prefix)
 
 	for (i = 0; actions[i].name != NULL; i++) {
 		if (actions[i].sym == sym) {
-			actions[i].cb();
+			(void)coma_wm_action(actions[i].name);
 			break;
 		}
 	}
@@ -959,10 +1622,12 @@ wm_handle_prefix(XKeyEvent *prefix)
 	if (actions[i].name == NULL) {
 		LIST_FOREACH(ua, &uactions, list) {
 			if (ua->sym == sym) {
+				coma_stats_begin(&sample);
 				if (ua->shell)
 					wm_run_shell_command(ua->action);
 				else
 					wm_run_command(ua->action, ua->hold);
+				coma_stats_end(ua->stat, &sample);
 				break;
 			}
 		}
@@ -973,6 +1638,15 @@ out:
 		XSetInputFocus(dpy, focus, RevertToPointerRoot, CurrentTime);
 }
 
+/* Block for the next key, the time the user takes is not ours. */
+static void
+wm_key_wait(XEvent *evt)
+{
+	coma_stats_wait();
+	XMaskEvent(dpy, KeyPressMask, evt);
+	coma_stats_resume();
+}
+
 static void
 wm_mouse_click(XButtonEvent *evt)
 {
@@ -995,44 +1669,88 @@ static void
 wm_window_map(XMapRequestEvent *evt)
 {
 	struct client		*client;
+	struct coma_placement	place;
+
+	if (coma_pool_claim(evt->window))
+		return;
+
+	if ((client = coma_client_find(evt->window)) != NULL)
+		return;
+
+	/* Decided before the window is ever mapped, so it never moves. */
+	if (coma_rule_place(evt->window, &place) == -1) {
+		coma_client_create(evt->window, NULL);
+		return;
+	}
+
+	coma_client_create(evt->window, &place);
+
+	if (place.frame == frame_popup && frame_active != frame_popup)
+		coma_frame_popup_show();
+}
+
+static void
+wm_window_property(XPropertyEvent *evt)
+{
+	struct client		*client;
+
+	if (evt->atom != atom_client_status &&
+	    (evt->atom != XA_WM_NAME || evt->state != PropertyNewValue))
+		return;
 
 	if ((client = coma_client_find(evt->window)) == NULL)
-		coma_client_create(evt->window);
+		return;
+
+	/* Set by the shell hooks, deleting it falls back to the title. */
+	if (evt->atom == atom_client_status) {
+		if (coma_client_update_status(client))
+			coma_frame_bar_update(client->frame);
+		return;
+	}
+
+	coma_client_title_changed(client);
 }
 
 static void
 wm_window_configure(XConfigureRequestEvent *evt)
 {
+	size_t			idx;
 	XWindowChanges		cfg;
 	struct client		*client;
 
 	memset(&cfg, 0, sizeof(cfg));
 
 	if ((client = coma_client_find(evt->window)) != NULL) {
+		/* Only the border width is ever honoured. */
 		if (evt->value_mask & CWBorderWidth)
 			client->bw = evt->border_width;
 
-		if (evt->value_mask & CWWidth)
-			client->w = evt->width;
-
-		if (evt->value_mask & CWHeight)
-			client->h = evt->height;
-
-		if (evt->value_mask & CWX)
-			client->x = evt->x;
-
-		if (evt->value_mask & CWY)
-			client->y = evt->y;
+		for (idx = 0; idx < configure_count; idx++) {
+			if (configures[idx].window == evt->window)
+				break;
+		}
 
-		cfg.x = client->frame->x;
-		cfg.y = client->frame->y;
-		cfg.width = client->frame->w;
-		cfg.height = client->frame->h;
-		cfg.border_width = client->bw;
+		if (idx == configure_count) {
+			if (configure_count == configure_size) {
+				configure_size = configure_size == 0 ?
+				    16 : configure_size * 2;
+				configures = realloc(configures,
+				    configure_size * sizeof(*configures));
+				if (configures == NULL)
+					fatal("realloc: %s", errno_s);
+			}
+			configures[idx].window = evt->window;
+			configures[idx].border = 0;
+			configures[idx].requests = 0;
+			configure_count++;
+		} else {
+			/* Zero length samples, only the count matters. */
+			coma_stats_record(configure_merged, 0);
+		}
 
-		XConfigureWindow(dpy, evt->window, evt->value_mask, &cfg);
-		coma_client_adjust(client);
-		coma_client_send_configure(client);
+		configures[idx].requests++;
+		if (evt->value_mask & CWBorderWidth)
+			configures[idx].border = 1;
 	} else {
 		cfg.x = evt->x;
 		cfg.y = evt->y;
@@ -1045,6 +1763,47 @@ wm_window_configure(XConfigureRequestEvent *evt)
 	}
 }
 
+/*
+ * Clients in a frame do not get to pick their geometry, a burst of
+ * requests from one is answered with a single configure once all of
+ * them were read.
+ */
+static void
+wm_configure_flush(void)
+{
+	size_t			idx;
+	struct coma_sample	sample;
+	struct client		*client;
+
+	for (idx = 0; idx < configure_count; idx++) {
+		if ((client = coma_client_find(configures[idx].window)) == NULL)
+			continue;
+
+		coma_stats_begin(&sample);
+
+		if (configures[idx].requests > 1) {
+			coma_log("window 0x%08lx: %u configure requests merged",
+			    client->window, configures[idx].requests);
+		}
+
+		if (configures[idx].border)
+			XSetWindowBorderWidth(dpy, client->window, client->bw);
+
+		client->x = client->frame->x;
+		client->y = client->frame->y;
+		client->w = client->frame->w;
+		client->h = client->frame->h;
+
+		coma_client_send_configure(client);
+		coma_stats_end(configure_reply, &sample);
+	}
+
+	if (configure_count > 0) {
+		configure_count = 0;
+		coma_wm_sync(False);
+	}
+}
+
 static int
 wm_error(Display *edpy, XErrorEvent *error)
 {
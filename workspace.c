@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2019 Joris Vink <joris@coders.se>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Named workspaces, each with its own frames, popup and focus.
+ *
+ * Only the frames of the active workspace are loaded into frame.c,
+ * the others are parked here with their clients unmapped. Nothing in
+ * a parked workspace is configured, drawn or has its titles updated
+ * until it is shown again. A workspace gets its frames the first time
+ * it is needed.
+ */
+
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "coma.h"
+
+TAILQ_HEAD(coma_workspace_list, coma_workspace);
+
+static struct coma_workspace_list	workspaces =
+    TAILQ_HEAD_INITIALIZER(workspaces);
+static u_int32_t			workspace_id = 1;
+
+struct coma_workspace			*workspace_active = NULL;
+
+/* Returns -1 if a workspace with that name exists already. */
+int
+coma_workspace_define(const char *name)
+{
+	struct coma_workspace	*ws;
+
+	if (coma_workspace_find(name) != NULL)
+		return (-1);
+
+	ws = coma_calloc(1, sizeof(*ws));
+	ws->id = workspace_id++;
+
+	if ((ws->name = strdup(name)) == NULL)
+		fatal("strdup");
+
+	TAILQ_INIT(&ws->frames);
+	TAILQ_INIT(&ws->splits);
+
+	TAILQ_INSERT_TAIL(&workspaces, ws, list);
+
+	return (0);
+}
+
+/* Called before the first frames are created. */
+void
+coma_workspace_setup(void)
+{
+	if (TAILQ_EMPTY(&workspaces))
+		(void)coma_workspace_define(COMA_WORKSPACE_DEFAULT);
+
+	workspace_active = TAILQ_FIRST(&workspaces);
+
+	/* Frames from frame-create are already there, they go along. */
+	coma_frame_state_save(workspace_active);
+	coma_frame_state_load(workspace_active);
+}
+
+void
+coma_workspace_cleanup(void)
+{
+	struct coma_workspace	*ws;
+
+	while ((ws = TAILQ_FIRST(&workspaces)) != NULL) {
+		TAILQ_REMOVE(&workspaces, ws, list);
+		free(ws->name);
+		free(ws);
+	}
+
+	workspace_active = NULL;
+}
+
+struct coma_workspace *
+coma_workspace_lookup(u_int32_t id)
+{
+	struct coma_workspace	*ws;
+
+	TAILQ_FOREACH(ws, &workspaces, list) {
+		if (ws->id == id)
+			return (ws);
+	}
+
+	return (NULL);
+}
+
+struct coma_workspace *
+coma_workspace_find(const char *name)
+{
+	struct coma_workspace	*ws;
+
+	TAILQ_FOREACH(ws, &workspaces, list) {
+		if (!strcmp(ws->name, name))
+			return (ws);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Unmap what is mapped in the active workspace and map the focused
+ * clients of ws, the X server hears about it in one go.
+ */
+void
+coma_workspace_switch(struct coma_workspace *ws)
+{
+	if (ws == workspace_active)
+		return;
+
+	coma_frame_workspace_hide();
+	coma_frame_state_save(workspace_active);
+
+	workspace_active = ws;
+	coma_frame_state_load(ws);
+
+	if (frame_popup == NULL)
+		coma_frame_setup();
+
+	coma_frame_workspace_show();
+	coma_ewmh_desktops();
+
+	coma_log("workspace %s", ws->name);
+}
+
+void
+coma_workspace_next(void)
+{
+	struct coma_workspace	*ws;
+
+	if ((ws = TAILQ_NEXT(workspace_active, list)) == NULL)
+		ws = TAILQ_FIRST(&workspaces);
+
+	coma_workspace_switch(ws);
+}
+
+void
+coma_workspace_prev(void)
+{
+	struct coma_workspace	*ws;
+
+	if ((ws = TAILQ_PREV(workspace_active, coma_workspace_list, list)) ==
+	    NULL)
+		ws = TAILQ_LAST(&workspaces, coma_workspace_list);
+
+	coma_workspace_switch(ws);
+}
+
+/* Workspaces in the order they were defined, for the select keys. */
+struct coma_workspace *
+coma_workspace_nth(int idx)
+{
+	struct coma_workspace	*ws;
+
+	TAILQ_FOREACH(ws, &workspaces, list) {
+		if (idx-- == 0)
+			return (ws);
+	}
+
+	return (NULL);
+}
+
+/* The reverse of coma_workspace_nth(), -1 if ws is not known. */
+int
+coma_workspace_index(struct coma_workspace *ws)
+{
+	int			idx;
+	struct coma_workspace	*entry;
+
+	idx = 0;
+	TAILQ_FOREACH(entry, &workspaces, list) {
+		if (entry == ws)
+			return (idx);
+		idx++;
+	}
+
+	return (-1);
+}
+
+/*
+ * The frame a client that was in slot on workspace id when coma
+ * restarted goes to, its workspace gets its frames now if it had none
+ * yet. Returns NULL if there is no such frame in the active workspace.
+ */
+struct frame *
+coma_workspace_frame(u_int32_t id, u_int32_t slot)
+{
+	struct frame		*frame;
+	struct coma_workspace	*ws;
+
+	if ((ws = coma_workspace_lookup(id)) == NULL || ws == workspace_active)
+		return (coma_frame_slot(slot));
+
+	coma_frame_state_save(workspace_active);
+	coma_frame_state_load(ws);
+
+	if (frame_popup == NULL)
+		coma_frame_setup();
+
+	if ((frame = coma_frame_slot(slot)) == NULL)
+		frame = frame_active;
+
+	coma_frame_state_save(ws);
+	coma_frame_state_load(workspace_active);
+
+	return (frame);
+}
+
+/* Run cb with each parked workspace that has frames loaded in turn. */
+void
+coma_workspace_hidden(void (*cb)(void))
+{
+	struct coma_workspace	*ws;
+
+	coma_frame_state_save(workspace_active);
+
+	TAILQ_FOREACH(ws, &workspaces, list) {
+		if (ws == workspace_active || ws->popup == NULL)
+			continue;
+
+		coma_frame_state_load(ws);
+		cb();
+		coma_frame_state_save(ws);
+	}
+
+	coma_frame_state_load(workspace_active);
+}